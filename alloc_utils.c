@@ -1,72 +1,218 @@
 #include "alloc_utils.h"
 
-/*  FUNCTION: alloc_2d
-    INPUT:  size_t x, number of rows
-            size_t y, number of columns
-    OUTPUT: 2-dimensional array of characters.
+/*  FUNCTION: reserve_buffer
+    INPUT:  buf, pointer to the buffer to grow.
+            cap, pointer to the capacity of the buffer.
+            need, the number of bytes required.
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (the buffer is left as it was).
 
-    A 2-d array of characters is allocated by malloc, if the allocation fails (i.e. the returned pointer is NULL), an error message is printed out and the program exits.
+    The capacity starts from 256 bytes and doubles until it holds need bytes, so that a buffer growing a little at a time is reallocated only a logarithmic number of times.
+*/
+int reserve_buffer(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return 0;
+    size_t new_cap = *cap ? *cap : 256;
+    while (new_cap < need)
+        new_cap *= 2;
+    char *tmp = realloc(*buf, new_cap);
+    if (tmp == NULL)
+        return -1;
+    stats_alloc();
+    *buf = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+/*  FUNCTION: new_block
+    INPUT:  arena, an arena.
+            cap, the bytes of the block.
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
 
+    Puts a new block in front of the blocks of the arena.
 */
-char **alloc_2d(size_t x, size_t y)
+static int new_block(Arena *arena, size_t cap)
 {
-    char **out_2d = malloc(x * sizeof(*out_2d));
-    if (out_2d == NULL)
+    Arena_block *b = malloc(sizeof(*b) + cap);
+    if (b == NULL)
+        return -1;
+    stats_alloc();
+    b->next = arena->head;
+    b->cap = cap;
+    b->used = 0;
+    arena->head = b;
+    arena->total += cap;
+    return 0;
+}
+
+/*  FUNCTION: arena_alloc
+    INPUT:  arena, an arena.
+            n, the number of bytes required.
+    OUTPUT: a piece of memory aligned for any type, NULL if the memory could not be allocated.
+
+    The piece is taken from the current block. When it does not fit a new block is added, as large as the whole arena so far (at least ARENA_BLOCK_BYTES and n): the arena doubles, so it reaches any size with few allocations.
+*/
+void *arena_alloc(Arena *arena, size_t n)
+{
+    size_t align = _Alignof(max_align_t);
+    n = (n + align - 1) & ~(align - 1);
+    Arena_block *b = arena->head;
+    if (b == NULL || b->cap - b->used < n)
     {
-        perror("Error allocating the matrix");
-        exit(EXIT_FAILURE);
+        size_t cap = arena->total > ARENA_BLOCK_BYTES ? arena->total : ARENA_BLOCK_BYTES;
+        if (cap < n)
+            cap = n;
+        if (new_block(arena, cap) == -1)
+            return NULL;
+        b = arena->head;
     }
-    for (size_t i = 0; i < x; i++)
+    void *p = (char *)b->data + b->used;
+    b->used += n;
+    return p;
+}
+
+/*  FUNCTION: arena_reset
+    INPUT:  arena, an arena.
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
+
+    A single block is simply emptied. If the arena had to grow beyond its block, its blocks are replaced by one as large as all of them: the next use of the same size fits in it and allocates nothing.
+*/
+int arena_reset(Arena *arena)
+{
+    if (arena->head == NULL || arena->head->next == NULL)
     {
-        out_2d[i] = calloc(y, sizeof(**out_2d));
-        if (out_2d[i] == NULL)
-        {
-            perror("Error allocating a row");
-            exit(EXIT_FAILURE);
-        }
+        if (arena->head != NULL)
+            arena->head->used = 0;
+        return 0;
     }
-
-    return out_2d;
+    size_t total = arena->total;
+    arena_free(arena);
+    return new_block(arena, total);
 }
 
-/*  FUNCTION free_2d
-    INPUT: a pointer to a 2D array of type char
-           x the number of rows of the array
+/*  FUNCTION: arena_free
+    INPUT:  arena, an arena.
     OUTPUT: void
+*/
+void arena_free(Arena *arena)
+{
+    while (arena->head != NULL)
+    {
+        Arena_block *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->total = 0;
+}
 
-    The function frees the memory allocated for the 2D array. It works with arrays created with malloc.
+/*  FUNCTION: init_page
+    INPUT:  a pointer to the page to allocate
+            size_t n_rows, number of rows
+            size_t width, capacity of a row in bytes
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
 
+    The rows and their lengths are allocated by two calls of malloc (instead of one per row), the lengths are set to zero. On failure nothing is left allocated.
 */
-void free_2d(char **arr_2d, size_t x)
+int init_page(Page *page, size_t n_rows, size_t width)
 {
-
-    for (size_t i = 0; i < x; i++)
+    page->n_rows = n_rows;
+    page->width = width;
+    page->rows = malloc(n_rows * width);
+    page->len = calloc(n_rows, sizeof(*page->len));
+    if (page->rows == NULL || page->len == NULL)
     {
-        free(arr_2d[i]);
+        free_page(page);
+        return -1;
     }
-    free(arr_2d);
+    stats_alloc();
+    stats_alloc();
+    return 0;
+}
+
+/*  FUNCTION: free_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+
+    Frees the rows and the lengths of the page.
+*/
+void free_page(Page *page)
+{
+    free(page->rows);
+    free(page->len);
+    page->rows = NULL;
+    page->len = NULL;
 }
 
-/*  FUNCTION resize_buffer
-    INPUT:  a pointer to a char pointer **buffer
-            a size_t variable linelen, which represents a required length of the buffer
-    OUTPUT: the resized buffer
+/*  FUNCTION: clear_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
 
-    If the original buffer is NULL or its length is less than linelen, the function resizes the buffer using realloc. If the resizing is successful, the function returns the new buffer. If the resizing fails, it frees the original buffer, outputs an error message using perror, and exits the program with failure status.
+    Only the lengths are reset, the content of the rows is overwritten later.
 */
-char *resize_buffer(char **buffer, size_t linelen)
+void clear_page(Page *page)
 {
-    if (*buffer == NULL || strlen(*buffer) < linelen)
+    memset(page->len, 0, page->n_rows * sizeof(*page->len));
+}
+
+/*  FUNCTION: init_span_page
+    INPUT:  a pointer to the page to allocate
+            int n_rows, number of rows
+            int n_cols, number of columns
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
+
+    The pieces and the counts of the columns filled are allocated once, the page starts empty. On failure nothing is left allocated.
+*/
+int init_span_page(Span_page *page, int n_rows, int n_cols)
+{
+    page->n_rows = n_rows;
+    page->n_cols = n_cols;
+    page->bytes = 0;
+    page->spans = malloc(2 * (size_t)n_rows * n_cols * sizeof(*page->spans));
+    page->n_filled = calloc(n_rows, sizeof(*page->n_filled));
+    if (page->spans == NULL || page->n_filled == NULL)
     {
-        char *buffer2 = realloc(*buffer, linelen + 1);
-        if (buffer2 != NULL)
-            *buffer = buffer2;
-        else
-        {
-            free(*buffer);
-            perror("Error reallocating");
-            exit(EXIT_FAILURE);
-        }
+        free_span_page(page);
+        return -1;
     }
-    return *buffer;
+    stats_alloc();
+    stats_alloc();
+    return 0;
+}
+
+/*  FUNCTION: free_span_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+*/
+void free_span_page(Span_page *page)
+{
+    free(page->spans);
+    free(page->n_filled);
+    page->spans = NULL;
+    page->n_filled = NULL;
+}
+
+/*  FUNCTION: clear_span_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+
+    Only the counts are reset, the pieces are overwritten later.
+*/
+void clear_span_page(Span_page *page)
+{
+    memset(page->n_filled, 0, page->n_rows * sizeof(*page->n_filled));
+    page->bytes = 0;
+}
+
+/*  FUNCTION: set_row
+    INPUT:  a pointer to a page
+            the index of the row
+            the string to copy in the row
+    OUTPUT: void
+
+    Replaces the content of a row with a string, which must fit in the row.
+*/
+void set_row(Page *page, size_t i, const char *str)
+{
+    page->len[i] = strlen(str);
+    memcpy(page_row(page, i), str, page->len[i]);
 }
\ No newline at end of file
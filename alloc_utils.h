@@ -4,32 +4,178 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include "stats.h"
 
-/*  FUNCTION: alloc_2d
-    INPUT:  size_t x, number of rows
-            size_t y, number of columns
-    OUTPUT: 2-dimensional array of characters.
+#define ARENA_BLOCK_BYTES (64 << 10) // the first block of an arena, the next ones double the arena
 
-    Allocates a 2-d array of characters.
+/*  FUNCTION: reserve_buffer
+    INPUT:  a pointer to the buffer to grow
+            a pointer to the capacity of the buffer
+            the number of bytes required
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (the buffer is left as it was).
+
+    Doubles the capacity of the buffer until it holds the bytes required, the content is kept. The capacity, not the content, tells whether the buffer must grow, so a buffer reused for the whole run stops growing at the largest size needed.
+*/
+int reserve_buffer(char **, size_t *, size_t);
+
+/*      The struct contains a block of an arena:
+        struct Arena_block *next - the block filled before this one.
+        size_t cap, used - the bytes of the block and the bytes handed out.
+        max_align_t data[] - the memory handed out.
+*/
+typedef struct Arena_block
+{
+    struct Arena_block *next;
+    size_t cap, used;
+    max_align_t data[];
+} Arena_block;
+
+/*      The struct contains an arena, memory handed out in pieces and given back all at once:
+        Arena_block *head - the block the pieces are taken from, followed by the blocks already filled (NULL if none).
+        size_t total - the bytes of all the blocks.
+
+        A zeroed struct is an empty arena. The pieces are never freed one by one: arena_reset gives them all back, keeping the memory for the next use, so that an arena reset for every batch of lines or every document allocates nothing once it has grown to the largest size needed.
+*/
+typedef struct Arena
+{
+    Arena_block *head;
+    size_t total;
+} Arena;
+
+/*  FUNCTION: arena_alloc
+    INPUT:  a pointer to an arena
+            the number of bytes required
+    OUTPUT: a piece of memory aligned for any type, valid until the arena is reset or freed, NULL if the memory could not be allocated.
+*/
+void *arena_alloc(Arena *, size_t);
+
+/*  FUNCTION: arena_reset
+    INPUT:  a pointer to an arena
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (the arena is then empty, but usable).
+
+    Gives back all the pieces of the arena.
 */
-char **alloc_2d(size_t, size_t);
+int arena_reset(Arena *);
 
-/*  FUNCTION free_2d
-    INPUT:  a pointer to a 2D array of type char
-            the number of rows of the array
+/*  FUNCTION: arena_free
+    INPUT:  a pointer to an arena
     OUTPUT: void
 
-    The function frees the memory allocated for the 2D array. It works with arrays created with malloc.
+    Frees the blocks of the arena, which is left empty.
 */
-void free_2d(char **, size_t);
+void arena_free(Arena *);
 
-/*  FUNCTION resize_buffer
-    INPUT:  a pointer to a char pointer **buffer
-            a size_t variable linelen, which represents a required length of the buffer
-    OUTPUT: the resized buffer
+/*      The struct contains a page of text stored in a single allocation:
+        char *rows - the rows, one after the other, each one width bytes long.
+        size_t *len - the number of bytes used in each row (the rows are not null terminated).
+        size_t n_rows - the number of rows.
+        size_t width - the capacity of a row in bytes.
+*/
+typedef struct Page
+{
+    char *rows;
+    size_t *len;
+    size_t n_rows;
+    size_t width;
+} Page;
+
+/*  FUNCTION: init_page
+    INPUT:  a pointer to the page to allocate
+            size_t n_rows, number of rows
+            size_t width, capacity of a row in bytes
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
+
+    As alloc_page, but a failure is reported to the caller instead of terminating the program.
+*/
+int init_page(Page *, size_t, size_t);
+
+/*  FUNCTION: free_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+
+    Frees the memory allocated for the page.
+*/
+void free_page(Page *);
+
+/*  FUNCTION: clear_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+
+    Empties all the rows of the page.
+*/
+void clear_page(Page *);
+
+/*  FUNCTION: set_row
+    INPUT:  a pointer to a page
+            the index of the row
+            the string to copy in the row
+    OUTPUT: void
+
+    Replaces the content of a row with a string, which must fit in the row.
+*/
+void set_row(Page *, size_t, const char *);
+
+/*      The struct contains a piece of a row of a page, described instead of copied:
+        size_t off - the offset of the text in the buffer the page refers to.
+        unsigned len - the number of bytes of the text (words separated by single spaces).
+        unsigned gap - the number of spaces written for each space of the text.
+        unsigned pad - the number of spaces written after the text.
+*/
+typedef struct Span
+{
+    size_t off;
+    unsigned len;
+    unsigned gap;
+    unsigned pad;
+} Span;
+
+/*      The struct contains a page described by the pieces of text it is made of:
+        Span *spans - two pieces for each column of each row, those of row i and column j at spans[2 * (i * n_cols + j)].
+        int *n_filled - the number of columns filled in each row.
+        int n_rows, n_cols - the number of rows (without the new page symbol) and of columns.
+        size_t bytes - the number of bytes of the rows, without the newlines.
+
+        A column of a row is at most two pieces: a justified row is its words but the last, with the spaces between them widened, and the last word. An unused piece is empty. The memory of the page depends only on the number of rows and columns, not on their width.
+*/
+typedef struct Span_page
+{
+    Span *spans;
+    int *n_filled;
+    int n_rows, n_cols;
+    size_t bytes;
+} Span_page;
+
+/*  FUNCTION: init_span_page
+    INPUT:  a pointer to the page to allocate
+            int n_rows, number of rows
+            int n_cols, number of columns
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
+*/
+int init_span_page(Span_page *, int, int);
+
+/*  FUNCTION: free_span_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+*/
+void free_span_page(Span_page *);
+
+/*  FUNCTION: clear_span_page
+    INPUT:  a pointer to a page
+    OUTPUT: void
+
+    Empties all the rows of the page.
+*/
+void clear_span_page(Span_page *);
 
-    Resize a buffer string to a given size.
+/*  FUNCTION: page_row
+    INPUT:  a pointer to a page
+            the index of the row
+    OUTPUT: a pointer to the first byte of the row.
 */
-char *resize_buffer(char **, size_t);
+static inline char *page_row(const Page *page, size_t i)
+{
+    return page->rows + i * page->width;
+}
 
 #endif
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "batch.h"
+
+/*      The struct contains the state of a batch run, shared by the workers:
+        Doc_list *list - the documents.
+        Split_layout layout - the layout of the pages.
+        size_t out_cap - the size of the output buffer of a worker.
+        atomic size_t next - the next document to be taken by a worker.
+        atomic size_t failed - the documents that could not be formatted.
+        atomic uint64_t bytes_in, bytes_out, pages - the totals of the documents formatted.
+*/
+typedef struct Doc_run
+{
+    Doc_list *list;
+    Split_layout layout;
+    size_t out_cap;
+    _Atomic size_t next;
+    _Atomic size_t failed;
+    _Atomic uint64_t bytes_in, bytes_out, pages;
+} Doc_run;
+
+/*      The struct contains the state of a worker, reused from document to document:
+        Out_stream out - the output buffer, its descriptor is the output file of the current document.
+        int write_err - the errno of the first failed write of the current document, 0 if none.
+        uint64_t bytes_in, bytes_out, pages - the totals of the documents formatted by the worker.
+*/
+typedef struct Doc_worker
+{
+    Out_stream out;
+    int write_err;
+    uint64_t bytes_in, bytes_out, pages;
+} Doc_worker;
+
+/*  FUNCTION: xstrdup
+    INPUT:  str, a string.
+    OUTPUT: a copy of the string.
+
+    If the memory cannot be allocated an error message is printed out and the program exits.
+*/
+static char *xstrdup(const char *str)
+{
+    char *copy = strdup(str);
+    if (copy == NULL)
+    {
+        perror("Error allocating the list of documents");
+        exit(EXIT_FAILURE);
+    }
+    return copy;
+}
+
+/*  FUNCTION: add_doc
+    INPUT:  list, the documents of a batch.
+            in_path, the input file.
+            out_path, the output file, NULL to derive it from in_path.
+            out_dir, the directory of the derived output files, NULL for the directory of the input.
+    OUTPUT: void
+
+    If the memory cannot be allocated an error message is printed out and the program exits.
+*/
+void add_doc(Doc_list *list, const char *in_path, const char *out_path, const char *out_dir)
+{
+    if (list->n_docs == list->cap)
+    {
+        size_t new_cap = list->cap ? 2 * list->cap : 64;
+        Doc *tmp = realloc(list->docs, new_cap * sizeof(*tmp));
+        if (tmp == NULL)
+        {
+            perror("Error allocating the list of documents");
+            exit(EXIT_FAILURE);
+        }
+        list->docs = tmp;
+        list->cap = new_cap;
+    }
+    Doc *doc = &list->docs[list->n_docs++];
+    doc->in_path = xstrdup(in_path);
+    if (out_path != NULL)
+    {
+        doc->out_path = xstrdup(out_path);
+        return;
+    }
+    const char *base = in_path;
+    if (out_dir != NULL && strrchr(in_path, '/') != NULL)
+        base = strrchr(in_path, '/') + 1;
+    size_t n = (out_dir ? strlen(out_dir) + 1 : 0) + strlen(base) + strlen(OUT_SUFFIX) + 1;
+    doc->out_path = malloc(n);
+    if (doc->out_path == NULL)
+    {
+        perror("Error allocating the list of documents");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(doc->out_path, n, "%s%s%s%s", out_dir ? out_dir : "", out_dir ? "/" : "", base, OUT_SUFFIX);
+}
+
+/*  FUNCTION: read_manifest
+    INPUT:  list, the documents of a batch.
+            path, the manifest: one document per line, the input file optionally followed by a tab and the output file.
+            out_dir, the directory of the derived output files, NULL for the directory of the input.
+    OUTPUT: void
+
+    If the manifest cannot be read an error message is printed out and the program exits.
+*/
+void read_manifest(Doc_list *list, const char *path, const char *out_dir)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) != -1)
+    {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        char *tab = strchr(line, '\t');
+        if (tab != NULL)
+            *tab++ = '\0';
+        add_doc(list, line, tab, out_dir);
+    }
+    if (ferror(f))
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    free(line);
+    fclose(f);
+}
+
+/*  FUNCTION: free_docs
+    INPUT:  list, the documents of a batch.
+    OUTPUT: void
+*/
+void free_docs(Doc_list *list)
+{
+    for (size_t k = 0; k < list->n_docs; k++)
+    {
+        free(list->docs[k].in_path);
+        free(list->docs[k].out_path);
+    }
+    free(list->docs);
+    memset(list, 0, sizeof(*list));
+}
+
+/*  FUNCTION: doc_write
+    INPUT:  ctx, a pointer to the worker.
+            iov, the buffers flushed by the output buffer.
+            iovcnt, the number of buffers.
+    OUTPUT: void
+
+    Writes the buffers to the output file of the document. A write error is recorded instead of terminating the program, and the following writes of the document are skipped.
+*/
+static void doc_write(void *ctx, struct iovec *iov, int iovcnt)
+{
+    Doc_worker *w = ctx;
+    if (w->write_err == 0 && writev_all(w->out.fd, iov, iovcnt) == -1)
+        w->write_err = errno;
+}
+
+/*  FUNCTION: doc_sink
+    INPUT:  ctx, a pointer to the worker.
+            page, a page as text.
+            len, the length of the page.
+    OUTPUT: 0, or 1 after a write error, to stop the layout of the document.
+*/
+static int doc_sink(void *ctx, const char *page, size_t len)
+{
+    Doc_worker *w = ctx;
+    out_write(&w->out, page, len);
+    w->bytes_out += len;
+    w->pages++;
+    return w->write_err != 0;
+}
+
+/*  FUNCTION: format_doc
+    INPUT:  ctx, the context of the worker.
+            w, the worker.
+            doc, the document.
+    OUTPUT: 0 on success, -1 if the document could not be formatted (the error has been printed out).
+
+    The input is read in chunks as in the single-process version and the pages go through the output buffer of the worker to the output file. After a layout error the pages completed so far are kept, as in the single-process version; after a read or write error the partial output file, if it is a regular file, is removed. Either way the error is reported, the document is not counted in the totals and the context is reset for the next document.
+*/
+static int format_doc(Split_ctx *ctx, Doc_worker *w, const Doc *doc)
+{
+    uint64_t bytes_in = w->bytes_in, bytes_out = w->bytes_out, pages = w->pages; // the totals before the document
+    In_stream in;
+    if (init_input(&in, doc->in_path) == -1)
+    {
+        fprintf(stderr, "%s: %s\n", doc->in_path, strerror(errno));
+        return -1;
+    }
+    int fd = open(doc->out_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        fprintf(stderr, "%s: %s\n", doc->out_path, strerror(errno));
+        close_input(&in);
+        return -1;
+    }
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode); // only a regular file is removed after an error
+    w->out.fd = fd;
+    w->write_err = 0;
+
+    const char *data;
+    ssize_t n = 0;
+    int read_err = 0;
+    Split_status status = SPLIT_OK;
+    while (status == SPLIT_OK && (n = read_chunk(&in, &data)) > 0)
+    {
+        w->bytes_in += n;
+        status = split_feed(ctx, data, n);
+    }
+    if (n == -1)
+        read_err = errno;
+    else if (status == SPLIT_OK)
+        status = split_finish(ctx);
+    flush_output(&w->out);
+    if (close(fd) == -1 && w->write_err == 0) // a full disk may be reported only now
+        w->write_err = errno;
+    close_input(&in);
+    if (read_err == 0 && w->write_err == 0 && status == SPLIT_OK)
+        return 0;
+
+    if (read_err != 0)
+        fprintf(stderr, "%s: %s\n", doc->in_path, strerror(read_err));
+    else if (w->write_err != 0)
+        fprintf(stderr, "%s: %s\n", doc->out_path, strerror(w->write_err));
+    else
+        fprintf(stderr, "%s: ERROR: %s\n", doc->in_path, split_error(ctx));
+    if ((read_err != 0 || w->write_err != 0) && regular && unlink(doc->out_path) == -1)
+        fprintf(stderr, "%s: %s\n", doc->out_path, strerror(errno));
+    split_reset(ctx);
+    w->bytes_in = bytes_in;
+    w->bytes_out = bytes_out;
+    w->pages = pages;
+    return -1;
+}
+
+/*  FUNCTION: doc_worker
+    INPUT:  arg, a pointer to the run.
+    OUTPUT: NULL
+
+    Each worker opens one context and one output buffer and reuses them (with the page and the line buffers of the context) for all its documents. The documents are shared through an atomic counter, so a long document does not leave the other workers idle.
+*/
+static void *doc_worker(void *arg)
+{
+    Doc_run *run = arg;
+    Doc_worker w = {0};
+    Split_ctx *ctx;
+    Split_status status = split_open(&ctx, &run->layout, doc_sink, &w);
+    if (status != SPLIT_OK)
+    {
+        fprintf(stderr, "ERROR: %s, must stop.\n", split_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+    open_output(&w.out, -1, run->out_cap);
+    set_output_sink(&w.out, doc_write, &w);
+
+    size_t k;
+    while ((k = atomic_fetch_add(&run->next, 1)) < run->list->n_docs)
+        if (format_doc(ctx, &w, &run->list->docs[k]) == -1)
+            atomic_fetch_add(&run->failed, 1);
+
+    atomic_fetch_add(&run->bytes_in, w.bytes_in);
+    atomic_fetch_add(&run->bytes_out, w.bytes_out);
+    atomic_fetch_add(&run->pages, w.pages);
+    close_output(&w.out);
+    split_close(ctx);
+    return NULL;
+}
+
+/*  FUNCTION: run_docs
+    INPUT:  list, the documents of a batch.
+            n_workers, the number of threads formatting the documents.
+            layout, the layout of the pages.
+            out_cap, the size of the output buffer of a worker.
+    OUTPUT: the number of documents that could not be formatted.
+
+    The calling thread is one of the workers. If a thread cannot be created an error message is printed out and the program exits.
+*/
+size_t run_docs(Doc_list *list, int n_workers, const Split_layout *layout, size_t out_cap)
+{
+    Doc_run run = {.list = list, .layout = *layout, .out_cap = out_cap};
+    if (n_workers > list->n_docs)
+        n_workers = list->n_docs > 0 ? list->n_docs : 1;
+    pthread_t *threads = malloc(n_workers * sizeof(*threads));
+    if (threads == NULL)
+    {
+        perror("Error allocating the threads");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 1; t < n_workers; t++)
+    {
+        if ((errno = pthread_create(&threads[t], NULL, doc_worker, &run)) != 0)
+        {
+            perror("Error creating a thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    doc_worker(&run);
+    for (int t = 1; t < n_workers; t++)
+        pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(threads);
+
+    double wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    size_t done = list->n_docs - run.failed;
+    fprintf(stderr, "Formatted %zu of %zu documents with %d workers in %.3f s: %.1f documents/s, %.2f MB/s in, %.2f MB out, %llu pages\n",
+            done, list->n_docs, n_workers, wall, wall > 0 ? done / wall : 0.0, wall > 0 ? run.bytes_in / 1e6 / wall : 0.0,
+            run.bytes_out / 1e6, (unsigned long long)run.pages);
+    return run.failed;
+}
\ No newline at end of file
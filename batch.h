@@ -0,0 +1,76 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+#include "io_utils.h"
+#include "splittext.h"
+
+#define OUT_SUFFIX ".out" // appended to the name of an input file to name its output
+
+/*      The struct contains a document of a batch:
+        char *in_path - the input file.
+        char *out_path - the output file.
+*/
+typedef struct Doc
+{
+    char *in_path;
+    char *out_path;
+} Doc;
+
+/*      The struct contains the documents of a batch:
+        Doc *docs - the documents, in the order they were given.
+        size_t n_docs, cap - the number of documents and the capacity of docs.
+*/
+typedef struct Doc_list
+{
+    Doc *docs;
+    size_t n_docs, cap;
+} Doc_list;
+
+/*  FUNCTION: add_doc
+    INPUT:  list, the documents of a batch.
+            in_path, the input file.
+            out_path, the output file, NULL to derive it from in_path.
+            out_dir, the directory of the derived output files, NULL for the directory of the input.
+    OUTPUT: void
+
+    A derived output file is named after the input file followed by OUT_SUFFIX.
+*/
+void add_doc(Doc_list *list, const char *in_path, const char *out_path, const char *out_dir);
+
+/*  FUNCTION: read_manifest
+    INPUT:  list, the documents of a batch.
+            path, the manifest: one document per line, the input file optionally followed by a tab and the output file.
+            out_dir, the directory of the derived output files, NULL for the directory of the input.
+    OUTPUT: void
+
+    Adds the documents of the manifest, empty lines are skipped.
+*/
+void read_manifest(Doc_list *list, const char *path, const char *out_dir);
+
+/*  FUNCTION: free_docs
+    INPUT:  list, the documents of a batch.
+    OUTPUT: void
+*/
+void free_docs(Doc_list *list);
+
+/*  FUNCTION: run_docs
+    INPUT:  list, the documents of a batch.
+            n_workers, the number of threads formatting the documents.
+            layout, the layout of the pages.
+            out_cap, the size of the output buffer of a worker.
+    OUTPUT: the number of documents that could not be formatted.
+
+    Formats each document independently, as the single-process version would, on a pool of n_workers threads, then prints a summary of the throughput on stderr. A document that cannot be read, written or laid out is reported on stderr and does not stop the others.
+*/
+size_t run_docs(Doc_list *list, int n_workers, const Split_layout *layout, size_t out_cap);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/*  End-to-end benchmark of split_text.
+
+    Every input text is laid out by every mode (sp: single process, mp: three processes, and optionally mp-pipe, pj and pp) with every layout of the matrix. Each combination is run several times and the run with the median wall time is reported, one CSV line per combination on the standard output:
+
+        label,corpus,bytes,mode,cols,rows,width,spacing,runs,wall_s,mb_s,pages,pages_s,user_s,sys_s,peak_rss_kb
+
+    The text is given on the standard input (so a regular file is memory-mapped as in normal use) and the output is read from a pipe, where the pages are counted. The CPU times include all the processes of the run, the peak RSS is the one of the largest process.
+*/
+
+#define MAX_LAYOUTS 32
+#define MAX_RUNS 101
+
+typedef struct Layout
+{
+    int cols, rows, width, spacing;
+} Layout;
+
+/*      The struct contains the measures of one run:
+        double wall - the elapsed time in seconds.
+        double user, sys - the CPU time in seconds.
+        long rss - the peak resident set size in KB.
+        long pages - the number of pages written.
+*/
+typedef struct Run
+{
+    double wall, user, sys;
+    long rss, pages;
+} Run;
+
+// the default matrix: the default layout of split_text, one wide column, and narrower and wider multi-column pages
+static Layout layouts[MAX_LAYOUTS] = {{3, 47, 22, 10}, {1, 60, 80, 1}, {2, 40, 40, 4}, {4, 60, 16, 2}, {6, 20, 30, 3}};
+static int n_layouts = 5;
+
+/*  FUNCTION: now
+    INPUT:  void
+    OUTPUT: the time in seconds of the monotonic clock.
+*/
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*  FUNCTION: parse_layouts
+    INPUT:  str, a comma separated list of layouts, each written as cols:rows:width:spacing
+    OUTPUT: void
+
+    Replaces the default matrix. If the list is not valid an error message is printed out and the program exits.
+*/
+static void parse_layouts(char *str)
+{
+    n_layouts = 0;
+    for (char *tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        Layout *l = &layouts[n_layouts];
+        if (n_layouts == MAX_LAYOUTS || sscanf(tok, "%d:%d:%d:%d", &l->cols, &l->rows, &l->width, &l->spacing) != 4)
+        {
+            fprintf(stderr, "Error: invalid layout %s.\n", tok);
+            exit(EXIT_FAILURE);
+        }
+        n_layouts++;
+    }
+}
+
+/*  FUNCTION: run_once
+    INPUT:  prog, the path of split_text
+            args, the arguments (prog included, NULL terminated)
+            corpus, the path of the input text
+            run, where the measures are stored
+    OUTPUT: 0 on success, -1 if split_text failed.
+
+    split_text is started with the text on the standard input and the standard output on a pipe. The output is read in large blocks and the page separators (the only lines containing "%%%") are counted, the last page has no separator. The time is measured from the start of the child to its end, the CPU times and the peak RSS come from wait4, which covers the processes created by split_text as well since it waits for them.
+*/
+static int run_once(const char *prog, char *const args[], const char *corpus, Run *run)
+{
+    static char buf[1 << 20];
+    int fd[2];
+    int in = open(corpus, O_RDONLY);
+    if (in == -1 || pipe(fd) == -1)
+    {
+        perror(corpus);
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        dup2(in, STDIN_FILENO);
+        dup2(fd[1], STDOUT_FILENO);
+        close(in);
+        close(fd[0]);
+        close(fd[1]);
+        execv(prog, args);
+        perror(prog);
+        _exit(127);
+    }
+    close(in);
+    close(fd[1]);
+
+    // count the separators, a match may span two blocks: keep the number of '%' ending the previous block
+    long seps = 0, bytes = 0;
+    int run_len = 0;
+    ssize_t n;
+    while ((n = read(fd[0], buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + n; p++)
+        {
+            if (*p != '%')
+                run_len = 0;
+            else if (++run_len == 3)
+                seps++;
+        }
+        bytes += n;
+    }
+    close(fd[0]);
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) != pid)
+    {
+        perror("wait4");
+        exit(EXIT_FAILURE);
+    }
+    run->wall = now() - start;
+    run->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6;
+    run->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    run->rss = ru.ru_maxrss;
+    run->pages = seps + (bytes > 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/*  FUNCTION: cmp_wall
+    INPUT:  two pointers to runs
+    OUTPUT: the order of the runs by wall time, as required by qsort.
+*/
+static int cmp_wall(const void *a, const void *b)
+{
+    double d = ((const Run *)a)->wall - ((const Run *)b)->wall;
+    return (d > 0) - (d < 0);
+}
+
+int main(int argc, char *argv[])
+{
+    char c_opt;
+    char *prog = "./split_text"; // the program to measure
+    int n_runs = 3;              // runs of each combination
+    char *modes = "sp,mp";       // modes to measure
+    char *label = "";            // label of the build, copied in every line
+    char *threads = "4";         // threads of the pj mode
+
+    char help[] = "Usage: bench [-x program] [-n runs] [-m modes] [-L layouts] [-j threads] [-t label] FILE...\n\n"
+                  "-x program  The split_text executable. Defaults to ./split_text\n"
+                  "-n runs  Number of runs of each combination, the median is reported. Defaults to 3\n"
+                  "-m modes  Comma separated list of sp (single process), mp (-m), mp-pipe (-m -t pipe), pj (-j), pp (-p r,t,l,w). Defaults to sp,mp\n"
+                  "-L layouts  Comma separated list of cols:rows:width:spacing. Defaults to 3:47:22:10,1:60:80:1,2:40:40:4,4:60:16:2,6:20:30:3\n"
+                  "-j threads  Number of threads of the pj mode. Defaults to 4\n"
+                  "-t label  Label of the build, written in the first field of every line.\n";
+
+    while ((c_opt = getopt(argc, argv, "hx:n:m:L:j:t:")) != -1)
+        switch (c_opt)
+        {
+        case 'x':
+            prog = optarg;
+            break;
+        case 'n':
+            n_runs = atoi(optarg);
+            break;
+        case 'm':
+            modes = optarg;
+            break;
+        case 'L':
+            parse_layouts(optarg);
+            break;
+        case 'j':
+            threads = optarg;
+            break;
+        case 't':
+            label = optarg;
+            break;
+        default:
+            fprintf(stderr, "%s", help);
+            exit(c_opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    if (optind == argc || n_runs < 1 || n_runs > MAX_RUNS)
+    {
+        fprintf(stderr, "%s", help);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("label,corpus,bytes,mode,cols,rows,width,spacing,runs,wall_s,mb_s,pages,pages_s,user_s,sys_s,peak_rss_kb\n");
+    fflush(stdout);
+    for (int f = optind; f < argc; f++)
+    {
+        struct stat st;
+        if (stat(argv[f], &st) == -1)
+        {
+            perror(argv[f]);
+            exit(EXIT_FAILURE);
+        }
+        char *mode_list = strdup(modes), *save;
+        for (char *mode = strtok_r(mode_list, ",", &save); mode != NULL; mode = strtok_r(NULL, ",", &save))
+        {
+            for (int k = 0; k < n_layouts; k++)
+            {
+                char c[12], l[12], w[12], s[12];
+                snprintf(c, sizeof(c), "%d", layouts[k].cols);
+                snprintf(l, sizeof(l), "%d", layouts[k].rows);
+                snprintf(w, sizeof(w), "%d", layouts[k].width);
+                snprintf(s, sizeof(s), "%d", layouts[k].spacing);
+                char *args[16] = {prog, "-c", c, "-l", l, "-w", w, "-s", s};
+                int n_args = 9;
+                if (strcmp(mode, "mp") == 0)
+                    args[n_args++] = "-m";
+                else if (strcmp(mode, "mp-pipe") == 0)
+                {
+                    args[n_args++] = "-m";
+                    args[n_args++] = "-t";
+                    args[n_args++] = "pipe";
+                }
+                else if (strcmp(mode, "pj") == 0)
+                {
+                    args[n_args++] = "-j";
+                    args[n_args++] = threads;
+                }
+                else if (strcmp(mode, "pp") == 0)
+                {
+                    args[n_args++] = "-p";
+                    args[n_args++] = "r,t,l,w";
+                }
+                else if (strcmp(mode, "sp") != 0)
+                {
+                    fprintf(stderr, "Error: unknown mode %s.\n", mode);
+                    exit(EXIT_FAILURE);
+                }
+                args[n_args] = NULL;
+
+                Run runs[MAX_RUNS];
+                int failed = 0;
+                for (int r = 0; r < n_runs && !failed; r++)
+                    failed = run_once(prog, args, argv[f], &runs[r]);
+                if (failed)
+                {
+                    fprintf(stderr, "split_text failed on %s, mode %s, layout %d:%d:%d:%d\n", argv[f], mode, layouts[k].cols, layouts[k].rows, layouts[k].width, layouts[k].spacing);
+                    continue;
+                }
+                qsort(runs, n_runs, sizeof(*runs), cmp_wall);
+                Run *m = &runs[n_runs / 2];
+                printf("%s,%s,%lld,%s,%d,%d,%d,%d,%d,%.4f,%.2f,%ld,%.1f,%.4f,%.4f,%ld\n", label, argv[f], (long long)st.st_size, mode,
+                       layouts[k].cols, layouts[k].rows, layouts[k].width, layouts[k].spacing, n_runs,
+                       m->wall, st.st_size / 1e6 / m->wall, m->pages, m->pages / m->wall, m->user, m->sys, m->rss);
+                fflush(stdout);
+            }
+        }
+        free(mode_list);
+    }
+    return 0;
+}
\ No newline at end of file
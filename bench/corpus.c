@@ -0,0 +1,109 @@
+#include <string.h>
+#include <ctype.h>
+#include "corpus.h"
+
+static const char *onsets[] = {"", "b", "c", "d", "f", "g", "l", "m", "n", "p", "r", "s", "t", "v", "z",
+                               "ch", "gh", "gl", "gn", "sc", "st", "tr", "pr", "br", "cr", "qu"};
+static const char *vowels[] = {"a", "e", "i", "o", "u"};
+static const char *accented[] = {"à", "è", "é", "ì", "ò", "ù"};
+static const char *common[] = {"il", "la", "di", "che", "e", "un", "una", "per", "non", "con", "si",
+                               "del", "della", "in", "al", "lo", "le", "gli", "ma", "come", "anche"};
+
+/*  FUNCTION: next_rand
+    INPUT:  state, a pointer to the state of the generator (not 0)
+    OUTPUT: the next pseudo-random number.
+
+    xorshift64* generator.
+*/
+uint64_t next_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*  FUNCTION: pick
+    INPUT:  state, a pointer to the state of the generator
+            n, the number of choices
+    OUTPUT: a pseudo-random number in [0, n).
+*/
+size_t pick(uint64_t *state, size_t n)
+{
+    return (next_rand(state) >> 11) % n;
+}
+
+/*  FUNCTION: make_word
+    INPUT:  c, a Corpus
+            word, a buffer of at least MAX_WORD_BYTES + 1 bytes
+    OUTPUT: the length of the word written in word (null terminated).
+
+    One word out of three is a common short word, the others are made of one to four syllables. With all_accented the words are made of one to three syllables whose vowels are all accented.
+*/
+static size_t make_word(Corpus *c, char *word)
+{
+    word[0] = '\0';
+    if (!c->all_accented && pick(&c->state, 3) == 0)
+    {
+        strcpy(word, common[pick(&c->state, N_ELEMS(common))]);
+        return strlen(word);
+    }
+    size_t n_syl = 1 + pick(&c->state, c->all_accented ? 3 : 4);
+    int accent = (int)pick(&c->state, 100) < c->accent_pct;
+    for (size_t k = 0; k < n_syl; k++)
+    {
+        strcat(word, onsets[pick(&c->state, N_ELEMS(onsets))]);
+        if (c->all_accented || (k == n_syl - 1 && accent))
+            strcat(word, accented[pick(&c->state, N_ELEMS(accented))]);
+        else
+            strcat(word, vowels[pick(&c->state, N_ELEMS(vowels))]);
+    }
+    return strlen(word);
+}
+
+/*  FUNCTION: corpus_init
+    INPUT:  c, the Corpus to initialise
+            seed, the seed of the generator
+            par_words, accent_pct, max_blank, all_accented, the options of the corpus (see struct Corpus)
+    OUTPUT: void
+*/
+void corpus_init(Corpus *c, uint64_t seed, int par_words, int accent_pct, int max_blank, bool all_accented)
+{
+    c->state = seed * 0x9E3779B97F4A7C15ULL + 1; // never 0
+    c->par_words = par_words;
+    c->accent_pct = accent_pct;
+    c->max_blank = max_blank;
+    c->all_accented = all_accented;
+    c->words_left = 0;
+    c->new_sentence = true;
+}
+
+/*  FUNCTION: corpus_word
+    INPUT:  c, a Corpus
+            word, a buffer of at least MAX_WORD_BYTES + 1 bytes
+            n_blank, where the number of empty lines after the word is stored: 0 if the word does not end its paragraph
+    OUTPUT: the length of the word written in word (null terminated), with its capital letter and punctuation.
+
+    A paragraph is made of sentences of words, the first word of each sentence is capitalised and the last word of the paragraph ends a sentence.
+*/
+size_t corpus_word(Corpus *c, char *word, size_t *n_blank)
+{
+    if (c->words_left == 0)
+        c->words_left = 1 + pick(&c->state, 2 * c->par_words);
+    size_t len = make_word(c, word);
+    if (c->new_sentence)
+        word[0] = toupper((unsigned char)word[0]);
+    c->new_sentence = false;
+    if (c->words_left == 1 || pick(&c->state, 12) == 0)
+    {
+        word[len++] = '.';
+        c->new_sentence = true;
+    }
+    else if (pick(&c->state, 8) == 0)
+        word[len++] = ',';
+    word[len] = '\0';
+    *n_blank = --c->words_left == 0 ? 1 + pick(&c->state, c->max_blank) : 0;
+    return len;
+}
\ No newline at end of file
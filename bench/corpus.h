@@ -0,0 +1,66 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*  Reproducible generator of Italian-like texts, shared by gen_corpus and kernels so that both measure the same corpus.
+
+    The words are built from Italian syllables (with a given share of words ending with an accented vowel) mixed with the most common short words, the sentences start with a capital letter and end with a full stop, a paragraph is a single line of words and the paragraphs are separated by runs of empty lines. The same options and seed give the same text on every platform, because the generator does not depend on the C library random functions.
+*/
+
+#define MAX_WORD_BYTES 14 // 4 syllables of 3 bytes, 1 byte for the accent, 1 for the punctuation (or 3 syllables of 4 bytes when they are all accented)
+
+#define N_ELEMS(a) (sizeof(a) / sizeof(*(a)))
+
+/*      The struct contains the options and the state of a corpus:
+        uint64_t state - the state of the generator (never 0).
+        int par_words - the mean number of words per paragraph (the lengths vary from 1 to twice the mean).
+        int accent_pct - the percentage of words ending with an accented vowel.
+        int max_blank - the longest run of empty lines between paragraphs (the runs vary from 1 to max_blank).
+        bool all_accented - whether every vowel is accented (no common words, one to three syllables).
+        size_t words_left - the words left in the current paragraph.
+        bool new_sentence - whether the next word starts a sentence.
+*/
+typedef struct Corpus
+{
+    uint64_t state;
+    int par_words, accent_pct, max_blank;
+    bool all_accented;
+    size_t words_left;
+    bool new_sentence;
+} Corpus;
+
+/*  FUNCTION: next_rand
+    INPUT:  state, a pointer to the state of the generator (not 0)
+    OUTPUT: the next pseudo-random number.
+
+    xorshift64* generator.
+*/
+uint64_t next_rand(uint64_t *);
+
+/*  FUNCTION: pick
+    INPUT:  state, a pointer to the state of the generator
+            n, the number of choices
+    OUTPUT: a pseudo-random number in [0, n).
+*/
+size_t pick(uint64_t *, size_t);
+
+/*  FUNCTION: corpus_init
+    INPUT:  c, the Corpus to initialise
+            seed, the seed of the generator
+            par_words, accent_pct, max_blank, all_accented, the options of the corpus (see struct Corpus)
+    OUTPUT: void
+*/
+void corpus_init(Corpus *, uint64_t, int, int, int, bool);
+
+/*  FUNCTION: corpus_word
+    INPUT:  c, a Corpus
+            word, a buffer of at least MAX_WORD_BYTES + 1 bytes
+            n_blank, where the number of empty lines after the word is stored: 0 if the word does not end its paragraph
+    OUTPUT: the length of the word written in word (null terminated), with its capital letter and punctuation.
+*/
+size_t corpus_word(Corpus *, char *, size_t *);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "corpus.h"
+
+/*  Reproducible generator of Italian-like input texts for the benchmarks (see corpus.h).
+
+    No word is longer than MAX_WORD_BYTES bytes, so that the texts can be laid out with any column width of at least MAX_WORD_BYTES.
+*/
+
+/*  FUNCTION: parse_size
+    INPUT:  str, a number optionally followed by K, M or G
+    OUTPUT: the number of bytes.
+
+    If the string is not a valid size an error message is printed out and the program exits.
+*/
+static size_t parse_size(const char *str)
+{
+    char *end;
+    unsigned long long n = strtoull(str, &end, 10);
+    switch (toupper((unsigned char)*end))
+    {
+    case 'G':
+        n <<= 10;
+        /* fall through */
+    case 'M':
+        n <<= 10;
+        /* fall through */
+    case 'K':
+        n <<= 10;
+        end++;
+        break;
+    }
+    if (end == str || *end != '\0' || n == 0)
+    {
+        fprintf(stderr, "Error: invalid size %s.\n", str);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    char c_opt;
+    size_t size = 1 << 20;   // bytes to generate
+    int par_words = 60;      // mean number of words per paragraph
+    int accent_pct = 10;     // percentage of words ending with an accented vowel
+    int max_blank = 1;       // longest run of empty lines between paragraphs
+    uint64_t seed = 1;       // seed of the generator
+
+    char help[] = "Usage: gen_corpus [-s size] [-p words] [-a percent] [-b lines] [-r seed] > FILE\n\n"
+                  "-s size  Number of bytes to generate, with an optional K, M or G suffix. Defaults to 1M\n"
+                  "-p words  Mean number of words per paragraph (the lengths vary from 1 to twice the mean). Defaults to 60\n"
+                  "-a percent  Percentage of words ending with an accented vowel. Defaults to 10\n"
+                  "-b lines  Longest run of empty lines between paragraphs (the runs vary from 1 to lines). Defaults to 1\n"
+                  "-r seed  Seed of the generator. Defaults to 1\n";
+
+    while ((c_opt = getopt(argc, argv, "hs:p:a:b:r:")) != -1)
+        switch (c_opt)
+        {
+        case 's':
+            size = parse_size(optarg);
+            break;
+        case 'p':
+            par_words = atoi(optarg);
+            break;
+        case 'a':
+            accent_pct = atoi(optarg);
+            break;
+        case 'b':
+            max_blank = atoi(optarg);
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "%s", help);
+            exit(c_opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    if (par_words < 1 || accent_pct < 0 || accent_pct > 100 || max_blank < 1)
+    {
+        fprintf(stderr, "%s", help);
+        exit(EXIT_FAILURE);
+    }
+
+    static char out_buf[1 << 20];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    Corpus corpus;
+    corpus_init(&corpus, seed, par_words, accent_pct, max_blank, false);
+    char word[MAX_WORD_BYTES + 1];
+    size_t written = 0, n_blank = 0;
+    while (written < size || n_blank == 0) // the last paragraph is ended
+    {
+        size_t len = corpus_word(&corpus, word, &n_blank);
+        written += fwrite(word, 1, len, stdout);
+        if (n_blank == 0)
+            written += fwrite(" ", 1, 1, stdout);
+        else
+            for (size_t k = 0; k <= n_blank; k++) // the \n ending the paragraph and the empty lines
+                written += fwrite("\n", 1, 1, stdout);
+    }
+    if (fflush(stdout) == EOF)
+    {
+        perror("Error writing the corpus");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,605 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "io_utils.h"
+#include "processing.h"
+#include "alloc_utils.h"
+#include "corpus.h"
+
+/*  Microbenchmark of the kernels of split_text.
+
+    Every kernel is run over texts generated in memory, so that neither the disk nor the page cache is measured, and each (kernel, text) pair is reported as a CSV line on the standard output:
+
+        label,kernel,text,bytes,lines,runs,median_ns_byte,p99_ns_byte,median_ns_line,p99_ns_line,mb_s,allocs_run
+
+    A run is one pass of the kernel over the whole text, timed with the monotonic clock. The first runs only warm up the caches and the branch predictors, the others give the median and the 99th percentile of the time per byte and per line (mb_s comes from the median). One more run, untimed, counts the allocations made by a kernel that has already warmed up (allocs_run, the counter of -P): in the steady state it should be 0. The kernels are:
+
+        read        read_one_line over the raw text, which is read as a mapped file is (bytes and lines of the raw text).
+        strdisplen  strdisplen over every tokenized line.
+        is_ascii    is_ascii over every byte of the tokenized lines.
+        process     process_one_line laying out the tokenized lines on pages, as the second process of -m does, without writing them.
+        write       write_one_page writing the first page of the text to /dev/null as many times as the text has pages (the bytes and rows written).
+
+    The texts come from the generator of gen_corpus (corpus.c), with its default options:
+
+        mixed       paragraphs of 1 to 120 words, one word out of ten ending with an accented vowel, separated by an empty line (the text of gen_corpus).
+        accented    the same paragraphs with every vowel accented (two bytes per vowel).
+        words       the words of mixed, one per line.
+        long        the words of mixed in a single paragraph as long as the whole text.
+*/
+
+#define MAX_RUNS 1001
+
+typedef enum Text_kind
+{
+    TEXT_MIXED,
+    TEXT_ACCENTED,
+    TEXT_WORDS,
+    TEXT_LONG,
+    N_TEXTS
+} Text_kind;
+
+static const char *text_names[N_TEXTS] = {"mixed", "accented", "words", "long"};
+
+/*      The struct contains a text and what the kernels need to run over it:
+        char *data, size_t len - the raw text.
+        Arena arena - the memory holding the tokenized lines.
+        char **lines, size_t n_lines - the lines as read_one_line returns them, and their number.
+        size_t tok_bytes - the bytes of the tokenized lines.
+        Page page - the page laid out by the process kernel.
+        Page first - the first page of the text, with its separator, written by the write kernel.
+        size_t n_pages, first_bytes, first_rows - the pages of the text, and the bytes and rows of the first one.
+*/
+typedef struct Text
+{
+    char *data;
+    size_t len;
+    Arena arena;
+    char **lines;
+    size_t n_lines;
+    size_t tok_bytes;
+    Page page, first;
+    size_t n_pages, first_bytes, first_rows;
+} Text;
+
+/*      The struct contains the layout of the pages and the output of the write kernel. */
+typedef struct Bench_ctx
+{
+    int n_cols, n_rows, col_width, spacing;
+    int alloc_n_rows, alloc_page_width;
+    Out_stream out;
+} Bench_ctx;
+
+/*      The units a kernel has gone through in a run: the time is divided by them. */
+typedef struct Units
+{
+    size_t bytes, lines;
+} Units;
+
+typedef size_t (*Kernel_fn)(Bench_ctx *, Text *, Units *);
+
+static volatile size_t sink; // the kernels return a value that is kept here, so that no call is optimised away
+
+/*  FUNCTION: now_ns
+    INPUT:  void
+    OUTPUT: the time in nanoseconds of the monotonic clock.
+*/
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*  FUNCTION: gen_text
+    INPUT:  kind, the kind of text
+            size, the number of bytes to generate (a few more are generated to end the last line)
+            len, where the length of the text is stored
+    OUTPUT: the text, ended by a newline character. If the memory cannot be allocated an error message is printed out and the program exits.
+*/
+static char *gen_text(Text_kind kind, size_t size, size_t *len)
+{
+    char *text = malloc(size + MAX_WORD_BYTES + 2);
+    if (text == NULL)
+    {
+        perror("Error allocating the text");
+        exit(EXIT_FAILURE);
+    }
+    Corpus corpus;
+    corpus_init(&corpus, 1, 60, 10, 1, kind == TEXT_ACCENTED);
+    size_t n = 0, n_blank;
+    while (n < size)
+    {
+        n += corpus_word(&corpus, text + n, &n_blank);
+        if (kind == TEXT_WORDS)
+            text[n++] = '\n';
+        else if (n_blank == 0 || kind == TEXT_LONG)
+            text[n++] = ' ';
+        else
+            for (size_t k = 0; k <= n_blank && (k == 0 || n < size); k++) // the \n ending the paragraph and the empty lines
+                text[n++] = '\n';
+    }
+    text[n - 1] = '\n';
+    *len = n;
+    return text;
+}
+
+/*  FUNCTION: open_text
+    INPUT:  in, the In_stream to initialise
+            t, a text
+    OUTPUT: void
+
+    Reads the text in memory as a mapped input: next_line returns the lines where they are.
+*/
+static void open_text(In_stream *in, const Text *t)
+{
+    memset(in, 0, sizeof(*in));
+    in->map = t->data;
+    in->map_len = t->len;
+}
+
+/*  FUNCTION: lay_out
+    INPUT:  ctx, the layout
+            t, a text with its tokenized lines
+            page, the page where the text is laid out
+            stop_at_first, whether to stop when the first page is full
+    OUTPUT: the number of pages the text has (1 when stop_at_first and the first page is full).
+
+    Lays out the lines as the second process of -m does: the page is cleared when it is full, nothing is written.
+*/
+static size_t lay_out(Bench_ctx *ctx, Text *t, Page *page, bool stop_at_first)
+{
+    Pr_data pos_data = {.line_ptr = NULL, .i = 0, .j = 0};
+    bool empty_line = false;
+    size_t n_pages = 1;
+    char empty[2];
+
+    clear_page(page);
+    for (size_t k = 0; k < t->n_lines; k++)
+    {
+        char *line = t->lines[k];
+        if (*line == '\0') // process_empty_line rewrites an empty line, the text must not change between runs
+        {
+            empty[0] = '\0';
+            line = empty;
+        }
+        if (process_empty_line(&line, &empty_line, pos_data))
+            continue;
+        pos_data = start_line(pos_data, line);
+        while (*pos_data.line_ptr != '\0')
+        {
+            pos_data = process_one_line(ctx->n_cols, ctx->col_width, ctx->n_rows, ctx->spacing, page, pos_data);
+            if (pos_data.i == 0 && pos_data.j == 0)
+            {
+                if (stop_at_first)
+                    return 1;
+                clear_page(page);
+                n_pages++;
+            }
+        }
+    }
+    return n_pages;
+}
+
+/*  FUNCTION: load_text
+    INPUT:  ctx, the layout
+            t, the text to prepare
+            kind, the kind of text
+            size, the number of bytes of the text
+    OUTPUT: void
+
+    Generates the text, tokenizes its lines and lays it out once, to count its pages and keep its first page. If the memory cannot be allocated or a word is larger than a column an error message is printed out and the program exits.
+*/
+static void load_text(Bench_ctx *ctx, Text *t, Text_kind kind, size_t size)
+{
+    memset(t, 0, sizeof(*t));
+    t->data = gen_text(kind, size, &t->len);
+
+    size_t lines_cap = 1024;
+    t->lines = malloc(lines_cap * sizeof(*t->lines));
+    t->page = alloc_page(ctx->alloc_n_rows, ctx->alloc_page_width);
+    t->first = alloc_page(ctx->alloc_n_rows, ctx->alloc_page_width);
+    if (t->lines == NULL)
+    {
+        perror("Error allocating the lines");
+        exit(EXIT_FAILURE);
+    }
+
+    In_stream in;
+    char *line;
+    ssize_t cnt;
+    open_text(&in, t);
+    // the lines are read into the arena one after the other and stay there
+    while ((cnt = read_one_line(&in, &t->arena, &line, ctx->col_width)) != EOF)
+    {
+        if (cnt == LONG_WORD)
+            exit(EXIT_FAILURE);
+        if (t->n_lines == lines_cap)
+        {
+            lines_cap *= 2;
+            char **tmp = realloc(t->lines, lines_cap * sizeof(*t->lines));
+            if (tmp == NULL)
+            {
+                perror("Error allocating the lines");
+                exit(EXIT_FAILURE);
+            }
+            t->lines = tmp;
+        }
+        t->lines[t->n_lines++] = line;
+        t->tok_bytes += strlen(line);
+    }
+
+    t->n_pages = lay_out(ctx, t, &t->page, false);
+    lay_out(ctx, t, &t->first, true);
+    set_row(&t->first, ctx->n_rows, NEW_PAGE);
+    for (int i = 0; i < ctx->alloc_n_rows && t->first.len[i] != 0; i++, t->first_rows++)
+        t->first_bytes += t->first.len[i] + 1;
+}
+
+/*  FUNCTION: free_text
+    INPUT:  t, a text loaded by load_text
+    OUTPUT: void
+*/
+static void free_text(Text *t)
+{
+    free(t->data);
+    arena_free(&t->arena);
+    free(t->lines);
+    free_page(&t->page);
+    free_page(&t->first);
+}
+
+static size_t k_read(Bench_ctx *ctx, Text *t, Units *u)
+{
+    In_stream in;
+    static Arena arena; // kept between runs, as split_text keeps its arena between lines
+    char *line;
+    size_t sum = 0;
+    ssize_t cnt;
+    open_text(&in, t);
+    while ((cnt = read_one_line(&in, &arena, &line, ctx->col_width)) != EOF)
+    {
+        sum += cnt;
+        arena_reset(&arena);
+    }
+    u->bytes = t->len;
+    u->lines = t->n_lines;
+    return sum;
+}
+
+static size_t k_strdisplen(Bench_ctx *ctx, Text *t, Units *u)
+{
+    size_t sum = 0;
+    for (size_t k = 0; k < t->n_lines; k++)
+        sum += strdisplen(t->lines[k]);
+    u->bytes = t->tok_bytes;
+    u->lines = t->n_lines;
+    return sum;
+}
+
+static size_t k_is_ascii(Bench_ctx *ctx, Text *t, Units *u)
+{
+    size_t sum = 0;
+    for (size_t k = 0; k < t->n_lines; k++)
+        for (const char *p = t->lines[k]; *p != '\0'; p++)
+            sum += is_ascii(*p);
+    u->bytes = t->tok_bytes;
+    u->lines = t->n_lines;
+    return sum;
+}
+
+static size_t k_process(Bench_ctx *ctx, Text *t, Units *u)
+{
+    u->bytes = t->tok_bytes;
+    u->lines = t->n_lines;
+    return lay_out(ctx, t, &t->page, false);
+}
+
+static size_t k_write(Bench_ctx *ctx, Text *t, Units *u)
+{
+    for (size_t k = 0; k < t->n_pages; k++)
+        write_one_page(&ctx->out, &t->first, ctx->alloc_n_rows);
+    flush_output(&ctx->out);
+    u->bytes = t->n_pages * t->first_bytes;
+    u->lines = t->n_pages * t->first_rows;
+    return t->n_pages;
+}
+
+static const struct
+{
+    const char *name;
+    Kernel_fn fn;
+} kernels[] = {{"read", k_read}, {"strdisplen", k_strdisplen}, {"is_ascii", k_is_ascii}, {"process", k_process}, {"write", k_write}};
+
+#define N_SCAN_FNS 5    // skip_blanks and find_blank (walked together), utf8_width, is_ascii_text, count_byte of ' ' and of '\n'
+#define SCAN_OFFSETS 64 // the windows start at every offset of a 64-byte block...
+#define SCAN_MAX_LEN 200 // ...and have every length up to this, so that the vector loops and the tails meet at every alignment
+#define SCAN_SPOTS 16   // the places of the text where the windows are taken
+static const char *scan_fn_names[N_SCAN_FNS] = {"skip_blanks/find_blank", "utf8_width", "is_ascii_text", "count_byte ' '", "count_byte '\\n'"};
+static const char *scan_levels[] = {"scalar", "sse2", "avx2"};
+
+/*  FUNCTION: mix
+    INPUT:  h, a hash
+            v, a value
+    OUTPUT: the hash updated with the value.
+*/
+static uint64_t mix(uint64_t h, uint64_t v)
+{
+    return (h ^ v) * 0x100000001B3ULL;
+}
+
+/*  FUNCTION: scan_window
+    INPUT:  p, end, the window to scan
+            base, where the offsets are measured from
+            h, the hashes of the functions, updated with their results over the window
+    OUTPUT: void
+*/
+static void scan_window(const char *p, const char *end, const char *base, uint64_t *h)
+{
+    for (const char *q = p; q < end;)
+    {
+        const char *w = skip_blanks(q, end);
+        q = find_blank(w, end);
+        h[0] = mix(mix(h[0], w - base), q - base);
+    }
+    h[0] = mix(h[0], end - base);
+    h[1] = mix(h[1], utf8_width(p, end));
+    h[2] = mix(h[2], is_ascii_text(p, end));
+    h[3] = mix(h[3], count_byte(p, end, ' '));
+    h[4] = mix(h[4], count_byte(p, end, '\n'));
+}
+
+/*  FUNCTION: scan_text
+    INPUT:  text, len, a text
+            h, where the hashes of the functions are stored
+    OUTPUT: void
+
+    Runs the scans over the whole text and over short windows at every alignment, with the level in use.
+*/
+static void scan_text(const char *text, size_t len, uint64_t *h)
+{
+    for (int f = 0; f < N_SCAN_FNS; f++)
+        h[f] = 0xCBF29CE484222325ULL;
+    scan_window(text, text + len, text, h);
+    for (size_t spot = 0; spot < SCAN_SPOTS; spot++)
+    {
+        size_t start = len / SCAN_SPOTS * spot;
+        for (size_t o = 0; o < SCAN_OFFSETS; o++)
+            for (size_t l = 0; l <= SCAN_MAX_LEN && start + o + l <= len; l++)
+                scan_window(text + start + o, text + start + o + l, text, h);
+    }
+}
+
+/*  FUNCTION: check_scan
+    INPUT:  size, the number of bytes of each text
+    OUTPUT: whether every level supported by the CPU gives the same results as the scalar one.
+
+    The generated texts and a text of random bytes (every byte value, invalid UTF-8 included) are scanned with each level, forced with scan_force, and the results of each function are compared with those of the scalar level. A line per level and an error message per difference are printed out.
+*/
+static bool check_scan(size_t size)
+{
+    char *texts[N_TEXTS + 1];
+    size_t lens[N_TEXTS + 1];
+    for (int kind = 0; kind < N_TEXTS; kind++)
+        texts[kind] = gen_text(kind, size, &lens[kind]);
+    texts[N_TEXTS] = malloc(size);
+    if (texts[N_TEXTS] == NULL)
+    {
+        perror("Error allocating the text");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (size_t k = 0; k < size; k++)
+        texts[N_TEXTS][k] = (char)next_rand(&state);
+    lens[N_TEXTS] = size;
+
+    const char *initial = scan_level_name();
+    bool same = true;
+    uint64_t ref[N_TEXTS + 1][N_SCAN_FNS], h[N_SCAN_FNS];
+    for (size_t lv = 0; lv < N_ELEMS(scan_levels); lv++)
+    {
+        if (scan_force(scan_levels[lv]) == -1)
+        {
+            printf("scan %s: not supported by this CPU\n", scan_levels[lv]);
+            continue;
+        }
+        bool level_same = true;
+        for (int k = 0; k <= N_TEXTS; k++)
+        {
+            scan_text(texts[k], lens[k], lv == 0 ? ref[k] : h);
+            for (int f = 0; lv > 0 && f < N_SCAN_FNS; f++)
+                if (h[f] != ref[k][f])
+                {
+                    fprintf(stderr, "Error: %s differs between scalar and %s over the %s text.\n", scan_fn_names[f], scan_levels[lv],
+                            k < N_TEXTS ? text_names[k] : "random");
+                    level_same = false;
+                }
+        }
+        printf("scan %s: %s\n", scan_levels[lv], lv == 0 ? "reference" : level_same ? "same results as scalar" : "DIFFERENT");
+        same = same && level_same;
+    }
+    scan_force(initial);
+    for (int k = 0; k <= N_TEXTS; k++)
+        free(texts[k]);
+    return same;
+}
+
+/*  FUNCTION: cmp_double
+    INPUT:  two pointers to doubles
+    OUTPUT: their order, as required by qsort.
+*/
+static int cmp_double(const void *a, const void *b)
+{
+    double d = *(const double *)a - *(const double *)b;
+    return (d > 0) - (d < 0);
+}
+
+/*  FUNCTION: in_list
+    INPUT:  name, a name
+            list, a comma separated list of names
+    OUTPUT: whether name is in the list.
+*/
+static bool in_list(const char *name, const char *list)
+{
+    size_t len = strlen(name);
+    for (const char *p = list; p != NULL; p = strchr(p, ','), p = p == NULL ? NULL : p + 1)
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return true;
+    return false;
+}
+
+/*  FUNCTION: check_list
+    INPUT:  list, a comma separated list of names
+            names, n, the known names
+            what, what the names are, for the error message
+    OUTPUT: void
+
+    If a name of the list is not known an error message is printed out and the program exits.
+*/
+static void check_list(const char *list, const char *const *names, size_t n, const char *what)
+{
+    char *copy = strdup(list), *save;
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        size_t k = 0;
+        while (k < n && strcmp(tok, names[k]) != 0)
+            k++;
+        if (k == n)
+        {
+            fprintf(stderr, "Error: unknown %s %s.\n", what, tok);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(copy);
+}
+
+int main(int argc, char *argv[])
+{
+    char c_opt;
+    size_t size = 4 << 20; // bytes of each text
+    int n_runs = 21;        // measured runs of each pair
+    int n_warmup = 3;       // runs before the measured ones
+    char *kernel_list = "read,strdisplen,is_ascii,process,write";
+    char *text_list = "mixed,accented,words,long";
+    char *label = ""; // label of the build, copied in every line
+    bool scan_check = false;
+    Bench_ctx ctx = {.n_cols = 3, .n_rows = 47, .col_width = 22, .spacing = 10};
+
+    char help[] = "Usage: kernels [-s size] [-n runs] [-w runs] [-k kernels] [-T texts] [-L layout] [-t label] [-S]\n\n"
+                  "-s size  Number of bytes of each text, in KiB. Defaults to 4096\n"
+                  "-n runs  Number of measured runs of each kernel over each text. Defaults to 21\n"
+                  "-w runs  Number of warmup runs, not measured. Defaults to 3\n"
+                  "-k kernels  Comma separated list of read, strdisplen, is_ascii, process, write. Defaults to all\n"
+                  "-T texts  Comma separated list of mixed, accented, words, long. Defaults to all\n"
+                  "-L layout  The layout of the pages, cols:rows:width:spacing. Defaults to 3:47:22:10\n"
+                  "-t label  Label of the build, written in the first field of every line.\n"
+                  "-S  Instead of timing the kernels, check that every scan level supported by the CPU (scalar, sse2, avx2) gives the same results. Exits with failure if not\n";
+
+    while ((c_opt = getopt(argc, argv, "hs:n:w:k:T:L:t:S")) != -1)
+        switch (c_opt)
+        {
+        case 's':
+            size = (size_t)atol(optarg) << 10;
+            break;
+        case 'n':
+            n_runs = atoi(optarg);
+            break;
+        case 'w':
+            n_warmup = atoi(optarg);
+            break;
+        case 'k':
+            kernel_list = optarg;
+            break;
+        case 'T':
+            text_list = optarg;
+            break;
+        case 'L':
+            if (sscanf(optarg, "%d:%d:%d:%d", &ctx.n_cols, &ctx.n_rows, &ctx.col_width, &ctx.spacing) != 4)
+            {
+                fprintf(stderr, "Error: invalid layout %s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            label = optarg;
+            break;
+        case 'S':
+            scan_check = true;
+            break;
+        default:
+            fprintf(stderr, "%s", help);
+            exit(c_opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    if (optind != argc || size == 0 || n_runs < 1 || n_runs > MAX_RUNS || n_warmup < 0 ||
+        ctx.n_cols < 1 || ctx.n_rows < 1 || ctx.spacing < 1 || ctx.col_width < MAX_WORD_BYTES)
+    {
+        fprintf(stderr, "%s", help);
+        exit(EXIT_FAILURE);
+    }
+    const char *kernel_names[N_ELEMS(kernels)];
+    for (size_t k = 0; k < N_ELEMS(kernels); k++)
+        kernel_names[k] = kernels[k].name;
+    check_list(kernel_list, kernel_names, N_ELEMS(kernels), "kernel");
+    check_list(text_list, text_names, N_TEXTS, "text");
+    if (scan_check)
+        return check_scan(size) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    ctx.alloc_n_rows = ctx.n_rows + 1; // one extra line for the newpage symbol
+    ctx.alloc_page_width = row_capacity(ctx.n_cols, ctx.col_width, ctx.spacing);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1)
+    {
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
+    }
+    open_output(&ctx.out, null_fd, (size_t)ctx.alloc_n_rows * ctx.alloc_page_width);
+
+    // the allocations are counted only in the extra run, the timed runs do not touch the counters
+    const char *stats_names[] = {"kernels"};
+    stats_init(1, stats_names);
+    Proc_stats *counters = stats;
+    stats = NULL;
+
+    printf("label,kernel,text,bytes,lines,runs,median_ns_byte,p99_ns_byte,median_ns_line,p99_ns_line,mb_s,allocs_run\n");
+    fflush(stdout);
+    for (int kind = 0; kind < N_TEXTS; kind++)
+    {
+        if (!in_list(text_names[kind], text_list))
+            continue;
+        Text t;
+        load_text(&ctx, &t, kind, size);
+        for (size_t k = 0; k < N_ELEMS(kernels); k++)
+        {
+            if (!in_list(kernels[k].name, kernel_list))
+                continue;
+            double ns[MAX_RUNS];
+            Units u;
+            for (int r = -n_warmup; r < n_runs; r++)
+            {
+                double start = now_ns();
+                sink += kernels[k].fn(&ctx, &t, &u);
+                if (r >= 0)
+                    ns[r] = now_ns() - start;
+            }
+            stats = counters;
+            uint64_t allocs = counters->allocs;
+            sink += kernels[k].fn(&ctx, &t, &u);
+            allocs = counters->allocs - allocs;
+            stats = NULL;
+            qsort(ns, n_runs, sizeof(*ns), cmp_double);
+            double median = ns[n_runs / 2], p99 = ns[(99 * n_runs + 99) / 100 - 1];
+            printf("%s,%s,%s,%zu,%zu,%d,%.4f,%.4f,%.2f,%.2f,%.1f,%llu\n", label, kernels[k].name, text_names[kind], u.bytes, u.lines, n_runs,
+                   median / u.bytes, p99 / u.bytes, median / u.lines, p99 / u.lines, u.bytes / median * 1e3, (unsigned long long)allocs);
+            fflush(stdout);
+        }
+        free_text(&t);
+    }
+    close_output(&ctx.out);
+    close(null_fd);
+    return 0;
+}
\ No newline at end of file
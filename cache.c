@@ -0,0 +1,297 @@
+#include "cache.h"
+
+/*  FUNCTION: hash_bytes
+    INPUT:  data, the bytes to hash.
+            len, the number of bytes.
+            seed, a value mixed into the hash.
+    OUTPUT: the hash of the bytes and of the seed.
+
+    The bytes are mixed 8 at a time.
+*/
+uint64_t hash_bytes(const char *data, size_t len, uint64_t seed)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ seed ^ ((uint64_t)len << 32);
+    size_t k = 0;
+    for (; k + 8 <= len; k += 8)
+    {
+        uint64_t w;
+        memcpy(&w, data + k, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    memcpy(&w, data + k, len - k);
+    h = (h ^ w) * 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 29);
+}
+
+/*  FUNCTION: find_slot
+    INPUT:  cache, a cache with at least one free slot.
+            hash, the hash of a line.
+            text, the line.
+            len, the length of the line.
+            col_width, the width of the columns.
+    OUTPUT: the slot of the line, or the free slot where it belongs.
+*/
+static Cache_entry **find_slot(Split_cache *cache, uint64_t hash, const char *text, size_t len, int col_width)
+{
+    size_t mask = cache->n_slots - 1;
+    for (size_t k = hash & mask;; k = (k + 1) & mask)
+    {
+        Cache_entry *e = cache->slots[k];
+        if (e == NULL ||
+            (e->hash == hash && e->col_width == col_width && e->text_len == len && memcmp(e->text, text, len) == 0))
+            return &cache->slots[k];
+    }
+}
+
+/*  FUNCTION: grow_table
+    INPUT:  cache, a cache.
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (the table is left as it was).
+
+    Doubles the table, so that it is never more than half full.
+*/
+static int grow_table(Split_cache *cache)
+{
+    size_t n_slots = cache->n_slots ? 2 * cache->n_slots : 1024;
+    Cache_entry **slots = calloc(n_slots, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+    stats_alloc();
+    Cache_entry **old = cache->slots;
+    size_t old_n = cache->n_slots;
+    cache->slots = slots;
+    cache->n_slots = n_slots;
+    for (size_t k = 0; k < old_n; k++)
+        if (old[k] != NULL)
+            *find_slot(cache, old[k]->hash, old[k]->text, old[k]->text_len, old[k]->col_width) = old[k];
+    free(old);
+    return 0;
+}
+
+/*  FUNCTION: new_entry
+    INPUT:  cache, the cache the entry is allocated for.
+            col_width, the width of the columns.
+            text_len, the length of the line.
+            n_rows, the number of rows.
+            rows_len, the length of the rows.
+    OUTPUT: an entry with room for the line and the rows, NULL if the memory could not be allocated.
+
+    The entry is taken from the arena of the cache, so that the entries cost an allocation per block instead of one each. An entry that is not added stays in the arena until the cache is closed. The hash is not set, the line, the rows and their ends are to be copied by the caller.
+*/
+static Cache_entry *new_entry(Split_cache *cache, int col_width, size_t text_len, size_t n_rows, size_t rows_len)
+{
+    Cache_entry *e = arena_alloc(&cache->entries, sizeof(*e) + n_rows * sizeof(size_t) + text_len + rows_len);
+    if (e == NULL)
+        return NULL;
+    e->col_width = col_width;
+    e->text_len = text_len;
+    e->rows = (Line_rows){.n_rows = n_rows, .rows_len = rows_len};
+    e->rows.ends = (size_t *)(e + 1);
+    e->text = (char *)(e->rows.ends + n_rows);
+    e->rows.rows = (char *)e->text + text_len;
+    return e;
+}
+
+/*  FUNCTION: add_entry
+    INPUT:  cache, a cache.
+            e, an entry not in the cache, with its hash set.
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (the entry is not added).
+*/
+static int add_entry(Split_cache *cache, Cache_entry *e)
+{
+    if (2 * (cache->n_entries + 1) > cache->n_slots && grow_table(cache) == -1)
+        return -1;
+    *find_slot(cache, e->hash, e->text, e->text_len, e->col_width) = e;
+    cache->n_entries++;
+    cache->bytes += sizeof(*e) + e->rows.n_rows * sizeof(size_t) + e->text_len + e->rows.rows_len;
+    return 0;
+}
+
+/*  FUNCTION: cache_lookup
+    INPUT:  cache, a cache.
+            text, a processed line (not empty).
+            len, the length of the line.
+            col_width, the width of the columns.
+    OUTPUT: the rows of the line, NULL if the line is not in the cache.
+*/
+const Line_rows *cache_lookup(Split_cache *cache, const char *text, size_t len, int col_width)
+{
+    Cache_entry *e = NULL;
+    if (cache->n_slots > 0)
+        e = *find_slot(cache, hash_bytes(text, len, (unsigned)col_width), text, len, col_width);
+    if (e == NULL)
+    {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    return &e->rows;
+}
+
+/*  FUNCTION: cache_insert
+    INPUT:  cache, a cache.
+            text, a processed line (not empty).
+            len, the length of the line.
+            col_width, the width of the columns.
+            rows, the rows of the line.
+    OUTPUT: 0 on success (also when the cache is full), -1 if the memory could not be allocated.
+
+    The line, its rows and their ends are copied in a single piece of the arena of the cache.
+*/
+int cache_insert(Split_cache *cache, const char *text, size_t len, int col_width, const Line_rows *rows)
+{
+    if (cache->bytes >= CACHE_MAX_BYTES)
+        return 0;
+    Cache_entry *e = new_entry(cache, col_width, len, rows->n_rows, rows->rows_len);
+    if (e == NULL)
+        return -1;
+    e->hash = hash_bytes(text, len, (unsigned)col_width);
+    memcpy(e->rows.ends, rows->ends, rows->n_rows * sizeof(size_t));
+    memcpy((char *)e->text, text, len);
+    memcpy(e->rows.rows, rows->rows, rows->rows_len);
+    if (add_entry(cache, e) == -1)
+        return -1;
+    cache->dirty = true;
+    return 0;
+}
+
+/*  FUNCTION: load_cache
+    INPUT:  cache, an empty cache.
+            f, the cache file, positioned after the magic.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_IO if the file is not a valid cache or SPLIT_ERR_NOMEM.
+
+    Every entry is a header of four size_t (width, length of the line, number of rows, length of the rows) followed by the ends of the rows, the line and the rows, in the byte order of the machine that wrote it. The entries are checked so that a damaged file cannot produce rows out of their buffer.
+*/
+static Split_status load_cache(Split_cache *cache, FILE *f)
+{
+    size_t head[4];
+    while (fread(head, sizeof(head), 1, f) == 1)
+    {
+        if (head[0] < 1 || head[0] > INT32_MAX || head[1] < 1 || head[1] > CACHE_MAX_BYTES || head[2] > head[1] ||
+            head[3] > head[0] * head[2] * 4)
+            return SPLIT_ERR_IO;
+        Cache_entry *e = new_entry(cache, (int)head[0], head[1], head[2], head[3]);
+        if (e == NULL)
+            return SPLIT_ERR_NOMEM;
+        size_t body = head[2] * sizeof(size_t) + head[1] + head[3];
+        bool valid = fread(e->rows.ends, 1, body, f) == body;
+        for (size_t r = 0; valid && r < head[2]; r++)
+            valid = e->rows.ends[r] <= head[3] && (r == 0 || e->rows.ends[r] >= e->rows.ends[r - 1]);
+        if (!valid)
+            return SPLIT_ERR_IO;
+        e->hash = hash_bytes(e->text, e->text_len, (unsigned)e->col_width);
+        if (*find_slot(cache, e->hash, e->text, e->text_len, e->col_width) != NULL)
+            continue; // a duplicate
+        if (add_entry(cache, e) == -1)
+            return SPLIT_ERR_NOMEM;
+    }
+    return ferror(f) ? SPLIT_ERR_IO : SPLIT_OK;
+}
+
+/*  FUNCTION: split_cache_open
+    INPUT:  cache, where to store the new cache.
+            path, the cache file, NULL for a cache in memory only.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_IO or SPLIT_ERR_NOMEM.
+*/
+Split_status split_cache_open(Split_cache **cache, const char *path)
+{
+    *cache = NULL;
+    Split_cache *c = calloc(1, sizeof(*c));
+    if (c == NULL || grow_table(c) == -1 || (path != NULL && (c->path = strdup(path)) == NULL))
+    {
+        split_cache_close(c);
+        return SPLIT_ERR_NOMEM;
+    }
+    if (path != NULL)
+    {
+        FILE *f = fopen(path, "rb");
+        if (f == NULL && errno != ENOENT)
+        {
+            split_cache_close(c);
+            return SPLIT_ERR_IO;
+        }
+        if (f != NULL)
+        {
+            char magic[sizeof(CACHE_MAGIC) - 1];
+            Split_status status = SPLIT_ERR_IO;
+            if (fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0)
+                status = load_cache(c, f);
+            fclose(f);
+            if (status != SPLIT_OK)
+            {
+                split_cache_close(c);
+                return status;
+            }
+        }
+    }
+    *cache = c;
+    return SPLIT_OK;
+}
+
+/*  FUNCTION: split_cache_save
+    INPUT:  cache, a cache.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_IO or SPLIT_ERR_NOMEM.
+
+    The entries are written to a temporary file next to the cache file, which then replaces it, so that a run interrupted while saving leaves the previous file intact. Nothing is written if no line has been added.
+*/
+Split_status split_cache_save(Split_cache *cache)
+{
+    if (cache->path == NULL || !cache->dirty)
+        return SPLIT_OK;
+    size_t n = strlen(cache->path) + 32;
+    char *tmp = malloc(n);
+    if (tmp == NULL)
+        return SPLIT_ERR_NOMEM;
+    snprintf(tmp, n, "%s.%ld.tmp", cache->path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f != NULL && fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1, 1, f) == 1;
+    for (size_t k = 0; ok && k < cache->n_slots; k++)
+    {
+        const Cache_entry *e = cache->slots[k];
+        if (e == NULL)
+            continue;
+        size_t head[4] = {e->col_width, e->text_len, e->rows.n_rows, e->rows.rows_len};
+        ok = fwrite(head, sizeof(head), 1, f) == 1 &&
+             fwrite(e->rows.ends, sizeof(size_t), e->rows.n_rows, f) == e->rows.n_rows &&
+             fwrite(e->text, 1, e->text_len, f) == e->text_len &&
+             fwrite(e->rows.rows, 1, e->rows.rows_len, f) == e->rows.rows_len;
+    }
+    if (f != NULL && fclose(f) != 0)
+        ok = false;
+    if (ok && rename(tmp, cache->path) == 0)
+        cache->dirty = false;
+    else
+    {
+        ok = false;
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok ? SPLIT_OK : SPLIT_ERR_IO;
+}
+
+/*  FUNCTION: split_cache_counters
+    INPUT:  cache, a cache.
+            hits, misses, entries, where the counters are stored.
+    OUTPUT: void
+*/
+void split_cache_counters(const Split_cache *cache, unsigned long long *hits, unsigned long long *misses, size_t *entries)
+{
+    *hits = cache->hits;
+    *misses = cache->misses;
+    *entries = cache->n_entries;
+}
+
+/*  FUNCTION: split_cache_close
+    INPUT:  cache, a cache or NULL.
+    OUTPUT: void
+*/
+void split_cache_close(Split_cache *cache)
+{
+    if (cache == NULL)
+        return;
+    arena_free(&cache->entries);
+    free(cache->slots);
+    free(cache->path);
+    free(cache);
+}
\ No newline at end of file
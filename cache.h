@@ -0,0 +1,86 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include "splittext.h"
+#include "processing.h"
+#include "alloc_utils.h"
+#include "stats.h"
+
+#define CACHE_MAGIC "SPLTCAC1"              // first bytes of a cache file
+#define CACHE_MAX_BYTES ((size_t)256 << 20) // memory above which no more lines are cached
+
+/*      The struct contains a line of the cache:
+        uint64_t hash - the hash of the line and of the column width.
+        int col_width - the width of the columns the line was broken for.
+        size_t text_len - the length of the processed line.
+        const char *text - the processed line (not null terminated).
+        Line_rows rows - the justified rows of the line (its capacities are 0, the rows are not to be grown).
+
+        An entry is a single allocation: the struct is followed by the ends of the rows, the line and the rows.
+*/
+typedef struct Cache_entry
+{
+    uint64_t hash;
+    int col_width;
+    size_t text_len;
+    const char *text;
+    Line_rows rows;
+} Cache_entry;
+
+/*      The struct contains a cache of justified lines:
+        char *path - the file the cache is loaded from and saved to, NULL if it lives in memory only.
+        Cache_entry **slots - the hash table (open addressing with linear probing), NULL slots are free.
+        size_t n_slots, n_entries - the size of the table (a power of 2) and the number of entries.
+        size_t bytes - the memory taken by the entries.
+        uint64_t hits, misses - the lookups that found the line and the ones that did not.
+        bool dirty - whether entries have been added since the cache was loaded.
+        Arena entries - the memory of the entries, which are never removed: it is freed with the cache.
+*/
+struct Split_cache
+{
+    char *path;
+    Cache_entry **slots;
+    size_t n_slots, n_entries;
+    size_t bytes;
+    uint64_t hits, misses;
+    bool dirty;
+    Arena entries;
+};
+
+/*  FUNCTION: hash_bytes
+    INPUT:  data, the bytes to hash.
+            len, the number of bytes.
+            seed, a value mixed into the hash.
+    OUTPUT: a 64-bit hash of the bytes and of the seed (not cryptographic).
+*/
+uint64_t hash_bytes(const char *data, size_t len, uint64_t seed);
+
+/*  FUNCTION: cache_lookup
+    INPUT:  cache, a cache.
+            text, a processed line (not empty).
+            len, the length of the line.
+            col_width, the width of the columns.
+    OUTPUT: the rows of the line, NULL if the line is not in the cache.
+
+    The rows are valid as long as the cache is open.
+*/
+const Line_rows *cache_lookup(Split_cache *cache, const char *text, size_t len, int col_width);
+
+/*  FUNCTION: cache_insert
+    INPUT:  cache, a cache.
+            text, a processed line (not empty).
+            len, the length of the line.
+            col_width, the width of the columns.
+            rows, the rows of the line, as produced by break_line.
+    OUTPUT: 0 on success (also when the cache is full and the line is not added), -1 if the memory could not be allocated.
+*/
+int cache_insert(Split_cache *cache, const char *text, size_t len, int col_width, const Line_rows *rows);
+
+#endif
\ No newline at end of file
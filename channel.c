@@ -0,0 +1,513 @@
+#include "channel.h"
+#include "io_utils.h"
+
+#define WAIT_MS 100 // how long a side sleeps before checking that the other side is still alive
+
+/*  FUNCTION: futex
+    INPUT:  addr, the futex word.
+            op, FUTEX_WAIT or FUTEX_WAKE.
+            val, the expected value of the word (FUTEX_WAIT) or the number of processes to wake (FUTEX_WAKE).
+            timeout, the maximum time to sleep, NULL to sleep until woken.
+    OUTPUT: the value returned by the system call.
+
+    glibc does not provide a wrapper. The futexes are shared between processes, so FUTEX_PRIVATE_FLAG is not used.
+*/
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, (uint32_t *)addr, op, val, timeout, NULL, 0);
+}
+
+/*  FUNCTION: ring_create
+    INPUT:  void
+    OUTPUT: a new empty ring.
+
+    The ring is placed in an anonymous shared mapping, so that it is inherited by the children created afterwards. The mapping is zero filled, hence the ring is empty and open. If the mapping fails an error message is printed out and the program exits.
+*/
+static Ring *ring_create(void)
+{
+    Ring *r = mmap(NULL, sizeof(Ring) + RING_CAP, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED)
+    {
+        perror("Error mapping the shared ring");
+        exit(EXIT_FAILURE);
+    }
+    r->producer = getpid();
+    return r;
+}
+
+/*  FUNCTION: producer_gone
+    INPUT:  r, a ring.
+    OUTPUT: true if the producer terminated.
+
+    The producer is the parent of the consumer: when it terminates the consumer is adopted by another process.
+*/
+static bool producer_gone(Ring *r)
+{
+    return getppid() != r->producer;
+}
+
+/*  FUNCTION: consumer_gone
+    INPUT:  r, a ring.
+    OUTPUT: true if the consumer terminated.
+
+    The consumer is a child of the producer, its state is queried with WNOWAIT so that it can still be waited for later.
+*/
+static bool consumer_gone(Ring *r)
+{
+    siginfo_t info;
+    info.si_pid = 0; // stays 0 if the child is still running
+    return waitid(P_PID, r->consumer, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid != 0;
+}
+
+/*  FUNCTION: ring_signal
+    INPUT:  seq, the futex word of the event.
+            waiting, the flag telling whether the other side is sleeping on seq.
+    OUTPUT: void
+
+    Tells the other side that something changed: the event counter is incremented (so that a side about to sleep on the old value returns at once) and the side is woken only if it announced that it is sleeping.
+*/
+static void ring_signal(_Atomic uint32_t *seq, _Atomic uint32_t *waiting)
+{
+    atomic_fetch_add(seq, 1);
+    if (atomic_load(waiting))
+        futex(seq, FUTEX_WAKE, 1, NULL);
+}
+
+/*  FUNCTION: ring_wait
+    INPUT:  pos, the position the caller is waiting to change (head for the consumer, tail for the producer).
+            old, the value of pos seen by the caller.
+            seq, the futex word of the event.
+            waiting, the flag used to announce the sleep.
+            closed, the closed flag of the ring (NULL for the producer).
+    OUTPUT: false if the wait timed out without any change, true otherwise.
+
+    The caller first reads the event counter, then announces that it is going to sleep and checks the condition again: if the other side changes the condition afterwards, it will see the announcement and increment the counter, so the sleep either does not start or it is interrupted.
+*/
+static bool ring_wait(_Atomic uint32_t *pos, uint32_t old, _Atomic uint32_t *seq, _Atomic uint32_t *waiting, _Atomic uint32_t *closed)
+{
+    struct timespec timeout = {.tv_sec = 0, .tv_nsec = WAIT_MS * 1000000L};
+    bool woken = true;
+    uint32_t s = atomic_load(seq);
+    atomic_store(waiting, 1);
+    if (atomic_load(pos) == old && (closed == NULL || !atomic_load(closed)))
+        woken = !(futex(seq, FUTEX_WAIT, s, &timeout) == -1 && errno == ETIMEDOUT);
+    atomic_store(waiting, 0);
+    return woken;
+}
+
+/*  FUNCTION: ring_writev
+    INPUT:  r, a ring.
+            iov, an array of buffers to write.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    Copies the buffers into the free space of the ring, wrapping around the end of the data array, and publishes the new head whenever the ring is full or all the buffers have been copied. If the consumer terminated, the process is killed by SIGPIPE, as a write on a pipe without readers would do (if the signal is ignored an error message is printed out and the program exits).
+*/
+static void ring_writev(Ring *r, const struct iovec *iov, int iovcnt)
+{
+    uint32_t h = atomic_load_explicit(&r->head, memory_order_relaxed); // only the producer writes head
+    uint32_t published = h;
+    for (int k = 0; k < iovcnt; k++)
+    {
+        const char *src = iov[k].iov_base;
+        size_t n = iov[k].iov_len;
+        while (n > 0)
+        {
+            uint32_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+            uint32_t space = RING_CAP - (h - t);
+            if (space == 0)
+            {
+                if (published != h) // let the consumer empty the ring
+                {
+                    atomic_store(&r->head, h);
+                    published = h;
+                    ring_signal(&r->head_seq, &r->cons_waiting);
+                }
+                stats_begin(STAGE_WAIT_WRITE);
+                bool woken = ring_wait(&r->tail, t, &r->tail_seq, &r->prod_waiting, NULL);
+                stats_end(STAGE_WAIT_WRITE);
+                if (!woken && consumer_gone(r))
+                {
+                    raise(SIGPIPE); // behave like a write on a pipe without readers
+                    fprintf(stderr, "Ring reader terminated unexpectedly\n");
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            }
+            size_t len = n < space ? n : space;
+            size_t off = h & (RING_CAP - 1);
+            size_t first = len < RING_CAP - off ? len : RING_CAP - off;
+            memcpy(r->data + off, src, first);
+            memcpy(r->data, src + first, len - first);
+            h += len;
+            src += len;
+            n -= len;
+        }
+    }
+    if (published != h)
+    {
+        atomic_store(&r->head, h);
+        ring_signal(&r->head_seq, &r->cons_waiting);
+    }
+}
+
+/*  FUNCTION: ring_get
+    INPUT:  r, a ring.
+            data, pointer to the string that will point to the bytes available.
+    OUTPUT: the number of contiguous bytes available at *data, 0 if the ring is closed (or its producer terminated) and empty.
+*/
+static size_t ring_get(Ring *r, const char **data)
+{
+    uint32_t t = atomic_load_explicit(&r->tail, memory_order_relaxed); // only the consumer writes tail
+    while (1)
+    {
+        uint32_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (h != t)
+        {
+            size_t off = t & (RING_CAP - 1);
+            size_t avail = h - t;
+            *data = r->data + off;
+            return avail < RING_CAP - off ? avail : RING_CAP - off;
+        }
+        if (atomic_load(&r->closed))
+        {
+            if (atomic_load(&r->head) == t) // the head is stored before the closed flag
+                return 0;
+            continue;
+        }
+        stats_begin(STAGE_WAIT_READ);
+        bool woken = ring_wait(&r->head, t, &r->head_seq, &r->cons_waiting, &r->closed);
+        stats_end(STAGE_WAIT_READ);
+        if (!woken && producer_gone(r))
+            return 0;
+    }
+}
+
+/*  FUNCTION: ring_release
+    INPUT:  r, a ring.
+            n, the number of bytes consumed.
+    OUTPUT: void
+*/
+static void ring_release(Ring *r, size_t n)
+{
+    atomic_store(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + (uint32_t)n);
+    ring_signal(&r->tail_seq, &r->prod_waiting);
+}
+
+/*  FUNCTION: open_channel
+    INPUT:  ch, a pointer to the Channel to initialise.
+            type, the kind of channel.
+            pipe_size, the capacity of the pipe in bytes, 0 for the default of the system (ignored by rings).
+    OUTPUT: void
+
+    Creates the pipe or maps the shared ring, if this fails an error message is printed out and the program exits. The capacity of a pipe is set with F_SETPIPE_SZ, which rounds it up to a power of 2 pages; an unprivileged process cannot go over /proc/sys/fs/pipe-max-size.
+*/
+void open_channel(Channel *ch, Chan_type type, int pipe_size)
+{
+    ch->type = type;
+    ch->ring = NULL;
+    ch->fd[0] = ch->fd[1] = -1;
+    ch->cap = RING_CAP;
+    if (type == CHAN_SHM)
+    {
+        ch->ring = ring_create();
+        return;
+    }
+    if (pipe(ch->fd) == -1)
+    {
+        perror("Pipe failed");
+        exit(EXIT_FAILURE);
+    }
+    int cap = pipe_size > 0 ? fcntl(ch->fd[1], F_SETPIPE_SZ, pipe_size) : fcntl(ch->fd[1], F_GETPIPE_SZ);
+    if (cap == -1)
+    {
+        perror("Error setting the capacity of a pipe");
+        exit(EXIT_FAILURE);
+    }
+    ch->cap = cap;
+}
+
+/*  FUNCTION: channel_writer
+    INPUT:  ch, a pointer to an opened Channel.
+            reader, the process id of the reading process (a child of the caller).
+    OUTPUT: void
+*/
+void channel_writer(Channel *ch, pid_t reader)
+{
+    if (ch->type == CHAN_SHM)
+        ch->ring->consumer = reader;
+    else
+        close(ch->fd[0]);
+}
+
+/*  FUNCTION: channel_reader
+    INPUT:  ch, a pointer to an opened Channel.
+    OUTPUT: void
+*/
+void channel_reader(Channel *ch)
+{
+    if (ch->type == CHAN_PIPE)
+        close(ch->fd[1]);
+}
+
+/*  FUNCTION: channel_sink
+    INPUT:  ctx, a pointer to the writing side of a Channel.
+            iov, an array of buffers to write.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    Pipes get all the buffers with a single writev (repeated on short writes), rings get them copied in with a single publication.
+
+    The time spent waiting for free space in a ring, or in the whole write on a pipe, is counted as blocked writing in the statistics.
+*/
+void channel_sink(void *ctx, struct iovec *iov, int iovcnt)
+{
+    Channel *ch = ctx;
+    if (ch->type == CHAN_SHM)
+        ring_writev(ch->ring, iov, iovcnt);
+    else
+    {
+        stats_begin(STAGE_WAIT_WRITE);
+        write_all(ch->fd[1], iov, iovcnt);
+        stats_end(STAGE_WAIT_WRITE);
+    }
+}
+
+/*  FUNCTION: channel_write
+    INPUT:  ch, a pointer to the writing side of a Channel.
+            buf, the bytes to write.
+            n, the number of bytes to write.
+    OUTPUT: void
+*/
+void channel_write(Channel *ch, const void *buf, size_t n)
+{
+    struct iovec iov = {.iov_base = (void *)buf, .iov_len = n};
+    channel_sink(ch, &iov, 1);
+}
+
+/*  FUNCTION: channel_get
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            data, pointer to the string that will point to the bytes available.
+            buf, a buffer used by pipes.
+            cap, the capacity of buf.
+    OUTPUT: the number of bytes available at *data, 0 if the writer closed the channel.
+
+    Reads interrupted by a signal are repeated, if a read fails an error message is printed out and the program exits.
+
+    The time spent waiting for data in a ring, or in the read on a pipe, is counted as blocked reading in the statistics.
+*/
+size_t channel_get(Channel *ch, const char **data, char *buf, size_t cap)
+{
+    if (ch->type == CHAN_SHM)
+        return ring_get(ch->ring, data);
+
+    ssize_t n;
+    stats_begin(STAGE_WAIT_READ);
+    while ((n = read(ch->fd[0], buf, cap)) == -1)
+    {
+        if (errno != EINTR)
+        {
+            perror("Pipe read failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stats_end(STAGE_WAIT_READ);
+    *data = buf;
+    return n;
+}
+
+/*  FUNCTION: channel_release
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            n, the number of bytes returned by the last call of channel_get.
+    OUTPUT: void
+*/
+void channel_release(Channel *ch, size_t n)
+{
+    if (ch->type == CHAN_SHM)
+        ring_release(ch->ring, n);
+}
+
+/*  FUNCTION: channel_read
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            buf, where to store the bytes.
+            n, the number of bytes to read.
+    OUTPUT: the number of bytes read, less than n only if the writer closed the channel.
+
+    The function keeps reading until n bytes have arrived, so a short read on a pipe does not break the stream.
+*/
+size_t channel_read(Channel *ch, void *buf, size_t n)
+{
+    char *dst = buf;
+    size_t got = 0;
+    while (got < n)
+    {
+        const char *data;
+        size_t avail = channel_get(ch, &data, dst + got, n - got);
+        if (avail == 0)
+            break;
+        if (avail > n - got) // only a ring can offer more than asked
+            avail = n - got;
+        if (data != dst + got)
+            memcpy(dst + got, data, avail);
+        channel_release(ch, avail);
+        got += avail;
+    }
+    return got;
+}
+
+/*  FUNCTION: close_channel
+    INPUT:  ch, a pointer to a Channel.
+            writer, true on the writing side.
+    OUTPUT: void
+
+    The writer of a ring sets the closed flag (after the last head, so that a reader seeing the flag sees all the data) and wakes the reader, then both sides unmap the ring.
+*/
+void close_channel(Channel *ch, bool writer)
+{
+    if (ch->type == CHAN_PIPE)
+    {
+        close(ch->fd[writer ? 1 : 0]);
+        return;
+    }
+    if (writer)
+    {
+        atomic_store(&ch->ring->closed, 1);
+        ring_signal(&ch->ring->head_seq, &ch->ring->cons_waiting);
+    }
+    munmap(ch->ring, sizeof(Ring) + RING_CAP);
+    ch->ring = NULL;
+}
+
+/*  FUNCTION: open_frame
+    INPUT:  f, a pointer to the Frame to initialise.
+    OUTPUT: void
+
+    If the allocation fails an error message is printed out and the program exits.
+*/
+void open_frame(Frame *f)
+{
+    f->cap = FRAME_BYTES;
+    f->buf = malloc(f->cap);
+    if (f->buf == NULL)
+    {
+        perror("Error allocating a batch");
+        exit(EXIT_FAILURE);
+    }
+    stats_alloc();
+    f->len = sizeof(uint32_t); // room for the header
+    f->pos = f->len;
+}
+
+/*  FUNCTION: frame_put
+    INPUT:  ch, a pointer to the writing side of a Channel.
+            f, a pointer to an opened Frame.
+            rec, the bytes of the record.
+            n, the number of bytes of the record.
+    OUTPUT: void
+
+    A record larger than FRAME_BYTES is sent alone in a batch grown to hold it. The lengths of the records and of the batches are 32-bit, so a record larger than FRAME_MAX_RECORD cannot be sent: an error message is printed out and the program exits, as it does if the batch cannot be grown.
+*/
+void frame_put(Channel *ch, Frame *f, const void *rec, size_t n)
+{
+    if (n > FRAME_MAX_RECORD)
+    {
+        fprintf(stderr, "Error: a record of %zu bytes is too large for a batch (at most %zu bytes).\n", n, (size_t)FRAME_MAX_RECORD);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t len = n;
+    if (f->len + sizeof(len) + n > f->cap)
+    {
+        frame_flush(ch, f);
+        if (f->len + sizeof(len) + n > f->cap)
+        {
+            char *tmp = realloc(f->buf, f->len + sizeof(len) + n);
+            if (tmp == NULL)
+            {
+                perror("Error allocating a batch");
+                exit(EXIT_FAILURE);
+            }
+            stats_alloc();
+            f->buf = tmp;
+            f->cap = f->len + sizeof(len) + n;
+        }
+    }
+    memcpy(f->buf + f->len, &len, sizeof(len));
+    memcpy(f->buf + f->len + sizeof(len), rec, n);
+    f->len += sizeof(len) + n;
+}
+
+/*  FUNCTION: frame_flush
+    INPUT:  ch, a pointer to the writing side of a Channel.
+            f, a pointer to an opened Frame.
+    OUTPUT: void
+
+    The header is filled with the number of bytes of the records and the whole batch is written at once.
+*/
+void frame_flush(Channel *ch, Frame *f)
+{
+    uint32_t len = f->len - sizeof(len);
+    if (len == 0)
+        return;
+    memcpy(f->buf, &len, sizeof(len));
+    channel_write(ch, f->buf, f->len);
+    f->len = sizeof(len);
+}
+
+/*  FUNCTION: frame_get
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            f, a pointer to an opened Frame.
+            n, where to store the number of bytes of the record.
+    OUTPUT: a pointer to the next record, or NULL if the writer closed the channel.
+
+    A batch is received by reading its header and then exactly the number of bytes it announces, so short reads on a pipe do not break the stream. If the channel ends in the middle of a batch an error message is printed out and the program exits.
+*/
+char *frame_get(Channel *ch, Frame *f, size_t *n)
+{
+    uint32_t len;
+    if (f->pos >= f->len)
+    {
+        size_t got = channel_read(ch, &len, sizeof(len));
+        if (got == 0) // no more batches
+            return NULL;
+        if (got != sizeof(len))
+        {
+            fprintf(stderr, "Channel read terminated unexpectedly\n");
+            exit(EXIT_FAILURE);
+        }
+        if (len > f->cap)
+        {
+            char *tmp = realloc(f->buf, len);
+            if (tmp == NULL)
+            {
+                perror("Error allocating a batch");
+                exit(EXIT_FAILURE);
+            }
+            stats_alloc();
+            f->buf = tmp;
+            f->cap = len;
+        }
+        if (channel_read(ch, f->buf, len) != len)
+        {
+            fprintf(stderr, "Channel read terminated unexpectedly\n");
+            exit(EXIT_FAILURE);
+        }
+        f->len = len;
+        f->pos = 0;
+    }
+    memcpy(&len, f->buf + f->pos, sizeof(len));
+    char *rec = f->buf + f->pos + sizeof(len);
+    f->pos += sizeof(len) + len;
+    *n = len;
+    return rec;
+}
+
+/*  FUNCTION: close_frame
+    INPUT:  f, a pointer to an opened Frame.
+    OUTPUT: void
+*/
+void close_frame(Frame *f)
+{
+    free(f->buf);
+    f->buf = NULL;
+    f->cap = 0;
+}
\ No newline at end of file
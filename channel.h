@@ -0,0 +1,224 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#define _GNU_SOURCE // F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include "stats.h"
+
+#define RING_CAP (1u << 20) // capacity in bytes of a shared-memory ring, a power of 2
+#define CACHE_LINE 64
+#define FRAME_BYTES (1 << 16) // a batch of records is sent as soon as it holds this many bytes
+#define FRAME_MAX_RECORD (UINT32_MAX - sizeof(uint32_t)) // the largest record: its length and that of its batch are 32-bit
+
+/*      The struct is the header of a single-producer/single-consumer ring of bytes placed in memory shared by two processes:
+        head - the number of bytes written so far (modulo 2^32), only the producer changes it.
+        head_seq - a futex word incremented by the producer whenever it publishes data or closes the ring.
+        prod_waiting - set while the producer sleeps waiting for free space.
+        tail - the number of bytes read so far (modulo 2^32), only the consumer changes it.
+        tail_seq - a futex word incremented by the consumer whenever it frees space.
+        cons_waiting - set while the consumer sleeps waiting for data.
+        closed - set by the producer when it will not write anymore.
+        producer, consumer - the process ids of the two sides, used to detect a side that terminated without closing the ring.
+        data - the bytes of the ring, RING_CAP of them.
+
+        The fields written by the producer and those written by the consumer live on different cache lines, so that the two processes do not keep stealing the line from each other. A side sleeps on the futex word of the other side only when the ring is empty (or full) and only wakes the other side if it announced that it is sleeping, so a steady stream costs no system call at all.
+*/
+typedef struct Ring
+{
+    _Alignas(CACHE_LINE) _Atomic uint32_t head;
+    _Atomic uint32_t head_seq;
+    _Atomic uint32_t prod_waiting;
+    _Alignas(CACHE_LINE) _Atomic uint32_t tail;
+    _Atomic uint32_t tail_seq;
+    _Atomic uint32_t cons_waiting;
+    _Alignas(CACHE_LINE) _Atomic uint32_t closed;
+    pid_t producer;
+    pid_t consumer;
+    _Alignas(CACHE_LINE) char data[];
+} Ring;
+
+typedef enum
+{
+    CHAN_SHM, // shared-memory ring
+    CHAN_PIPE // anonymous pipe
+} Chan_type;
+
+/*      The struct describes a one-way channel between two processes:
+        Chan_type type - whether the channel is a shared-memory ring or a pipe.
+        int fd[2] - the read and write ends of the pipe.
+        Ring *ring - the shared ring.
+        size_t cap - the bytes the channel holds before the writer waits (RING_CAP, or the capacity of the pipe).
+*/
+typedef struct Channel
+{
+    Chan_type type;
+    int fd[2];
+    Ring *ring;
+    size_t cap;
+} Channel;
+
+/*      The struct contains a batch of records exchanged through a channel:
+        char *buf - the batch: a header with the number of bytes of the records, then the records.
+        size_t len - the bytes used in buf (header included) by the writer, the bytes received by the reader.
+        size_t pos - the offset of the next record to be returned to the reader.
+        size_t cap - the capacity of buf.
+
+        Each record is its length (a uint32_t) followed by its bytes. Packing many records in a batch sent by a single write replaces the two writes (length, then bytes) per record, and the reader gets the whole batch with two reads.
+*/
+typedef struct Frame
+{
+    char *buf;
+    size_t len;
+    size_t pos;
+    size_t cap;
+} Frame;
+
+/*  FUNCTION: open_channel
+    INPUT:  ch, a pointer to the Channel to initialise.
+            type, the kind of channel.
+            pipe_size, the capacity of the pipe in bytes, 0 for the default of the system (ignored by rings).
+    OUTPUT: void
+
+    Creates the pipe or maps the shared ring. Must be called before fork by the process that will write to the channel.
+*/
+void open_channel(Channel *ch, Chan_type type, int pipe_size);
+
+/*  FUNCTION: channel_writer
+    INPUT:  ch, a pointer to an opened Channel.
+            reader, the process id of the reading process (a child of the caller).
+    OUTPUT: void
+
+    Prepares the writing side after fork, closing the unused end of the pipe.
+*/
+void channel_writer(Channel *ch, pid_t reader);
+
+/*  FUNCTION: channel_reader
+    INPUT:  ch, a pointer to an opened Channel.
+    OUTPUT: void
+
+    Prepares the reading side after fork, closing the unused end of the pipe.
+*/
+void channel_reader(Channel *ch);
+
+/*  FUNCTION: channel_write
+    INPUT:  ch, a pointer to the writing side of a Channel.
+            buf, the bytes to write.
+            n, the number of bytes to write.
+    OUTPUT: void
+
+    Writes all the n bytes, waiting for the reader when the channel is full.
+*/
+void channel_write(Channel *ch, const void *buf, size_t n);
+
+/*  FUNCTION: channel_sink
+    INPUT:  ctx, a pointer to the writing side of a Channel.
+            iov, an array of buffers to write.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    Writes all the buffers to the channel, it can be used as the sink of an Out_stream.
+*/
+void channel_sink(void *ctx, struct iovec *iov, int iovcnt);
+
+/*  FUNCTION: channel_read
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            buf, where to store the bytes.
+            n, the number of bytes to read.
+    OUTPUT: the number of bytes read, less than n only if the writer closed the channel.
+
+    Reads exactly n bytes, waiting for the writer when the channel is empty.
+*/
+size_t channel_read(Channel *ch, void *buf, size_t n);
+
+/*  FUNCTION: channel_get
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            data, pointer to the string that will point to the bytes available.
+            buf, a buffer used by pipes.
+            cap, the capacity of buf.
+    OUTPUT: the number of bytes available at *data, 0 if the writer closed the channel.
+
+    Waits for some bytes to be available. For a ring *data points directly into the shared memory and the bytes must be given back with channel_release once used, for a pipe the bytes are read into buf.
+*/
+size_t channel_get(Channel *ch, const char **data, char *buf, size_t cap);
+
+/*  FUNCTION: channel_release
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            n, the number of bytes returned by the last call of channel_get.
+    OUTPUT: void
+
+    Gives the space of the bytes already used back to the writer.
+*/
+void channel_release(Channel *ch, size_t n);
+
+/*  FUNCTION: close_channel
+    INPUT:  ch, a pointer to a Channel.
+            writer, true on the writing side.
+    OUTPUT: void
+
+    Closes the side of the channel owned by the caller. Closing the writing side tells the reader that no more data will come.
+*/
+void close_channel(Channel *ch, bool writer);
+
+/*  FUNCTION: open_frame
+    INPUT:  f, a pointer to the Frame to initialise.
+    OUTPUT: void
+
+    Allocates an empty batch of FRAME_BYTES bytes.
+*/
+void open_frame(Frame *f);
+
+/*  FUNCTION: frame_put
+    INPUT:  ch, a pointer to the writing side of a Channel.
+            f, a pointer to an opened Frame.
+            rec, the bytes of the record.
+            n, the number of bytes of the record.
+    OUTPUT: void
+
+    Appends a record to the batch, the batch is sent first if the record does not fit in it. A record larger than FRAME_MAX_RECORD makes the program exit with an error.
+*/
+void frame_put(Channel *ch, Frame *f, const void *rec, size_t n);
+
+/*  FUNCTION: frame_flush
+    INPUT:  ch, a pointer to the writing side of a Channel.
+            f, a pointer to an opened Frame.
+    OUTPUT: void
+
+    Sends the batch, if not empty, and empties it.
+*/
+void frame_flush(Channel *ch, Frame *f);
+
+/*  FUNCTION: frame_get
+    INPUT:  ch, a pointer to the reading side of a Channel.
+            f, a pointer to an opened Frame.
+            n, where to store the number of bytes of the record.
+    OUTPUT: a pointer to the next record, valid until the next call, or NULL if the writer closed the channel.
+
+    Returns the records of the current batch one after the other, receiving the next batch when the current one is exhausted.
+*/
+char *frame_get(Channel *ch, Frame *f, size_t *n);
+
+/*  FUNCTION: close_frame
+    INPUT:  f, a pointer to an opened Frame.
+    OUTPUT: void
+
+    Frees the batch, the records not yet sent are lost (call frame_flush first).
+*/
+void close_frame(Frame *f);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,794 @@
+#include "compress.h"
+
+#define Z_MAP_STEP ((size_t)1 << 30) // bytes of a mapping given to the decoder at a time (its counters are 32-bit)
+
+/*  FUNCTION: z_format
+    INPUT:  data, the first bytes of a stream.
+            len, the number of bytes.
+    OUTPUT: the format whose magic bytes start data, Z_NONE if none does.
+
+    gzip streams start with 1f 8b, zstd frames with 28 b5 2f fd.
+*/
+Z_format z_format(const char *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+        return Z_GZIP;
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+        return Z_ZSTD;
+    return Z_NONE;
+}
+
+/*  FUNCTION: z_format_name
+    INPUT:  name, the name of a format given on the command line.
+    OUTPUT: the format, Z_NONE if the name is not known or the format is not supported by this build.
+*/
+Z_format z_format_name(const char *name)
+{
+    if (strcmp(name, "gzip") == 0)
+        return Z_GZIP;
+#ifdef HAVE_ZSTD
+    if (strcmp(name, "zstd") == 0)
+        return Z_ZSTD;
+#endif
+    return Z_NONE;
+}
+
+/*  FUNCTION: ring_init
+    INPUT:  r, the ring to initialise.
+            n_bufs, the number of buffers.
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (nothing is left allocated).
+*/
+static int ring_init(Z_ring *r, int n_bufs)
+{
+    memset(r, 0, sizeof(*r));
+    r->bufs = calloc(n_bufs, sizeof(*r->bufs));
+    r->lens = calloc(n_bufs, sizeof(*r->lens));
+    if (r->bufs == NULL || r->lens == NULL)
+    {
+        free(r->bufs);
+        free(r->lens);
+        return -1;
+    }
+    stats_alloc();
+    stats_alloc();
+    r->n_bufs = n_bufs;
+    for (int k = 0; k < n_bufs; k++)
+    {
+        r->bufs[k] = malloc(Z_BUF_BYTES);
+        if (r->bufs[k] == NULL)
+        {
+            while (k-- > 0)
+                free(r->bufs[k]);
+            free(r->bufs);
+            free(r->lens);
+            return -1;
+        }
+        stats_alloc();
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->filled, NULL);
+    pthread_cond_init(&r->emptied, NULL);
+    return 0;
+}
+
+/*  FUNCTION: ring_free
+    INPUT:  r, a ring initialised by ring_init.
+    OUTPUT: void
+*/
+static void ring_free(Z_ring *r)
+{
+    for (int k = 0; k < r->n_bufs; k++)
+        free(r->bufs[k]);
+    free(r->bufs);
+    free(r->lens);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->filled);
+    pthread_cond_destroy(&r->emptied);
+}
+
+/*  FUNCTION: ring_slot
+    INPUT:  r, a ring.
+    OUTPUT: the buffer to fill, NULL if the consumer is gone.
+
+    Waits until a buffer is free.
+*/
+static char *ring_slot(Z_ring *r)
+{
+    pthread_mutex_lock(&r->lock);
+    while (r->count == r->n_bufs && !r->stop)
+        pthread_cond_wait(&r->emptied, &r->lock);
+    char *buf = r->stop ? NULL : r->bufs[(r->head + r->count) % r->n_bufs];
+    pthread_mutex_unlock(&r->lock);
+    return buf;
+}
+
+/*  FUNCTION: ring_push
+    INPUT:  r, a ring.
+            len, the number of bytes written in the buffer returned by ring_slot.
+    OUTPUT: void
+*/
+static void ring_push(Z_ring *r, size_t len)
+{
+    pthread_mutex_lock(&r->lock);
+    r->lens[(r->head + r->count) % r->n_bufs] = len;
+    r->count++;
+    pthread_cond_signal(&r->filled);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/*  FUNCTION: ring_end
+    INPUT:  r, a ring.
+            failed, whether the producer stopped on an error.
+    OUTPUT: void
+
+    Tells the consumer that no buffer follows the full ones.
+*/
+static void ring_end(Z_ring *r, bool failed)
+{
+    pthread_mutex_lock(&r->lock);
+    r->over = true;
+    r->failed = failed;
+    pthread_cond_signal(&r->filled);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/*  FUNCTION: ring_front
+    INPUT:  r, a ring.
+            len, where the number of bytes of the buffer is stored.
+    OUTPUT: the first full buffer, NULL if the producer is done and all the buffers have been read.
+
+    Waits until a buffer is full or the producer is done.
+*/
+static char *ring_front(Z_ring *r, size_t *len)
+{
+    pthread_mutex_lock(&r->lock);
+    while (r->count == 0 && !r->over)
+        pthread_cond_wait(&r->filled, &r->lock);
+    char *buf = NULL;
+    if (r->count > 0)
+    {
+        buf = r->bufs[r->head];
+        *len = r->lens[r->head];
+    }
+    pthread_mutex_unlock(&r->lock);
+    return buf;
+}
+
+/*  FUNCTION: ring_pop
+    INPUT:  r, a ring whose first buffer has been read.
+    OUTPUT: void
+*/
+static void ring_pop(Z_ring *r)
+{
+    pthread_mutex_lock(&r->lock);
+    r->head = (r->head + 1) % r->n_bufs;
+    r->count--;
+    pthread_cond_signal(&r->emptied);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/*  FUNCTION: z_input
+    INPUT:  zi, a compressed input.
+            data, where the pointer to the bytes is stored.
+    OUTPUT: the number of bytes of the next piece of compressed data, 0 at the end, -1 if the input cannot be read (the error has been printed out).
+
+    A mapping is returned in pieces of Z_MAP_STEP bytes, a stream starts with the prefix and is then read into in_buf.
+*/
+static ssize_t z_input(Z_in *zi, const unsigned char **data)
+{
+    size_t n;
+    if (zi->map != NULL)
+    {
+        n = zi->map_len - zi->pos;
+        if (n > Z_MAP_STEP)
+            n = Z_MAP_STEP;
+        *data = (const unsigned char *)zi->map + zi->pos;
+        zi->pos += n;
+        return n;
+    }
+    if (zi->prefix_len > 0)
+    {
+        *data = (const unsigned char *)zi->prefix;
+        n = zi->prefix_len;
+        zi->prefix_len = 0;
+        return n;
+    }
+    n = fread(zi->in_buf, 1, Z_BUF_BYTES, zi->src);
+    if (n == 0 && ferror(zi->src))
+    {
+        perror("Error reading the compressed input");
+        return -1;
+    }
+    *data = (const unsigned char *)zi->in_buf;
+    return n;
+}
+
+/*  FUNCTION: inflate_gzip
+    INPUT:  zi, a gzip input.
+    OUTPUT: true on success, false on error (the error has been printed out).
+
+    The members of the stream are decompressed one after the other, as gzip -d does. New compressed data is read only when the output buffer is not full, so that the output zlib still holds at the end of the input is not lost.
+*/
+static bool inflate_gzip(Z_in *zi)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK) // 16: gzip header and trailer
+    {
+        fprintf(stderr, "Error decompressing the input: %s\n", z.msg != NULL ? z.msg : "cannot initialise zlib");
+        return false;
+    }
+    char *out = ring_slot(&zi->ring);
+    z.next_out = (Bytef *)out;
+    z.avail_out = Z_BUF_BYTES;
+    int ret = Z_OK;
+    bool need_input = true, ok = true;
+    while (out != NULL)
+    {
+        if (need_input && z.avail_in == 0)
+        {
+            const unsigned char *data;
+            ssize_t n = z_input(zi, &data);
+            if (n <= 0)
+            {
+                ok = n == 0;
+                break;
+            }
+            z.next_in = (Bytef *)data;
+            z.avail_in = n;
+        }
+        if (ret == Z_STREAM_END)
+        {
+            if (z.avail_in == 0)
+            {
+                need_input = true;
+                continue;
+            }
+            inflateReset(&z); // another member follows
+        }
+        ret = inflate(&z, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+        {
+            fprintf(stderr, "Error decompressing the input: %s\n", z.msg != NULL ? z.msg : "invalid gzip data");
+            ok = false;
+            break;
+        }
+        need_input = z.avail_out != 0;
+        if (z.avail_out == 0)
+        {
+            ring_push(&zi->ring, Z_BUF_BYTES);
+            out = ring_slot(&zi->ring);
+            z.next_out = (Bytef *)out;
+            z.avail_out = Z_BUF_BYTES;
+        }
+    }
+    if (ok && out != NULL && ret != Z_STREAM_END)
+    {
+        fprintf(stderr, "Error decompressing the input: the gzip data is truncated\n");
+        ok = false;
+    }
+    if (out != NULL && z.avail_out < Z_BUF_BYTES)
+        ring_push(&zi->ring, Z_BUF_BYTES - z.avail_out);
+    inflateEnd(&z);
+    return ok;
+}
+
+#ifdef HAVE_ZSTD
+/*  FUNCTION: inflate_zstd
+    INPUT:  zi, a zstd input.
+    OUTPUT: true on success, false on error (the error has been printed out).
+
+    As inflate_gzip: the frames are decompressed one after the other and new data is read only when the output buffer is not full.
+*/
+static bool inflate_zstd(Z_in *zi)
+{
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    if (ds == NULL || ZSTD_isError(ZSTD_initDStream(ds)))
+    {
+        fprintf(stderr, "Error decompressing the input: cannot initialise zstd\n");
+        ZSTD_freeDStream(ds);
+        return false;
+    }
+    char *out = ring_slot(&zi->ring);
+    ZSTD_outBuffer zout = {out, Z_BUF_BYTES, 0};
+    ZSTD_inBuffer zin = {NULL, 0, 0};
+    size_t ret = 0;
+    bool need_input = true, ok = true;
+    while (out != NULL)
+    {
+        if (need_input && zin.pos == zin.size)
+        {
+            const unsigned char *data;
+            ssize_t n = z_input(zi, &data);
+            if (n <= 0)
+            {
+                ok = n == 0;
+                break;
+            }
+            zin = (ZSTD_inBuffer){data, n, 0};
+        }
+        ret = ZSTD_decompressStream(ds, &zout, &zin);
+        if (ZSTD_isError(ret))
+        {
+            fprintf(stderr, "Error decompressing the input: %s\n", ZSTD_getErrorName(ret));
+            ok = false;
+            break;
+        }
+        need_input = zout.pos < zout.size;
+        if (zout.pos == zout.size)
+        {
+            ring_push(&zi->ring, Z_BUF_BYTES);
+            out = ring_slot(&zi->ring);
+            zout = (ZSTD_outBuffer){out, Z_BUF_BYTES, 0};
+        }
+    }
+    if (ok && out != NULL && ret != 0) // 0 when a frame has just been completed
+    {
+        fprintf(stderr, "Error decompressing the input: the zstd data is truncated\n");
+        ok = false;
+    }
+    if (out != NULL && zout.pos > 0)
+        ring_push(&zi->ring, zout.pos);
+    ZSTD_freeDStream(ds);
+    return ok;
+}
+#endif
+
+/*  FUNCTION: z_in_main
+    INPUT:  arg, a pointer to the Z_in.
+    OUTPUT: NULL
+
+    The body of the decompressing thread.
+*/
+static void *z_in_main(void *arg)
+{
+    Z_in *zi = arg;
+    bool ok = false;
+    if (zi->format == Z_GZIP)
+        ok = inflate_gzip(zi);
+#ifdef HAVE_ZSTD
+    else if (zi->format == Z_ZSTD)
+        ok = inflate_zstd(zi);
+#endif
+    ring_end(&zi->ring, !ok);
+    return NULL;
+}
+
+/*  FUNCTION: z_read
+    INPUT:  cookie, a pointer to the Z_in.
+            buf, where the data is copied.
+            size, the size of buf.
+    OUTPUT: the number of bytes copied, 0 at the end of the data, -1 on error (errno is EIO).
+
+    The read function of the stream: the decompressed buffers are copied as they come. Without a thread the prefix is returned first, then src is read.
+*/
+static ssize_t z_read(void *cookie, char *buf, size_t size)
+{
+    Z_in *zi = cookie;
+    size_t n;
+    if (zi->format == Z_NONE)
+    {
+        if (zi->prefix_len > 0)
+        {
+            n = zi->prefix_len < size ? zi->prefix_len : size;
+            memcpy(buf, zi->prefix, n);
+            memmove(zi->prefix, zi->prefix + n, zi->prefix_len - n);
+            zi->prefix_len -= n;
+            return n;
+        }
+        n = fread(buf, 1, size, zi->src);
+        return (n == 0 && ferror(zi->src)) ? -1 : (ssize_t)n;
+    }
+
+    size_t len;
+    const char *data = ring_front(&zi->ring, &len);
+    if (data == NULL)
+    {
+        if (!zi->ring.failed)
+            return 0;
+        errno = EIO;
+        return -1;
+    }
+    n = len - zi->read_pos;
+    if (n > size)
+        n = size;
+    memcpy(buf, data + zi->read_pos, n);
+    zi->read_pos += n;
+    if (zi->read_pos == len)
+    {
+        zi->read_pos = 0;
+        ring_pop(&zi->ring);
+    }
+    return n;
+}
+
+/*  FUNCTION: z_stop
+    INPUT:  zi, a compressed input with its thread running.
+    OUTPUT: void
+
+    Tells the thread that nothing more will be read, waits for it and frees the ring.
+*/
+static void z_stop(Z_in *zi)
+{
+    pthread_mutex_lock(&zi->ring.lock);
+    zi->ring.stop = true;
+    pthread_cond_signal(&zi->ring.emptied);
+    pthread_mutex_unlock(&zi->ring.lock);
+    pthread_join(zi->thread, NULL);
+    ring_free(&zi->ring);
+}
+
+/*  FUNCTION: z_close
+    INPUT:  cookie, a pointer to the Z_in.
+    OUTPUT: 0
+
+    The close function of the stream: the thread is stopped and the source released. A process forked after the input was opened has no thread and leaves everything to its parent.
+*/
+static int z_close(void *cookie)
+{
+    Z_in *zi = cookie;
+    if (zi->pid != getpid())
+        return 0;
+    if (zi->format != Z_NONE)
+        z_stop(zi);
+    if (zi->map != NULL)
+        munmap(zi->map, zi->map_len);
+    if (zi->src != NULL && zi->src != stdin)
+        fclose(zi->src);
+    free(zi->in_buf);
+    free(zi);
+    return 0;
+}
+
+/*  FUNCTION: z_open
+    INPUT:  zi, a compressed input with its source set.
+    OUTPUT: the stream reading zi, NULL if it cannot be created (errno tells why, zi is freed but not its source).
+
+    Allocates the buffers and starts the thread, unless the data is not compressed.
+*/
+static FILE *z_open(Z_in *zi)
+{
+    static const cookie_io_functions_t z_io = {.read = z_read, .close = z_close};
+    zi->pid = getpid();
+#ifndef HAVE_ZSTD
+    if (zi->format == Z_ZSTD)
+    {
+        fprintf(stderr, "Error: the input is compressed with zstd, split_text was built without libzstd.\n");
+        free(zi);
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+    if (zi->format != Z_NONE)
+    {
+        if (zi->map == NULL && (zi->in_buf = malloc(Z_BUF_BYTES)) == NULL)
+        {
+            free(zi);
+            return NULL;
+        }
+        if (ring_init(&zi->ring, Z_N_BUFS) == -1)
+        {
+            free(zi->in_buf);
+            free(zi);
+            return NULL;
+        }
+        int err = pthread_create(&zi->thread, NULL, z_in_main, zi);
+        if (err != 0)
+        {
+            ring_free(&zi->ring);
+            free(zi->in_buf);
+            free(zi);
+            errno = err;
+            return NULL;
+        }
+    }
+    FILE *f = fopencookie(zi, "r", z_io);
+    if (f == NULL)
+    { // the source is left to the caller
+        int err = errno;
+        if (zi->format != Z_NONE)
+            z_stop(zi);
+        free(zi->in_buf);
+        free(zi);
+        errno = err;
+    }
+    return f;
+}
+
+/*  FUNCTION: z_open_map
+    INPUT:  format, the format of the data.
+            map, len, the mapping holding the compressed stream.
+            pos, the offset of the stream in the mapping.
+    OUTPUT: a stream returning the decompressed data, NULL if it cannot be created.
+*/
+FILE *z_open_map(Z_format format, char *map, size_t len, size_t pos)
+{
+    Z_in *zi = calloc(1, sizeof(*zi));
+    if (zi == NULL)
+        return NULL;
+    zi->format = format;
+    zi->map = map;
+    zi->map_len = len;
+    zi->pos = pos;
+    return z_open(zi);
+}
+
+/*  FUNCTION: z_open_stream
+    INPUT:  format, the format of the data, Z_NONE to return it as it is.
+            src, the stream of the data.
+            prefix, len, the first bytes of the data, already read from src.
+    OUTPUT: a stream returning the decompressed data, NULL if it cannot be created.
+*/
+FILE *z_open_stream(Z_format format, FILE *src, const char *prefix, size_t len)
+{
+    Z_in *zi = calloc(1, sizeof(*zi));
+    if (zi == NULL)
+        return NULL;
+    zi->format = format;
+    zi->src = src;
+    memcpy(zi->prefix, prefix, len);
+    zi->prefix_len = len;
+    return z_open(zi);
+}
+
+/*  FUNCTION: z_write
+    INPUT:  fd, the file descriptor to write to.
+            data, the bytes to write.
+            n, the number of bytes.
+    OUTPUT: void
+
+    Writes all the bytes, repeating the write after short writes and interruptions. If write fails an error message is printed out and the program exits.
+*/
+static void z_write(int fd, const char *data, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = write(fd, data, n);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w == -1)
+        {
+            perror("Error writing the output");
+            exit(EXIT_FAILURE);
+        }
+        data += w;
+        n -= w;
+    }
+}
+
+/*  FUNCTION: deflate_gzip
+    INPUT:  zo, a gzip output.
+            out, a buffer of Z_BUF_BYTES bytes for the compressed data.
+    OUTPUT: void
+
+    Compresses the buffers of the ring until it is over, then ends the stream.
+*/
+static void deflate_gzip(Z_out *zo, char *out)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        fprintf(stderr, "Error compressing the output: cannot initialise zlib\n");
+        exit(EXIT_FAILURE);
+    }
+    for (;;)
+    {
+        size_t len;
+        char *data = ring_front(&zo->ring, &len);
+        int flush = data != NULL ? Z_NO_FLUSH : Z_FINISH;
+        z.next_in = (Bytef *)data;
+        z.avail_in = data != NULL ? len : 0;
+        do
+        {
+            z.next_out = (Bytef *)out;
+            z.avail_out = Z_BUF_BYTES;
+            deflate(&z, flush);
+            z_write(zo->fd, out, Z_BUF_BYTES - z.avail_out);
+        } while (z.avail_out == 0);
+        if (data == NULL)
+            break;
+        ring_pop(&zo->ring);
+    }
+    deflateEnd(&z);
+}
+
+#ifdef HAVE_ZSTD
+/*  FUNCTION: deflate_zstd
+    INPUT:  zo, a zstd output.
+            out, a buffer of Z_BUF_BYTES bytes for the compressed data.
+    OUTPUT: void
+
+    As deflate_gzip, with a single zstd frame.
+*/
+static void deflate_zstd(Z_out *zo, char *out)
+{
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == NULL)
+    {
+        fprintf(stderr, "Error compressing the output: cannot initialise zstd\n");
+        exit(EXIT_FAILURE);
+    }
+    for (;;)
+    {
+        size_t len, left;
+        char *data = ring_front(&zo->ring, &len);
+        ZSTD_EndDirective mode = data != NULL ? ZSTD_e_continue : ZSTD_e_end;
+        ZSTD_inBuffer zin = {data, data != NULL ? len : 0, 0};
+        do
+        {
+            ZSTD_outBuffer zout = {out, Z_BUF_BYTES, 0};
+            left = ZSTD_compressStream2(cctx, &zout, &zin, mode);
+            if (ZSTD_isError(left))
+            {
+                fprintf(stderr, "Error compressing the output: %s\n", ZSTD_getErrorName(left));
+                exit(EXIT_FAILURE);
+            }
+            z_write(zo->fd, out, zout.pos);
+        } while (mode == ZSTD_e_end ? left != 0 : zin.pos < zin.size);
+        if (data == NULL)
+            break;
+        ring_pop(&zo->ring);
+    }
+    ZSTD_freeCCtx(cctx);
+}
+#endif
+
+/*  FUNCTION: write_plain
+    INPUT:  zo, an output with format Z_NONE.
+    OUTPUT: void
+
+    Writes the buffers of the ring as they are, until it is over.
+*/
+static void write_plain(Z_out *zo)
+{
+    size_t len;
+    char *data;
+    while ((data = ring_front(&zo->ring, &len)) != NULL)
+    {
+        z_write(zo->fd, data, len);
+        ring_pop(&zo->ring);
+    }
+}
+
+/*  FUNCTION: z_out_main
+    INPUT:  arg, a pointer to the Z_out.
+    OUTPUT: NULL
+
+    The body of the compressing (or writing) thread.
+*/
+static void *z_out_main(void *arg)
+{
+    Z_out *zo = arg;
+    if (zo->format == Z_NONE)
+    {
+        write_plain(zo);
+        return NULL;
+    }
+    char *out = malloc(Z_BUF_BYTES);
+    if (out == NULL)
+    {
+        perror("Error allocating the compression buffer");
+        exit(EXIT_FAILURE);
+    }
+    stats_alloc();
+    if (zo->format == Z_GZIP)
+        deflate_gzip(zo, out);
+#ifdef HAVE_ZSTD
+    else
+        deflate_zstd(zo, out);
+#endif
+    free(out);
+    return NULL;
+}
+
+/*  FUNCTION: z_open_output
+    INPUT:  zo, the compressed output to initialise.
+            format, the format of the stream, Z_NONE to write the data as it is.
+            fd, the file descriptor the stream is written to.
+            n_bufs, the number of buffers of the ring.
+    OUTPUT: void
+*/
+void z_open_output(Z_out *zo, Z_format format, int fd, int n_bufs)
+{
+    memset(zo, 0, sizeof(*zo));
+    zo->format = format;
+    zo->n_bufs = n_bufs;
+    zo->fd = fd;
+    zo->owner = getpid();
+}
+
+/*  FUNCTION: z_start
+    INPUT:  zo, a compressed output.
+    OUTPUT: void
+
+    Allocates the ring and starts the thread in the calling process. If that fails an error message is printed out and the program exits.
+*/
+static void z_start(Z_out *zo)
+{
+    if (ring_init(&zo->ring, zo->n_bufs) == -1)
+    {
+        perror("Error allocating the output buffers");
+        exit(EXIT_FAILURE);
+    }
+    int err = pthread_create(&zo->thread, NULL, z_out_main, zo);
+    if (err != 0)
+    {
+        errno = err;
+        perror("Error starting the output thread");
+        exit(EXIT_FAILURE);
+    }
+    zo->pid = getpid();
+    zo->cur = NULL;
+    zo->fill = 0;
+}
+
+/*  FUNCTION: z_sink
+    INPUT:  ctx, a pointer to the Z_out.
+            iov, the buffers to compress.
+            iovcnt, the number of buffers.
+    OUTPUT: void
+
+    The data is copied into the buffer being filled, which is passed to the thread once full. Without compression the buffer is passed at the end of every call as well, so that the thread writes the data when the output buffer would have, while the layout goes on. The thread is started by the first call in each process, since the threads do not survive a fork.
+*/
+void z_sink(void *ctx, struct iovec *iov, int iovcnt)
+{
+    Z_out *zo = ctx;
+    if (zo->pid != getpid())
+        z_start(zo);
+    for (int k = 0; k < iovcnt; k++)
+    {
+        const char *data = iov[k].iov_base;
+        size_t left = iov[k].iov_len;
+        while (left > 0)
+        {
+            if (zo->cur == NULL)
+            { // blocks while all the buffers wait for the thread
+                stats_begin(STAGE_WAIT_WRITE);
+                zo->cur = ring_slot(&zo->ring);
+                stats_end(STAGE_WAIT_WRITE);
+            }
+            size_t n = Z_BUF_BYTES - zo->fill;
+            if (n > left)
+                n = left;
+            memcpy(zo->cur + zo->fill, data, n);
+            zo->fill += n;
+            data += n;
+            left -= n;
+            if (zo->fill == Z_BUF_BYTES)
+            {
+                ring_push(&zo->ring, zo->fill);
+                zo->cur = NULL;
+                zo->fill = 0;
+            }
+        }
+    }
+    if (zo->format == Z_NONE && zo->fill > 0)
+    {
+        ring_push(&zo->ring, zo->fill);
+        zo->cur = NULL;
+        zo->fill = 0;
+    }
+}
+
+/*  FUNCTION: z_close_output
+    INPUT:  zo, a compressed output.
+    OUTPUT: void
+*/
+void z_close_output(Z_out *zo)
+{
+    if (zo->pid != getpid())
+    {
+        if (zo->owner != getpid() || zo->format == Z_NONE)
+            return;
+        z_start(zo);
+    }
+    if (zo->fill > 0)
+        ring_push(&zo->ring, zo->fill);
+    ring_end(&zo->ring, false);
+    pthread_join(zo->thread, NULL);
+    ring_free(&zo->ring);
+    zo->pid = 0;
+    zo->owner = 0;
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#define _GNU_SOURCE // fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "stats.h"
+
+#define Z_BUF_BYTES (256 << 10) // size of the buffers exchanged with the threads
+#define Z_N_BUFS 4              // number of buffers between a thread and its reader or writer, unless given
+#define Z_MAGIC_LEN 4           // bytes needed to recognise a compressed stream
+
+/*      The formats of a compressed stream. */
+typedef enum Z_format
+{
+    Z_NONE,
+    Z_GZIP,
+    Z_ZSTD
+} Z_format;
+
+/*      The struct contains a ring of buffers passed from a producer thread to a consumer:
+        char **bufs - the buffers, Z_BUF_BYTES bytes each.
+        size_t *lens - the number of bytes in each full buffer.
+        int n_bufs - the number of buffers.
+        int head, count - the first full buffer and the number of full buffers.
+        bool over, failed - whether the producer is done, and whether it stopped on an error.
+        bool stop - whether the consumer is gone, the producer must stop.
+        pthread_mutex_t lock - protects head, count and the flags.
+        pthread_cond_t filled, emptied - signalled when a buffer is filled and when one is emptied (or a flag changes).
+
+        The producer fills the buffer after the full ones and the consumer reads the head outside the lock: a buffer belongs to one of them at a time.
+*/
+typedef struct Z_ring
+{
+    char **bufs;
+    size_t *lens;
+    int n_bufs;
+    int head, count;
+    bool over, failed, stop;
+    pthread_mutex_t lock;
+    pthread_cond_t filled, emptied;
+} Z_ring;
+
+/*      The struct contains a compressed input, read through the stream returned by z_open_map or z_open_stream:
+        Z_format format - the format of the data, Z_NONE to return it as it is.
+        char *map, size_t map_len, pos - the mapping of the compressed file and the offset of the next byte to decompress, map is NULL for a stream.
+        FILE *src - the stream of the compressed data, NULL for a mapping.
+        char prefix[Z_MAGIC_LEN], size_t prefix_len - the first bytes of the data, already read from src.
+        char *in_buf - the buffer where the compressed data is read from src.
+        pid_t pid - the process that opened the input.
+        pthread_t thread - the thread decompressing the data (none for Z_NONE).
+        Z_ring ring - the buffers of decompressed data.
+        size_t read_pos - the bytes of the head buffer already read.
+*/
+typedef struct Z_in
+{
+    Z_format format;
+    char *map;
+    size_t map_len, pos;
+    FILE *src;
+    char prefix[Z_MAGIC_LEN];
+    size_t prefix_len;
+    char *in_buf;
+    pid_t pid;
+    pthread_t thread;
+    Z_ring ring;
+    size_t read_pos;
+} Z_in;
+
+/*      The struct contains a compressed output, laid out pages go in, the compressed stream goes to fd:
+        Z_format format - the format of the stream, Z_NONE to write the data as it is (-a).
+        int n_bufs - the number of buffers of the ring.
+        int fd - the file descriptor the stream is written to.
+        pid_t owner - the process that opened the output.
+        pid_t pid - the process that started the thread, 0 if none did.
+        pthread_t thread - the thread compressing the buffers and writing the stream.
+        Z_ring ring - the buffers of uncompressed data, ring.over when the data is over.
+        char *cur, size_t fill - the buffer being filled (the one after the full ones), NULL if none, and its bytes.
+*/
+typedef struct Z_out
+{
+    Z_format format;
+    int n_bufs;
+    int fd;
+    pid_t owner;
+    pid_t pid;
+    pthread_t thread;
+    Z_ring ring;
+    char *cur;
+    size_t fill;
+} Z_out;
+
+/*  FUNCTION: z_format
+    INPUT:  data, the first bytes of a stream.
+            len, the number of bytes (at least Z_MAGIC_LEN to recognise every format).
+    OUTPUT: the format whose magic bytes start data, Z_NONE if none does.
+*/
+Z_format z_format(const char *data, size_t len);
+
+/*  FUNCTION: z_format_name
+    INPUT:  name, the name of a format given on the command line.
+    OUTPUT: the format, Z_NONE if the name is not known or the format is not supported by this build.
+*/
+Z_format z_format_name(const char *name);
+
+/*  FUNCTION: z_open_map
+    INPUT:  format, the format of the data.
+            map, len, the mapping holding the compressed stream, released when the stream is closed.
+            pos, the offset of the stream in the mapping.
+    OUTPUT: a stream returning the decompressed data, NULL if it cannot be created (errno tells why, the mapping is left as it was).
+
+    A thread decompresses the data into a ring of buffers, the stream reads them.
+*/
+FILE *z_open_map(Z_format format, char *map, size_t len, size_t pos);
+
+/*  FUNCTION: z_open_stream
+    INPUT:  format, the format of the data, Z_NONE to return it as it is.
+            src, the stream of the data, closed with the returned stream unless it is stdin.
+            prefix, len, the first bytes of the data, already read from src.
+    OUTPUT: a stream returning the decompressed data, NULL if it cannot be created (errno tells why, src is left open).
+
+    For Z_NONE the prefix is returned first and then src is read directly, without a thread.
+*/
+FILE *z_open_stream(Z_format format, FILE *src, const char *prefix, size_t len);
+
+/*  FUNCTION: z_open_output
+    INPUT:  zo, the compressed output to initialise.
+            format, the format of the stream, Z_NONE to write the data as it is.
+            fd, the file descriptor the stream is written to.
+            n_bufs, the number of buffers between the layout and the thread (at least 2).
+    OUTPUT: void
+
+    Nothing is allocated and no thread is started until the first data arrives, so that only the process writing the output (see mp_main) compresses it. With Z_NONE the thread only writes the data: the layout goes on while the previous pages are written, until n_bufs buffers are waiting for a slow reader of fd.
+*/
+void z_open_output(Z_out *zo, Z_format format, int fd, int n_bufs);
+
+/*  FUNCTION: z_sink
+    INPUT:  ctx, a pointer to the Z_out.
+            iov, the buffers to compress.
+            iovcnt, the number of buffers.
+    OUTPUT: void
+
+    An Out_sink: the data is copied into the ring and compressed (or written) by the thread. The time spent waiting for a free buffer is counted as STAGE_WAIT_WRITE. If the memory or the thread cannot be allocated an error message is printed out and the program exits.
+*/
+void z_sink(void *ctx, struct iovec *iov, int iovcnt);
+
+/*  FUNCTION: z_close_output
+    INPUT:  zo, a compressed output.
+    OUTPUT: void
+
+    Ends the stream and waits for the thread to write it. A process that wrote nothing does nothing, unless it opened a compressed output: then it writes an empty stream, so that the output is a valid stream even when there is no page (with -m the pages are written by another process and the empty stream is appended to theirs, which decompresses to the same data).
+*/
+void z_close_output(Z_out *zo);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include "stats.h"
+
+/*  The counters updated by libsplittext and by the layout engines. The shared table of the processes and the report of -P are in stats.c, which belongs to split_text only.
+*/
+
+Proc_stats *stats = NULL;
+
+/*  FUNCTION: wall_now
+    INPUT:  void
+    OUTPUT: the time in seconds of the monotonic clock.
+*/
+double wall_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*  FUNCTION: cpu_now
+    INPUT:  void
+    OUTPUT: the CPU time in seconds of the calling thread.
+*/
+static double cpu_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*  FUNCTION: stage_begin
+    INPUT:  t, the time of a stage.
+    OUTPUT: void
+*/
+void stage_begin(Stage_time *t)
+{
+    t->wall -= wall_now();
+    t->cpu -= cpu_now();
+}
+
+/*  FUNCTION: stage_end
+    INPUT:  t, the time of a stage.
+    OUTPUT: void
+*/
+void stage_end(Stage_time *t)
+{
+    t->wall += wall_now();
+    t->cpu += cpu_now();
+}
\ No newline at end of file
@@ -1,59 +1,467 @@
 #include "io_utils.h"
 
-/*  FUNCTION: read_one_line
-    INPUT:  fin, a pointer to an input stream.
-            out_line, poitner to the string where to write the processed lines.
-            col_width, the width of a column.
-    OUTPUT: the number of words in a line (newline considered as a single word) or EOF if fin reached the end.
+/*  FUNCTION: init_input
+    INPUT:  in, a pointer to the In_stream to initialise.
+            path, the name of the input file or NULL to read the standard input.
+    OUTPUT: 0 on success, -1 if the file cannot be opened (errno tells why).
+
+    The input file (or the standard input, if path is NULL) is mapped in memory when it is a regular file, the kernel is advised that the mapping will be read sequentially so that it can read ahead aggressively. The mapping starts from the beginning of the file but the reading starts from the current offset of the descriptor, so that an already partially consumed standard input is respected. If the input cannot be mapped (pipes, terminals, empty files or a failing mmap) the function falls back to a stdio stream.
 
-    Function that reads and process one line from the stream fin and returns a string of words separated by a single space. Empty lines are converted in lines containing only the \n character. Is up to the caller to free out_line and open and close the stream.
+    A compressed input is recognised by its magic bytes and read through the stream of z_open_map or z_open_stream, which a thread fills with the decompressed data; the mapping is then owned by that stream. A stream is peeked one byte at a time: only a first byte that starts a magic makes the next ones be read, and if they turn out to be text they are given back by a plain stream over the input.
 */
-ssize_t read_one_line(FILE *fin, char **out_line, const int col_width)
+int init_input(In_stream *in, const char *path)
 {
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    int cnt = 0;
+    struct stat st;
+    off_t start;
+    int fd = STDIN_FILENO;
 
-    // linenel contains the number of characters written, excluding the terminating NUL character, linecap the capacity of the buffer
-    linelen = getline(&line, &linecap, fin);
-    if (*out_line == NULL || strlen(*out_line) < linecap)
+    memset(in, 0, sizeof(*in));
+    if (path != NULL && (fd = open(path, O_RDONLY)) == -1)
+        return -1;
+
+    start = lseek(fd, 0, SEEK_CUR); // -1 if the descriptor is not seekable
+    if (start != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > start)
     {
-        char *tmp_line = realloc(*out_line, linecap); 
-        if (tmp_line == NULL)
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
         {
-            perror("Error allocating the line to be processed. Must stop");
-            exit(EXIT_FAILURE);
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            if (path != NULL) // the mapping stays valid after the descriptor is closed
+                close(fd);
+            Z_format format = z_format((char *)map + start, st.st_size - start);
+            if (format != Z_NONE)
+            {
+                if ((in->fin = z_open_map(format, map, st.st_size, start)) == NULL)
+                {
+                    int err = errno;
+                    munmap(map, st.st_size);
+                    errno = err;
+                    return -1;
+                }
+                return 0;
+            }
+            in->map = map;
+            in->map_len = st.st_size;
+            in->map_pos = start;
+            return 0;
         }
-        *out_line = tmp_line;
     }
-    strcpy(*out_line, ""); // reset the buffer
 
-    // strspn returns the index of the first character not in the charset. If it returns \0 it means that in the string there are only characters in the charset, so, in this case, we have an empty line.
-    if (line[strspn(line, " \t\v\r\n")] != '\0')
+    // fallback: read the input through a stream
+    FILE *src = stdin;
+    if (path != NULL && (src = fdopen(fd, "r")) == NULL)
     {
-        int n;
-        char *pline = line;
-        char word[linecap];
-        while (sscanf(pline, "%s%n", word, &n) == 1)
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    in->fin = src;
+    int c = getc(src);
+    if (c != 0x1f && c != 0x28) // not the first byte of a magic (EOF and errors are found again by the next read)
+    {
+        if (c != EOF)
+            ungetc(c, src);
+        return 0;
+    }
+    char magic[Z_MAGIC_LEN] = {c};
+    size_t n = 1 + fread(magic + 1, 1, Z_MAGIC_LEN - 1, src);
+    if ((in->fin = z_open_stream(z_format(magic, n), src, magic, n)) == NULL)
+    {
+        int err = errno;
+        if (src != stdin)
+            fclose(src);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/*  FUNCTION: open_input
+    INPUT:  in, a pointer to the In_stream to initialise.
+            path, the name of the input file or NULL to read the standard input.
+    OUTPUT: void
+
+    If the file cannot be opened an error message is printed out and the program exits.
+*/
+void open_input(In_stream *in, const char *path)
+{
+    if (init_input(in, path) == -1)
+    {
+        perror("Error opening the input file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  FUNCTION: close_input
+    INPUT:  in, a pointer to an In_stream opened by open_input.
+    OUTPUT: void
+
+    Unmaps the input file, closes the stream if it is not the standard input and frees the line buffer.
+*/
+void close_input(In_stream *in)
+{
+    if (in->map != NULL)
+        munmap(in->map, in->map_len);
+    if (in->fin != NULL && in->fin != stdin)
+        fclose(in->fin);
+    free(in->raw);
+    memset(in, 0, sizeof(*in));
+}
+
+/*  FUNCTION: next_line
+    INPUT:  in, a pointer to an opened In_stream.
+            line, pointer to the string that will point to the raw line.
+    OUTPUT: the number of bytes of the line (including the newline character, if any) or -1 if the input is ended.
+
+    For a mapped input the function looks for the next newline character with memchr and returns a pointer into the mapping, nothing is copied. For a stream the line is read by getline into the buffer of the In_stream, which is reused (and grown by getline when needed) for the whole run.
+*/
+ssize_t next_line(In_stream *in, const char **line)
+{
+    if (in->map == NULL)
+    {
+        ssize_t linelen = getline(&in->raw, &in->raw_cap, in->fin);
+        *line = in->raw;
+        return linelen;
+    }
+
+    if (in->map_pos >= in->map_len)
+        return -1;
+    const char *start = in->map + in->map_pos;
+    size_t left = in->map_len - in->map_pos;
+    const char *nl = memchr(start, '\n', left);
+    size_t linelen = (nl != NULL) ? (size_t)(nl - start) + 1 : left; // the last line may lack the newline
+    in->map_pos += linelen;
+    *line = start;
+    return linelen;
+}
+
+/*  FUNCTION: next_chunk
+    INPUT:  in, a pointer to an opened In_stream.
+            data, pointer to the string that will point to the bytes read.
+    OUTPUT: the number of bytes read, 0 if the input is ended.
+
+    The input is read by read_chunk. If the read fails an error message is printed out and the program exits.
+*/
+ssize_t next_chunk(In_stream *in, const char **data)
+{
+    ssize_t n = read_chunk(in, data);
+    if (n == -1)
+    {
+        perror("read error");
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+/*  FUNCTION: read_chunk
+    INPUT:  in, a pointer to an opened In_stream.
+            data, pointer to the string that will point to the bytes read.
+    OUTPUT: the number of bytes read, 0 if the input is ended, -1 if the read or the allocation of the buffer failed (errno tells why).
+
+    A mapped input is returned whole the first time, nothing is copied. A stream is read by fread in pieces of IN_CHUNK bytes into the buffer of the In_stream.
+*/
+ssize_t read_chunk(In_stream *in, const char **data)
+{
+    if (in->map != NULL)
+    {
+        size_t left = in->map_len - in->map_pos;
+        *data = in->map + in->map_pos;
+        in->map_pos = in->map_len;
+        return left;
+    }
+
+    if (in->raw_cap < IN_CHUNK)
+    {
+        char *tmp = realloc(in->raw, IN_CHUNK);
+        if (tmp == NULL)
+            return -1;
+        stats_alloc();
+        in->raw = tmp;
+        in->raw_cap = IN_CHUNK;
+    }
+    size_t n = fread(in->raw, 1, in->raw_cap, in->fin);
+    if (n == 0 && ferror(in->fin))
+        return -1;
+    *data = in->raw;
+    return n;
+}
+
+/*  FUNCTION: write_all
+    INPUT:  fd, the file descriptor to write to.
+            iov, an array of buffers to write, it is modified.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    The buffers are written by writev_all. If writev fails an error message is printed out and the program exits.
+*/
+void write_all(int fd, struct iovec *iov, int iovcnt)
+{
+    if (writev_all(fd, iov, iovcnt) == -1)
+    {
+        perror("write error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  FUNCTION: writev_all
+    INPUT:  fd, the file descriptor to write to.
+            iov, an array of buffers to write, it is modified.
+            iovcnt, the number of elements of iov.
+    OUTPUT: 0 on success, -1 if writev failed (errno tells why).
+
+    The function calls writev until every byte has been written: the calls interrupted by a signal are repeated, after a short write the buffers already written are skipped and the first one partially written is advanced. At most IOV_MAX buffers are passed to each call.
+*/
+int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX);
+        if (n == -1)
         {
-            if (strlen(word) > col_width) // -1 to account for \0
-            {
-                fprintf(stderr, "ERROR: read a word (%s) larger (%lu) than a column (%d), must stop.\n", word, strlen(word), col_width);
-                exit(EXIT_FAILURE);
-            }
-            // strat is safe because the buffer has the size of the entire line from which the word is taken
-            strcat(*out_line, word); 
-            strcat(*out_line, " ");
-            pline += n;
-            cnt++;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
         }
-        // remove the last space and add the newline character
-        strcpy(*out_line + strlen(*out_line) - 1, "\n\0");
     }
-    free(line);
+    return 0;
+}
 
+/*  FUNCTION: open_output
+    INPUT:  out, a pointer to the Out_stream to initialise.
+            fd, the file descriptor to write to.
+            cap, the size of the buffer in bytes.
+    OUTPUT: void
+
+    Allocates the buffer of the output, if the allocation fails an error message is printed out and the program exits.
+*/
+void open_output(Out_stream *out, int fd, size_t cap)
+{
+    out->fd = fd;
+    out->sink = NULL;
+    out->sink_ctx = NULL;
+    out->len = 0;
+    out->cap = cap;
+    out->buf = malloc(cap);
+    if (out->buf == NULL)
+    {
+        perror("Error allocating the output buffer");
+        exit(EXIT_FAILURE);
+    }
+    stats_alloc();
+}
+
+/*  FUNCTION: set_output_sink
+    INPUT:  out, a pointer to an opened Out_stream.
+            sink, the function receiving the flushed buffers.
+            ctx, the first argument passed to sink.
+    OUTPUT: void
+*/
+void set_output_sink(Out_stream *out, Out_sink sink, void *ctx)
+{
+    out->sink = sink;
+    out->sink_ctx = ctx;
+}
+
+/*  FUNCTION: out_write
+    INPUT:  out, a pointer to an opened Out_stream.
+            data, the bytes to write.
+            n, the number of bytes to write.
+    OUTPUT: void
+
+    If the bytes fit in the buffer they are copied, otherwise the buffered data and the new bytes are written together by a single writev, without copying the latter.
+*/
+void out_write(Out_stream *out, const char *data, size_t n)
+{
+    if (out->cap - out->len < n)
+    {
+        struct iovec iov = {.iov_base = (void *)data, .iov_len = n};
+        out_writev(out, &iov, 1);
+        return;
+    }
+    memcpy(out->buf + out->len, data, n);
+    out->len += n;
+}
+
+/*  FUNCTION: out_writev
+    INPUT:  out, a pointer to an opened Out_stream.
+            iov, an array of buffers to write after the buffered data.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    The buffered data and the buffers in iov are written by a single writev (more only if there are more than IOV_MAX buffers or the write is short), or passed together to the sink.
+*/
+void out_writev(Out_stream *out, struct iovec *iov, int iovcnt)
+{
+    struct iovec all[iovcnt + 1];
+    all[0].iov_base = out->buf;
+    all[0].iov_len = out->len;
+    if (iovcnt > 0)
+        memcpy(all + 1, iov, iovcnt * sizeof(*iov));
+    if (stats != NULL)
+        for (int k = 0; k <= iovcnt; k++)
+            stats->bytes_out += all[k].iov_len;
+    if (out->sink != NULL)
+        out->sink(out->sink_ctx, all, iovcnt + 1);
+    else
+        write_all(out->fd, all, iovcnt + 1);
+    out->len = 0;
+}
+
+/*  FUNCTION: flush_output
+    INPUT:  out, a pointer to an opened Out_stream.
+    OUTPUT: void
+
+    Writes the buffered data.
+*/
+void flush_output(Out_stream *out)
+{
+    if (out->len > 0)
+        out_writev(out, NULL, 0);
+}
+
+/*  FUNCTION: close_output
+    INPUT:  out, a pointer to an opened Out_stream.
+    OUTPUT: void
+
+    Writes the buffered data and frees the buffer. The file descriptor is left open.
+*/
+void close_output(Out_stream *out)
+{
+    flush_output(out);
+    if (out->sink == z_sink)
+        z_close_output(out->sink_ctx);
+    free(out->buf);
+    out->buf = NULL;
+    out->cap = 0;
+}
+
+/*  FUNCTION: alloc_page
+    INPUT:  size_t n_rows, number of rows
+            size_t width, capacity of a row in bytes
+    OUTPUT: an empty page.
+
+    If the allocation fails an error message is printed out and the program exits.
+*/
+Page alloc_page(size_t n_rows, size_t width)
+{
+    Page page;
+    if (init_page(&page, n_rows, width) == -1)
+    {
+        perror("Error allocating the page");
+        exit(EXIT_FAILURE);
+    }
+    return page;
+}
+
+/*  FUNCTION: write_one_page
+    INPUT:  out - the output buffer to write to.
+            page - the page whose rows are written to out.
+            alloc_n_rows - an integer representing the number of lines to write.
+    OUTPUT: void
+
+    The function loops through the rows of the page, whose lengths are already known, and describes the page as a list of buffers (each line followed by a newline character). If after this page the output buffer would still have room for another one the page is copied into the buffer, otherwise the buffered pages and this one are written by a single writev, so that the page itself is not copied. Write errors are handled by the output buffer.
+*/
+void write_one_page(Out_stream *out, Page *page, int alloc_n_rows)
+{
+    stats_begin(STAGE_OUTPUT);
+    struct iovec iov[2 * alloc_n_rows];
+    size_t page_len = 0;
+    int n = 0;
+    for (int i = 0; i < alloc_n_rows; i++)
+    {
+        if (page->len[i] == 0) // no more lines to write
+            break;
+        iov[n].iov_base = page_row(page, i);
+        iov[n].iov_len = page->len[i];
+        page_len += iov[n++].iov_len + 1;
+        iov[n].iov_base = "\n";
+        iov[n++].iov_len = 1;
+    }
+    if (out->cap - out->len >= 2 * page_len)
+    {
+        for (int k = 0; k < n; k++)
+            out_write(out, iov[k].iov_base, iov[k].iov_len);
+    }
+    else
+    {
+        out_writev(out, iov, n);
+    }
+    if (stats != NULL && n > 0)
+        stats->pages++;
+    stats_end(STAGE_OUTPUT);
+}
+
+/*  FUNCTION: warn_long_line
+    INPUT:  len, the number of bytes of a raw line.
+    OUTPUT: void
+
+    The flag is atomic since the stages of -p may tokenize on another thread than the one that started them.
+*/
+void warn_long_line(size_t len)
+{
+    static atomic_flag warned = ATOMIC_FLAG_INIT;
+    if (len > LINE_WINDOW && !atomic_flag_test_and_set(&warned))
+        fprintf(stderr, "Warning: a line of %zu bytes is held whole in memory, only the single-process version lays out lines longer than %d bytes a window at a time.\n", len, LINE_WINDOW);
+}
+
+/*  FUNCTION: read_one_line
+    INPUT:  in, a pointer to an input source.
+            arena, the arena the processed line is written in.
+            out_line, pointer to the string that will point to the processed line.
+            col_width, the width of a column.
+    OUTPUT: the number of words in a line (newline considered as a single word), EOF if the input reached the end or LONG_WORD if a word is larger than a column.
+
+    Function that reads and process one line from the input and returns a string of words separated by a single space. Empty lines are converted in lines containing only the \n character. The line lives in the arena until the caller resets it: nothing is freed line by line, and an arena reset for every line or batch of lines stops allocating once it holds the longest one. If the memory cannot be allocated an error message is printed out and the program exits. Is up to the caller to open and close the input.
+
+    The line is tokenized by tokenize_line, if a word is larger than a column an error message is printed out and the caller decides how to stop, after sending on what it has already read.
+*/
+ssize_t read_one_line(In_stream *in, Arena *arena, char **out_line, const int col_width)
+{
+    const char *line;
+    ssize_t linelen;
+    int cnt = 0;
+
+    const char *long_word;
+    size_t long_len;
+
+    stats_begin(STAGE_READ);
+    // linenel contains the number of bytes of the raw line, the line is not null terminated
+    linelen = next_line(in, &line);
     if (linelen == -1)
+    {
+        stats_end(STAGE_READ);
         return linelen;
+    }
+
+    warn_long_line(linelen);
+    // the processed line is at most as long as the raw line + '\n' + '\0'
+    if ((*out_line = arena_alloc(arena, linelen + 2)) == NULL)
+    {
+        perror("Error allocating the line to be processed. Must stop");
+        exit(EXIT_FAILURE);
+    }
+
+    cnt = tokenize_line(line, line + linelen, *out_line, col_width, &long_word, &long_len);
+    if (cnt < 0)
+    {
+        fprintf(stderr, "ERROR: read a word (%.*s) larger (%lu) than a column (%d), must stop.\n", (int)long_len, long_word, long_len, col_width);
+        stats_end(STAGE_READ);
+        return LONG_WORD;
+    }
+    stats_line(linelen, cnt);
+    stats_end(STAGE_READ);
+
     return cnt;
 }
\ No newline at end of file
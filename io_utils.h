@@ -4,15 +4,233 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "scan_utils.h"
+#include "stats.h"
+#include "processing.h"
+#include "compress.h"
+
+#define IN_CHUNK (1 << 16) // bytes read at a time by next_chunk from a stream
+#define LONG_WORD (-2)      // returned by read_one_line when a word is larger than a column
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // the Linux limit, limits.h defines it only for XOPEN
+#endif
+
+/*      The struct contains the state of an input source:
+        FILE *fin - the stream used when the input cannot be memory-mapped (e.g. a pipe or a terminal).
+        char *map - the start of the mapping of the input file, NULL when the input is read through fin.
+        size_t map_len - the length of the mapping in bytes.
+        size_t map_pos - the offset in the mapping of the next line to be read.
+        char *raw - the buffer holding the current raw line read from fin, it is reused for the whole run.
+        size_t raw_cap - the capacity of raw.
+
+        Regular files are mapped in memory and read sequentially, so that no line has to be copied by stdio or allocated by getline. Any other input falls back to the stream. A compressed input (gzip or zstd) is read through a stream fed by a decompressing thread.
+*/
+typedef struct In_stream
+{
+    FILE *fin;
+    char *map;
+    size_t map_len;
+    size_t map_pos;
+    char *raw;
+    size_t raw_cap;
+} In_stream;
+
+/*  FUNCTION: open_input
+    INPUT:  in, a pointer to the In_stream to initialise.
+            path, the name of the input file or NULL to read the standard input.
+    OUTPUT: void
+
+    Opens the input, mapping it in memory when it is a regular file and falling back to a stream otherwise.
+*/
+void open_input(In_stream *in, const char *path);
+
+/*  FUNCTION: init_input
+    INPUT:  in, a pointer to the In_stream to initialise.
+            path, the name of the input file or NULL to read the standard input.
+    OUTPUT: 0 on success, -1 if the file cannot be opened (errno tells why).
+
+    As open_input, but a failure is reported to the caller instead of terminating the program.
+*/
+int init_input(In_stream *in, const char *path);
+
+/*  FUNCTION: close_input
+    INPUT:  in, a pointer to an In_stream opened by open_input.
+    OUTPUT: void
+
+    Releases the mapping, the stream (unless it is stdin) and the line buffer of the input.
+*/
+void close_input(In_stream *in);
+
+/*  FUNCTION: next_line
+    INPUT:  in, a pointer to an opened In_stream.
+            line, pointer to the string that will point to the raw line.
+    OUTPUT: the number of bytes of the line (including the newline character, if any) or -1 if the input is ended.
+
+    Returns the next raw line of the input. The line is not null terminated: it points directly into the mapping or, for streams, into the buffer of the In_stream, and it is valid until the next call.
+*/
+ssize_t next_line(In_stream *in, const char **line);
+
+/*  Function receiving the buffers flushed by an Out_stream in place of a file descriptor (ctx is the pointer given to set_output_sink). */
+typedef void (*Out_sink)(void *ctx, struct iovec *iov, int iovcnt);
+
+/*      The struct contains the state of an output buffer:
+        int fd - the file descriptor the data is written to.
+        Out_sink sink - if not NULL, the function receiving the data instead of fd.
+        void *sink_ctx - the argument passed to sink.
+        char *buf - the buffer collecting the data.
+        size_t len - the number of bytes in the buffer.
+        size_t cap - the capacity of the buffer.
+
+        Data is collected in the buffer and written with a single writev when the buffer is full, together with the data that did not fit.
+*/
+typedef struct Out_stream
+{
+    int fd;
+    Out_sink sink;
+    void *sink_ctx;
+    char *buf;
+    size_t len;
+    size_t cap;
+} Out_stream;
+
+/*  FUNCTION: open_output
+    INPUT:  out, a pointer to the Out_stream to initialise.
+            fd, the file descriptor to write to.
+            cap, the size of the buffer in bytes.
+    OUTPUT: void
+
+    Allocates the buffer of the output.
+*/
+void open_output(Out_stream *out, int fd, size_t cap);
+
+/*  FUNCTION: set_output_sink
+    INPUT:  out, a pointer to an opened Out_stream.
+            sink, the function receiving the flushed buffers.
+            ctx, the first argument passed to sink.
+    OUTPUT: void
+
+    Redirects the output to a function instead of the file descriptor.
+*/
+void set_output_sink(Out_stream *out, Out_sink sink, void *ctx);
+
+/*  FUNCTION: write_all
+    INPUT:  fd, the file descriptor to write to.
+            iov, an array of buffers to write, it is modified.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    Writes all the buffers, repeating the writev after short writes and interruptions.
+*/
+void write_all(int fd, struct iovec *iov, int iovcnt);
+
+/*  FUNCTION: writev_all
+    INPUT:  fd, the file descriptor to write to.
+            iov, an array of buffers to write, it is modified.
+            iovcnt, the number of elements of iov.
+    OUTPUT: 0 on success, -1 if writev failed (errno tells why).
+
+    As write_all, for the callers that go on after an error.
+*/
+int writev_all(int fd, struct iovec *iov, int iovcnt);
+
+/*  FUNCTION: out_write
+    INPUT:  out, a pointer to an opened Out_stream.
+            data, the bytes to write.
+            n, the number of bytes to write.
+    OUTPUT: void
+
+    Appends n bytes to the buffer, the buffer is written out first if the bytes do not fit.
+*/
+void out_write(Out_stream *out, const char *data, size_t n);
+
+/*  FUNCTION: out_writev
+    INPUT:  out, a pointer to an opened Out_stream.
+            iov, an array of buffers to write after the buffered data.
+            iovcnt, the number of elements of iov.
+    OUTPUT: void
+
+    Writes the buffered data followed by the buffers in iov, leaving the buffer empty.
+*/
+void out_writev(Out_stream *out, struct iovec *iov, int iovcnt);
+
+/*  FUNCTION: flush_output
+    INPUT:  out, a pointer to an opened Out_stream.
+    OUTPUT: void
+
+    Writes the buffered data.
+*/
+void flush_output(Out_stream *out);
+
+/*  FUNCTION: close_output
+    INPUT:  out, a pointer to an opened Out_stream.
+    OUTPUT: void
+
+    Writes the buffered data and frees the buffer; a compressed output (see z_sink) is ended. The file descriptor is left open.
+*/
+void close_output(Out_stream *out);
+
+/*  FUNCTION: write_one_page
+    INPUT:  out, the output buffer to write to.
+            page, the page whose rows are written to out.
+            alloc_n_rows, the number of rows of the page (including the new page symbol).
+    OUTPUT: void
+
+    Writes the rows of the page, each followed by a newline character, stopping at the first empty row.
+*/
+void write_one_page(Out_stream *out, Page *page, int alloc_n_rows);
+
+/*  FUNCTION: alloc_page
+    INPUT:  size_t n_rows, number of rows
+            size_t width, capacity of a row in bytes
+    OUTPUT: an empty page.
+
+    Allocates a page whose rows are contiguous in memory, as init_page does; the program exits if it cannot.
+*/
+Page alloc_page(size_t, size_t);
+
+/*  FUNCTION: next_chunk
+    INPUT:  in, a pointer to an opened In_stream.
+            data, pointer to the string that will point to the bytes read.
+    OUTPUT: the number of bytes read, 0 if the input is ended.
+
+    Returns the input in large pieces, whose boundaries do not follow the lines. A mapped input is returned whole.
+*/
+ssize_t next_chunk(In_stream *in, const char **data);
+
+/*  FUNCTION: read_chunk
+    INPUT:  in, a pointer to an opened In_stream.
+            data, pointer to the string that will point to the bytes read.
+    OUTPUT: the number of bytes read, 0 if the input is ended, -1 if the read failed (errno tells why).
+
+    As next_chunk, for the callers that go on after an error.
+*/
+ssize_t read_chunk(In_stream *in, const char **data);
 
 /*  FUNCTION: read_one_line
-    INPUT:  fin, a pointer to an input stream.
-            out_line, poitner to the string where to write the processed lines.
+    INPUT:  in, a pointer to an input source.
+            arena, the arena the processed line is written in.
+            out_line, pointer to the string that will point to the processed line.
             col_width, the width of a column.
-    OUTPUT: the number of words in a line (newline considered as a single word) or EOF if fin reached the end.
+    OUTPUT: the number of words in a line (newline considered as a single word), EOF if the input reached the end or LONG_WORD if a word is larger than a column (the error message has been printed out).
+
+    Function that reads and process one line from the input and returns a string of words separated by a single space. Empty lines are converted in lines containing only the \n character. The line is valid until the arena is reset. Is up to the caller to open and close the input.
+*/
+ssize_t read_one_line(In_stream *in, Arena *arena, char **out_line, const int col_width);
+
+/*  FUNCTION: warn_long_line
+    INPUT:  len, the number of bytes of a raw line.
+    OUTPUT: void
 
-    Function that reads and process one line from the stream fin and returns a string of words separated by a single space. Empty lines are converted in lines containing only the \n character. Is up to the caller to free out_line and open and close the stream.
+    Reports on stderr, once per process, a line longer than LINE_WINDOW: the modes that hold a whole tokenized line (-m, -j, -p and -u) need memory as large as the longest line, only the single-process version lays it out a window at a time.
 */
-ssize_t read_one_line(FILE *fin, char **out_line, const int col_width);
+void warn_long_line(size_t len);
 
 #endif
\ No newline at end of file
@@ -5,19 +5,34 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <sys/wait.h>
+#include <getopt.h>
 #include "io_utils.h"
 #include "processing.h"
 #include "alloc_utils.h"
+#include "channel.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "server.h"
+#include "relayout.h"
+#include "page_index.h"
+#include "topology.h"
+#include "stats.h"
+#include "splittext.h"
 
-static char new_page[] = "\n %%% \n"; // newpage delimiter
+static char new_page[] = NEW_PAGE; // newpage delimiter
 
-bool process_empty_line(char **line, bool *empty_line, Pr_data pos_data);
+void mp_main(In_stream *in, Out_stream *out, const Mp_topology *topo, FILE *info, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width);
 
-void write_one_page(int fd, char **out_lines, int alloc_n_rows);
+unsigned long long sp_main(In_stream *in, Out_stream *out, const Split_layout *layout, Split_cache *cache, Page_index *index, unsigned long long first_page, unsigned long long last_page);
 
-void mp_main(int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width);
+int parse_pages(const char *spec, unsigned long long *first, unsigned long long *last);
 
-void sp_main(int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width);
+Split_cache *open_cache(const char *path);
+
+void close_cache(Split_cache *cache, bool verbose);
+
+int pj_main(In_stream *in, Out_stream *out, int n_threads, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width);
 
 int main(int argc, char *argv[])
 {
@@ -28,26 +43,86 @@ int main(int argc, char *argv[])
     int n_rows = 47;        // number of rows per page
     int col_width = 22;     // width of a column (visible characters)
     bool b_mp = false;      // whether to use multiprocess
+    Mp_topology topo = {.transport = CHAN_SHM}; // the processes of -m and how they exchange data
+    int n_cpu_lists = 0;    // number of CPU lists given for the processes of -m, 0 for none
+    int n_threads = 0;      // number of threads breaking the lines, 0 for none
+    int stage_group[N_PIPE_STAGES]; // the thread of each stage of the pipeline
+    int n_groups = 0;       // number of threads of the pipeline, 0 for none
     bool b_verbose = false; // whether to print additional information
+    char *in_path = NULL;   // input file, NULL to read the standard input
+    In_stream in;           // the input source
+    int n_buf_pages = 1;    // number of pages collected in the output buffer
+    Out_stream out;         // the output buffer
+    bool b_stats = false;   // whether to report the statistics
+    char *stats_path = NULL; // file of the statistics in JSON, NULL to print them on stderr
+    char *manifest = NULL;  // list of the documents of a batch
+    char *out_dir = NULL;   // directory of the output files of a batch, NULL for the directory of each input
+    char *sock_path = NULL; // socket of the server, NULL to format a single text
+    bool b_cache = false;   // whether to cache the justified lines
+    char *cache_path = NULL; // file of the cache, NULL to keep it in memory only
+    Split_cache *cache = NULL; // the cache of the justified lines
+    char *upd_path = NULL;  // output file updated incrementally, NULL to write the standard output
+    char *index_path = NULL; // file of the index of the pages, NULL for none
+    bool b_count = false;   // whether to print the number of pages instead of the pages
+    unsigned long long first_page = 1, last_page = SPLIT_END; // the pages written
+    Z_format z_fmt = Z_NONE; // the compression of the output
+    int out_depth = 0;       // number of buffers between the layout and the thread writing the output, 0 for no thread
+    Z_out zout;              // the compressed output, when z_fmt is not Z_NONE or out_depth is not 0
+    static const struct option long_opts[] = {{"serve", required_argument, NULL, 'S'},
+                                              {"count-pages", no_argument, NULL, 'C'},
+                                              {"pages", required_argument, NULL, 'R'},
+                                              {"topology", required_argument, NULL, 'T'},
+                                              {"cpus", required_argument, NULL, 'A'},
+                                              {"pipe-size", required_argument, NULL, 'B'},
+                                              {NULL, 0, NULL, 0}};
 
     // process input from command line
-    char help[] = "Usage: split_text [OPTION]... < [FILE]\n\n"
+    char help[] = "Usage: split_text [OPTION]... < [FILE]\n"
+            "       split_text [OPTION]... -i FILE\n"
+            "       split_text [OPTION]... FILE...\n"
+            "       split_text [OPTION]... -M MANIFEST\n"
+            "       split_text [-v] [-k | -K FILE] --serve SOCKET\n"
+            "       split_text [-v] [-i FILE] [-c N] [-l N] [-w N] [-s N] --count-pages | --pages A-B\n\n"
             "The options are as follows:\n\n"
             "-h  Display this help and exit.\n"
             "-m  Uses three processes.\n"
-            "-v  Display the values used to format the output text.\n"
+            "-t transport  How the processes of -m exchange data: shm (shared-memory rings) or pipe. Defaults to shm\n"
+            "--topology procs  Run -m with the stages r (read and tokenize), l (layout) and w (write) in this order, the processes separated by commas: r,l,w, rl,w or r,lw. Implies -m. Defaults to r,l,w\n"
+            "--cpus lists  Pin each process of -m to CPUs: one list per process (e.g. 0-3,8), the lists separated by colons.\n"
+            "--pipe-size bytes  Capacity of the pipes between the processes of -m (-t pipe), with an optional K or M suffix.\n"
+            "-j number  Break the lines into rows with number threads (single process). With FILE... or -M, format number documents at a time. Defaults to the number of CPUs\n"
+            "-p stages  Run the stages r (read), t (tokenize), l (layout) and w (write) as a pipeline of threads, the threads separated by commas (e.g. rt,l,w).\n"
+            "--serve socket  Run as a server on the Unix domain socket, laying out the texts sent by the clients (see README).\n"
+            "-k  Cache the rows of the justified lines, so that a line repeated in the text is only placed on the page (single process and --serve).\n"
+            "-u file  Write the output to file, laying out again only the pages changed since the previous run (file.ckpt keeps what is needed).\n"
+            "-x file  Write to file the index of the pages: where each page is in the output and where its text starts in the input (single process).\n"
+            "--count-pages  Print the number of pages of the output instead of the pages, without building them (single process).\n"
+            "--pages A-B  Write only the pages from A to B (counted from 1, A- for the pages from A to the end), the pages before A are only measured (single process).\n"
+            "-z format  Compress the output with format: gzip, or zstd if built with libzstd. A compressed input is recognised and decompressed.\n"
+            "-a depth  Write the output from a thread, so that the layout goes on while the previous pages are written, with up to depth buffers (at least 2) queued for it. With -z, the buffers queued for the compressing thread.\n"
+            "-K file  As -k, loading the cache from file and saving it back at the end, to share it between runs.\n"
+            "-v  Display the values used to format the output text, and the hits and misses of the cache.\n"
+            "-P  Report the time spent reading, laying out and writing the text and other counters on stderr.\n"
+            "-J file  Write the report of -P in JSON to file.\n"
+            "-i file  Read the input from file instead of the standard input.\n"
+            "-M file  Format the documents listed in file (one per line, the input optionally followed by a tab and the output), as for FILE...\n"
+            "-o dir  Write the output of each FILE to dir/FILE.out instead of FILE.out.\n"
             "-c number  Number of columns. Defaults to 3\n"
             "-l number  Number of rows per page. Defaults to 47\n"
             "-w number  Width of a column (number of visible characters). Defaults to 22\n"
-            "-s number  Number of space characters between columns. Defaults to 10\n\n"
+            "-s number  Number of space characters between columns. Defaults to 10\n"
+            "-b number  Number of pages collected in the output buffer before writing them. Defaults to 1\n\n"
             "Exit status\n"
             "The split_text utility exits 0 on success, and >0 if an error occurs.\n\n"
             "Example\n"
             "To convert the file sample_input.txt into the file sample_output.txt having four columns of width 21 separated by 5 spaces and with five rows per page:\n"
             "> $ ./split_text -m -c 4 -l 5 -w 21 -s 5 < inputs/sample_input.txt > sample_output.txt\n";
 
+    if (scan_env_rejected() != NULL) // the scans do not print, the program does
+        fprintf(stderr, "Warning: %s=%s is not a scan level supported by this CPU, using %s.\n", SCAN_ENV, scan_env_rejected(), scan_level_name());
+
     opterr = 0;
-    while ((c_opt = getopt(argc, argv, "hmvc:l:w:s:")) != -1)
+    while ((c_opt = getopt_long(argc, argv, "hmvkK:u:x:z:a:PJ:j:p:i:M:o:t:c:l:w:s:b:", long_opts, NULL)) != -1)
         switch (c_opt)
         {
         case 'h':
@@ -59,6 +134,113 @@ int main(int argc, char *argv[])
         case 'v':
             b_verbose = true;
             break;
+        case 'k':
+            b_cache = true;
+            break;
+        case 'K':
+            b_cache = true;
+            cache_path = optarg;
+            break;
+        case 'P':
+            b_stats = true;
+            break;
+        case 'J':
+            b_stats = true;
+            stats_path = optarg;
+            break;
+        case 'j':
+            n_threads = atoi(optarg);
+            if (n_threads < 1)
+            {
+                fprintf(stderr, "Error: there must be at least 1 thread.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            n_groups = parse_stages(optarg, stage_group);
+            if (n_groups < 1)
+            {
+                fprintf(stderr, "Error: the stages must be r, t, l and w in this order, the threads separated by commas (e.g. rt,l,w).\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            if (strcmp(optarg, "shm") == 0)
+                topo.transport = CHAN_SHM;
+            else if (strcmp(optarg, "pipe") == 0)
+                topo.transport = CHAN_PIPE;
+            else
+            {
+                fprintf(stderr, "Error: the transport must be shm or pipe.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'u':
+            upd_path = optarg;
+            break;
+        case 'x':
+            index_path = optarg;
+            break;
+        case 'z':
+            z_fmt = z_format_name(optarg);
+            if (z_fmt == Z_NONE)
+            {
+                fprintf(stderr, "Error: the output compression must be gzip or zstd (if built with libzstd).\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'a':
+            out_depth = atoi(optarg);
+            if (out_depth < 2)
+            {
+                fprintf(stderr, "Error: the output queue must hold at least 2 buffers.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'S':
+            sock_path = optarg;
+            break;
+        case 'C':
+            b_count = true;
+            break;
+        case 'R':
+            if (parse_pages(optarg, &first_page, &last_page) == -1)
+            {
+                fprintf(stderr, "Error: the pages must be A-B, A or A-, with 1 <= A <= B.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+            if (parse_topology(&topo, optarg) == -1)
+            {
+                fprintf(stderr, "Error: the processes must be r,l,w, rl,w or r,lw.\n");
+                exit(EXIT_FAILURE);
+            }
+            b_mp = true;
+            break;
+        case 'A':
+            if ((n_cpu_lists = parse_cpus(&topo, optarg)) == -1)
+            {
+                fprintf(stderr, "Error: the CPUs must be one list per process (e.g. 0-3,8), the lists separated by colons.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'B':
+            if (parse_pipe_size(&topo, optarg) == -1)
+            {
+                fprintf(stderr, "Error: the pipe size must be a positive number of bytes, optionally followed by K or M.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            manifest = optarg;
+            break;
+        case 'o':
+            out_dir = optarg;
+            break;
         case 'c':
             n_cols = atoi(optarg);
             if (n_cols < 1)
@@ -91,8 +273,26 @@ int main(int argc, char *argv[])
                 exit(EXIT_FAILURE);
             }
             break;
+        case 'b':
+            n_buf_pages = atoi(optarg);
+            if (n_buf_pages < 1)
+            {
+                fprintf(stderr, "Error: the output buffer must hold at least 1 page.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         case '?':
-            if (optopt == 'c' || optopt == 'l' || optopt == 'w' || optopt == 's')
+            if (optopt == 'S')
+                fprintf(stderr, "Option --serve requires an argument.\n");
+            else if (optopt == 'R')
+                fprintf(stderr, "Option --pages requires an argument.\n");
+            else if (optopt == 'T')
+                fprintf(stderr, "Option --topology requires an argument.\n");
+            else if (optopt == 'A')
+                fprintf(stderr, "Option --cpus requires an argument.\n");
+            else if (optopt == 'B')
+                fprintf(stderr, "Option --pipe-size requires an argument.\n");
+            else if (optopt == 'K' || optopt == 'u' || optopt == 'x' || optopt == 'z' || optopt == 'a' || optopt == 'J' || optopt == 'j' || optopt == 'p' || optopt == 'i' || optopt == 'M' || optopt == 'o' || optopt == 't' || optopt == 'c' || optopt == 'l' || optopt == 'w' || optopt == 's' || optopt == 'b')
                 fprintf(stderr, "Option -%c requires an argument.\n", optopt);
             else if (isprint(optopt))
                 fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -105,98 +305,372 @@ int main(int argc, char *argv[])
             abort();
         }
 
-    if (isatty(STDIN_FILENO)) {
+    if (topo.n_procs == 0)
+        parse_topology(&topo, "r,l,w");
+    if ((n_cpu_lists > 0 || topo.pipe_size > 0) && !b_mp)
+    {
+        fprintf(stderr, "Error: --cpus and --pipe-size can be used only with -m.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (n_cpu_lists > 0 && n_cpu_lists != topo.n_procs)
+    {
+        fprintf(stderr, "Error: --cpus must give one list for each of the %d processes.\n", topo.n_procs);
+        exit(EXIT_FAILURE);
+    }
+    if (topo.pipe_size > 0 && topo.transport != CHAN_PIPE)
+    {
+        fprintf(stderr, "Error: --pipe-size can be used only with -t pipe.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (b_mp && n_threads > 0)
+    {
+        fprintf(stderr, "Error: -j cannot be used together with -m.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (n_groups > 0 && (b_mp || n_threads > 0))
+    {
+        fprintf(stderr, "Error: -p cannot be used together with -m or -j.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (upd_path != NULL && (b_mp || n_threads > 0 || n_groups > 0 || b_cache))
+    {
+        fprintf(stderr, "Error: -u cannot be used together with -m, -j, -p, -k or -K.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (index_path != NULL && (b_mp || n_threads > 0 || n_groups > 0 || upd_path != NULL))
+    {
+        fprintf(stderr, "Error: -x cannot be used together with -m, -j, -p or -u.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (b_cache && (b_mp || n_threads > 0 || n_groups > 0))
+    {
+        fprintf(stderr, "Error: -k and -K cannot be used together with -m, -j or -p.\n");
+        exit(EXIT_FAILURE);
+    }
+    bool b_range = first_page != 1 || last_page != SPLIT_END; // whether --pages is given
+    if ((b_count || b_range) && (b_mp || n_threads > 0 || n_groups > 0 || b_cache || upd_path != NULL || index_path != NULL || sock_path != NULL || manifest != NULL || optind < argc))
+    {
+        fprintf(stderr, "Error: --count-pages and --pages cannot be used together with -m, -j, -p, -k, -K, -u, -x, --serve, FILE... or -M.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (b_count && b_range)
+    {
+        fprintf(stderr, "Error: --count-pages cannot be used together with --pages.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (z_fmt != Z_NONE && (upd_path != NULL || index_path != NULL || b_count || sock_path != NULL || manifest != NULL || optind < argc))
+    {
+        fprintf(stderr, "Error: -z cannot be used together with -u, -x, --count-pages, --serve, FILE... or -M.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (out_depth > 0 && (upd_path != NULL || b_count || sock_path != NULL || manifest != NULL || optind < argc))
+    {
+        fprintf(stderr, "Error: -a cannot be used together with -u, --count-pages, --serve, FILE... or -M.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (b_count) // no page is written, the pages are only measured
+        first_page = last_page = SPLIT_END;
+
+    if (sock_path != NULL)
+    { // the layout comes with each request
+        if (b_mp || n_threads > 0 || n_groups > 0 || b_stats || in_path != NULL || upd_path != NULL || index_path != NULL || manifest != NULL || optind < argc)
+        {
+            fprintf(stderr, "Error: --serve can be used only with -v, -k and -K.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (b_cache)
+            cache = open_cache(cache_path);
+        serve(sock_path, b_verbose, cache);
+        close_cache(cache, b_verbose);
+        return EXIT_SUCCESS;
+    }
+
+    bool b_batch = manifest != NULL || optind < argc; // several documents, each one to its own output file
+    if (b_batch && (in_path != NULL || b_mp || n_groups > 0 || b_stats || b_cache || upd_path != NULL || index_path != NULL))
+    {
+        fprintf(stderr, "Error: -i, -m, -p, -k, -K, -u, -x, -P and -J cannot be used with FILE... or -M.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!b_batch && in_path == NULL && isatty(STDIN_FILENO)) {
         // L'input NON è stato rediretto
         fprintf(stderr, help);
         exit(EXIT_FAILURE);
     }
 
     // Compute other useful values
-    // allocate extra space to hold accented characters. A line of accented characters would take up twice as much space as regular characters + 1 for '\0'
     int page_width = col_width * n_cols + spacing * (n_cols - 1);
-    int alloc_page_width = page_width * 2 + 1;
-    if (alloc_page_width < (strlen(new_page) + 1))
+    int alloc_page_width = row_capacity(n_cols, col_width, spacing); // a row of accented characters takes more bytes than characters
+    if (alloc_page_width < strlen(new_page))
     {
         fprintf(stderr, "The width of the page is smaller than the new page symbol, must stop.\n");
         exit(EXIT_FAILURE);
     }
     int alloc_n_rows = n_rows + 1; // one extra line for the newpage symbol
 
+    FILE *info = (z_fmt != Z_NONE) ? stderr : stdout; // where -v prints, not in the middle of the compressed output
     if (b_verbose)
     {
-        printf("Number of columns: %d\n", n_cols);
-        printf("Space between columns: %d\n", spacing);
-        printf("Page width: %d\n", page_width);
-        printf("Number of rows per page: %d\n", n_rows);
-        printf("Column width: %d\n", col_width);
+        fprintf(info, "Number of columns: %d\n", n_cols);
+        fprintf(info, "Space between columns: %d\n", spacing);
+        fprintf(info, "Page width: %d\n", page_width);
+        fprintf(info, "Number of rows per page: %d\n", n_rows);
+        fprintf(info, "Column width: %d\n", col_width);
+        if (out_depth > 0)
+            fprintf(info, "Output queue: %d buffers\n", out_depth);
+        fflush(info); // before the processes of -m are forked
+    }
+
+    if (b_batch)
+    {
+        Doc_list docs = {0};
+        if (manifest != NULL)
+            read_manifest(&docs, manifest, out_dir);
+        for (int k = optind; k < argc; k++)
+            add_doc(&docs, argv[k], NULL, out_dir);
+        int n_workers = n_threads > 0 ? n_threads : sysconf(_SC_NPROCESSORS_ONLN);
+        Split_layout layout = {.n_cols = n_cols, .n_rows = n_rows, .col_width = col_width, .spacing = spacing};
+        size_t failed = run_docs(&docs, n_workers > 0 ? n_workers : 1, &layout, (size_t)n_buf_pages * alloc_n_rows * alloc_page_width);
+        free_docs(&docs);
+        return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (b_stats)
+    { // the counters of each process of -m are reported separately
+        static const char *const sp_names[] = {"main"};
+        static const char *mp_names[MP_MAX_PROCS];
+        for (int k = 0; k < topo.n_procs; k++)
+            mp_names[k] = topo.names[k];
+        stats_init(b_mp ? topo.n_procs : 1, b_mp ? mp_names : sp_names);
+    }
+
+    // regular files are mapped in memory, anything else is read as a stream
+    open_input(&in, in_path);
+    if (upd_path != NULL)
+    { // the output goes to the file, not to the standard output
+        if (run_relayout(&in, upd_path, n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width, (size_t)n_buf_pages * alloc_n_rows * alloc_page_width, b_verbose) == -1)
+            exit(EXIT_FAILURE);
+        close_input(&in);
+        stats_report(stats_path);
+        return EXIT_SUCCESS;
+    }
+    // the buffer holds n_buf_pages pages of the largest possible size (a row plus '\n' is at most alloc_page_width bytes)
+    open_output(&out, STDOUT_FILENO, (size_t)n_buf_pages * alloc_n_rows * alloc_page_width);
+    if (z_fmt != Z_NONE || out_depth > 0)
+    { // the pages go to the thread compressing or writing them instead of the standard output
+        z_open_output(&zout, z_fmt, STDOUT_FILENO, out_depth > 0 ? out_depth : Z_N_BUFS);
+        set_output_sink(&out, z_sink, &zout);
     }
 
-    if (b_mp)
+    if (n_groups > 0)
+    {
+        if (run_pipeline(&in, &out, stage_group, n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width) == -1)
+        { // write the pages completed before the error
+            close_output(&out);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (n_threads > 0)
     {
-        mp_main(n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width);
+        if (pj_main(&in, &out, n_threads, n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width) == -1)
+        { // write the pages completed before the error
+            close_output(&out);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (b_mp)
+    {
+        mp_main(&in, &out, &topo, b_verbose ? info : NULL, n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width);
     }
     else
     {
-        sp_main(n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width);
+        Split_layout layout = {.n_cols = n_cols, .n_rows = n_rows, .col_width = col_width, .spacing = spacing};
+        Page_index index;
+        if (b_cache)
+            cache = open_cache(cache_path);
+        if (index_path != NULL)
+            open_index(&index, index_path, &layout);
+        unsigned long long n_pages = sp_main(&in, &out, &layout, cache, index_path != NULL ? &index : NULL, first_page, last_page);
+        if (b_count)
+            printf("%llu\n", n_pages);
+        close_cache(cache, b_verbose);
+        if (index_path != NULL)
+            close_index(&index);
     }
 
+    stats_begin(STAGE_OUTPUT);
+    close_output(&out);
+    stats_end(STAGE_OUTPUT);
+    close_input(&in);
+    stats_report(stats_path);
+
     return EXIT_SUCCESS;
 }
 
-/* FUNCTION: process_empty_line
- * INPUT:   a pointer to a pointer of char (char** line), the line to be checked
-            a pointer to a boolean (bool* empty_line), whether an empty line has been already found
-            a struct Pr_data (struct Pr_data pos_data), the position on the page (to determine whether the line is the  frirst of a page)
- * OUTPUT:  boolean value. If the line is empty and it is not the firts time an empty line is found, the function
-            returns true (indicating that the line should be discarded). Otherwise, it returns false. In any case the functon updates the value of *empty_line to match what it has found.
- */
-bool process_empty_line(char **line, bool *empty_line, Pr_data pos_data)
+/*  FUNCTION: mp_read
+    INPUT:  in, the input source.
+            to, the writing side of the channel to the next process.
+            col_width, the width (number of visible characters) of each column.
+    OUTPUT: EOF, or LONG_WORD if a word is larger than a column (the error has been printed out).
+
+    Reads the input line by line and packs the lines into batches (see Frame), so that each write on the channel carries up to FRAME_BYTES of lines instead of two writes per line. On a word larger than a column the lines read so far are still sent, so that their pages are written. The channel is closed at the end.
+*/
+static ssize_t mp_read(In_stream *in, Channel *to, int col_width)
 {
-    if (**line == '\0')
-    { // if this is the first time that reads an empty row and it is not the first row of a page
-        if (!*empty_line && !(pos_data.i == 0 && pos_data.j == 0))
+    Frame batch;
+    open_frame(&batch);
+    // the line is copied into the batch, so its memory is reused by the next one
+    Arena arena = {0};
+    char *line;
+    ssize_t cnt;
+    while ((cnt = read_one_line(in, &arena, &line, col_width)) >= 0)
+    {
+        frame_put(to, &batch, line, strlen(line) + 1); // + 1 to include the terminating null character
+        arena_reset(&arena);
+    }
+    frame_flush(to, &batch);
+    close_frame(&batch);
+    // the write is finished, close the channel
+    close_channel(to, true);
+    // free the memory allocated by read_one_line
+    arena_free(&arena);
+    return cnt;
+}
+
+/*  FUNCTION: mp_layout
+    INPUT:  in, the input source, read when from is NULL.
+            from, the reading side of the channel from the previous process, NULL if this process reads the input.
+            out, the output buffer, written when to is NULL.
+            to, the writing side of the channel to the next process, NULL if this process writes the output.
+            n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width, the layout of the pages.
+    OUTPUT: EOF, or LONG_WORD if a word of the input is larger than a column (the error has been printed out).
+
+    Lays out the lines on a page, which is written (through an output buffer, exactly as it would be written on the standard output) and reset as soon as it is full. The lines come in batches from the channel, where they are used in place, or are read from the input; the pages go to the channel or to the output. A word larger than a column stops the input, the lines before it are laid out as if the input ended there. The channels are closed at the end.
+*/
+static ssize_t mp_layout(In_stream *in, Channel *from, Out_stream *out, Channel *to, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width)
+{
+    char *line;
+    size_t nbytes;
+    ssize_t cnt = EOF;
+    Pr_data pos_data = {.line_ptr = NULL, .i = 0, .j = 0};
+    bool empty_line = false;
+
+    // the pages sent to the next process are collected in a buffer as large as the one of the standard output and flushed to the channel
+    Out_stream page_out;
+    if (to != NULL)
+    {
+        open_output(&page_out, to->fd[1], out->cap);
+        set_output_sink(&page_out, channel_sink, to);
+        out = &page_out;
+    }
+
+    // allocate a page, it will be rewritten every time
+    Page page = alloc_page(alloc_n_rows, alloc_page_width);
+
+    Frame batch;
+    Arena arena = {0};
+    if (from != NULL)
+        open_frame(&batch);
+    char empty[2]; // an empty line becomes "\n" here, there is no room for it in the batch
+    for (;;)
+    {
+        if (from != NULL)
         {
-            strcpy(*line, "\n"); // newline whill become a row of spaces
-            *empty_line = true;
+            if ((line = frame_get(from, &batch, &nbytes)) == NULL)
+                break;
+            if (*line == '\0')
+            {
+                empty[0] = '\0';
+                line = empty;
+            }
         }
         else
-        { // tell the caller to discard duplicate empty lines
-            return true;
+        {
+            arena_reset(&arena);
+            if ((cnt = read_one_line(in, &arena, &line, col_width)) < 0)
+                break;
+        }
+
+        // process the data. The variable pos_data stores the current position of the read buffer and of the output array.
+        // skip if more than one empty line is found
+        if (process_empty_line(&line, &empty_line, pos_data))
+        {
+            continue;
+        }
+        pos_data = start_line(pos_data, line);
+        // fill pages until there are words in the line
+        while (strcmp(pos_data.line_ptr, "") != 0)
+        {
+            stats_begin(STAGE_LAYOUT);
+            pos_data = process_one_line(n_cols, col_width, n_rows, spacing, &page, pos_data);
+            stats_end(STAGE_LAYOUT);
+            if (pos_data.i == 0 && pos_data.j == 0)
+            {                                        // the page is ended: add the separator and reset
+                set_row(&page, n_rows, new_page); // this is safe because the size is checked at the beginning of the main function
+                write_one_page(out, &page, alloc_n_rows);
+                clear_page(&page); // reset the page
+            }
         }
     }
-    else
+    // write the last page
+    write_one_page(out, &page, alloc_n_rows);
+    if (to != NULL)
     {
-        *empty_line = false;
+        stats_begin(STAGE_OUTPUT);
+        close_output(&page_out);
+        stats_end(STAGE_OUTPUT);
+        close_channel(to, true);
     }
-
-    return false;
+    if (from != NULL)
+    {
+        close_channel(from, false);
+        close_frame(&batch);
+    }
+    // free memory allocated
+    arena_free(&arena);
+    free_page(&page);
+    return cnt;
 }
 
-/*  FUNCTION: write_one_page
-    INPUT:  fd - a file descriptor to write to.
-            out_lines - an array of character pointers, representing lines of text to write to fd.
-            alloc_n_rows - an integer representing the number of lines to write.
+/*  FUNCTION: mp_write
+    INPUT:  from, the reading side of the channel from the previous process.
+            out, the output buffer.
+            alloc_page_width, the width of a row in memory.
     OUTPUT: void
 
-    The function loops through the out_lines array and writes each line, followed by a newline character, to the file descriptor using the write system call. If the number of characters written is not equal to the length of the line specified in the strlen call, the function prints an error message using perror, exits the program with EXIT_FAILURE, and returns control to the calling function.
+    Copies the data from the channel onto the output. With a ring the data is written straight from the shared memory, a pipe is read into a buffer. The channel is closed at the end.
 */
-void write_one_page(int fd, char **out_lines, int alloc_n_rows)
+static void mp_write(Channel *from, Out_stream *out, int alloc_page_width)
 {
-    for (int i = 0; i < alloc_n_rows; i++)
+    char *buf = malloc(alloc_page_width + 1);
+    if (buf == NULL)
     {
-        if (out_lines[i][0] == '\0') // no more lines to write
-            break;
-        if (write(fd, out_lines[i], strlen(out_lines[i])) != strlen(out_lines[i]))
-        {
-            perror("write error");
-            exit(EXIT_FAILURE);
-        }
-        write(fd, "\n", 1);
+        perror("Error allocating the output buffer");
+        exit(EXIT_FAILURE);
     }
+    stats_alloc();
+    const char *data;
+    size_t nbytes;
+    // while there are data to read
+    while ((nbytes = channel_get(from, &data, buf, alloc_page_width)) > 0)
+    {
+        stats_begin(STAGE_OUTPUT);
+        out_write(out, data, nbytes);
+        stats_end(STAGE_OUTPUT);
+        channel_release(from, nbytes);
+    }
+    // close the channel
+    close_channel(from, false);
+    // free allocated memory
+    free(buf);
 }
 
 /*  FUNCTION: mp_main
-    INPUT:  n_cols, the number of columns for the output.
+    INPUT:  in, the input source.
+            out, the output buffer.
+            topo, the processes, the stages they run, their CPUs and the channels connecting them.
+            info, the stream where the topology is printed (-v), NULL for none.
+            n_cols, the number of columns for the output.
             n_rows, the number of rows per page for the output.
             spacing, the number of spaces between columns.
             col_width, the width (number of visible characters) of each column.
@@ -204,218 +678,372 @@ void write_one_page(int fd, char **out_lines, int alloc_n_rows)
             alloc_page_width, the width of a row in memory.
     OUTPUT: void
 
-    This is a function three interconnected processes that takes as input the parameters related to the desired layout for the output text and prints it with a given number of columns and rows per page and a certain spacing between the columns (if the input had empty lines pagination is done properly).
+    This is a function of two or three interconnected processes that takes as input the parameters related to the desired layout for the output text and prints it with a given number of columns and rows per page and a certain spacing between the columns (if the input had empty lines pagination is done properly).
 
-    The code first declares several variables for processing rows, including a char pointer 'line' with an initial value of NULL, and a structure called Pr_data. Then, variables for multiprocess are declared, such as file descriptors for two pipes and two process ids.
+    The stages (reading, layout and writing) are divided among the processes as the topology says, by default one process each. A channel is either a single-producer/single-consumer ring in shared memory (the default) or an anonymous pipe, whose capacity can be set.
 
-    After initializing the first pipe, a fork is made and the parent process reads line by line from the standard input and writes it to the pipe. Then, the parent process closes the write end of the pipe and waits for the (first) child process to finish.
+    Each process but the last opens a channel and forks the next one, which reads from that channel: the first process runs the first stages, then the child runs the following ones, and so on. Every process pins itself to its CPUs before it starts working, then runs its stages:
 
-    The child process reads lines from the pipe, processes them, and writes output to a new pipe. It first opens a new pipe and a second fork is performed. The second parent process will read from the first pipe and write to the second. It will allocate a matrix of the size of a page and read from the first pipe. It processes the data and fills pages until there are no words in the line. When the page is ended, the separator is added, and the page array is reset. This process is repeated until all data is processed. Finally, it writes the last page, closes both pipes and waits for children to terminate.
+    - the reader (mp_read) reads line by line from the input and sends the lines in batches to the next process.
+    - the formatter (mp_layout) lays out the lines, received from the previous process or read by itself when it is also the reader, and sends the pages as text to the next process or writes them itself when it is also the writer.
+    - the writer (mp_write) copies the data from the previous process onto the standard output.
 
-    The second child reads data from the second pipe and writes them onto the standard output. It reads the data until there is no more data and writes to the standard output. Finally, it closes the second pipe, frees the allocated memory, and terminates.
+    Finally, each process closes its channels and waits for its child to terminate. The first process exits with an error if a word of the input was larger than a column, after the pages of the lines before it have been written.
 */
-void mp_main(int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width)
+void mp_main(In_stream *in, Out_stream *out, const Mp_topology *topo, FILE *info, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width)
 {
-    // Variables to prcess rows
-    char *line = NULL;
-    ssize_t linelen, nbytes;
-    Pr_data pos_data = {.line_ptr = line, .i = 0, .j = 0};
-    bool empty_line = false;
+    Channel from; // the channel from the previous process
+    Channel to;   // the channel to the next process
+    int proc = 0; // the index of this process
+    pid_t child = 0; // the next process, 0 for none
 
-    // Variabiles for multiprocess
-    int fd[2];  // file descriptors for the read and write ends of the first pipe
-    pid_t pid1; // the child process id returned by the first fork()
+    while (proc < topo->n_procs - 1)
+    {
+        open_channel(&to, topo->transport, topo->pipe_size);
+        if (proc == 0 && info != NULL)
+        { // before the fork, so that it is printed once and before the pages
+            print_topology(info, topo, &to);
+            fflush(info);
+        }
+        if ((child = fork()) < 0)
+        {
+            perror("Fork failed");
+            exit(EXIT_FAILURE);
+        }
+        if (child > 0)
+        {
+            channel_writer(&to, child);
+            break;
+        }
+        // the child reads from the channel and goes on with the next stages
+        from = to;
+        channel_reader(&from);
+        stats_select(++proc);
+    }
+    pin_process(topo, proc);
 
-    // Open the first pipe
-    if (pipe(fd) == -1)
+    bool reads = topo->proc_of[MP_READ] == proc;
+    bool lays_out = topo->proc_of[MP_LAYOUT] == proc;
+    bool writes = topo->proc_of[MP_WRITE] == proc;
+    ssize_t cnt = EOF;
+    if (lays_out)
+        cnt = mp_layout(in, reads ? NULL : &from, out, writes ? NULL : &to, n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width);
+    else if (reads)
+        cnt = mp_read(in, &to, col_width);
+    else
+        mp_write(&from, out, alloc_page_width);
+
+    // wait for the next process to finish, its failure (e.g. it could not be pinned) is the failure of this one
+    int status;
+    if (child > 0 && waitpid(child, &status, 0) != child)
     {
-        perror("Pipe 1 failed");
+        perror("waitpid error");
         exit(EXIT_FAILURE);
     }
-    // fork
-    pid1 = fork();
+    if (cnt == LONG_WORD || (child > 0 && WIFEXITED(status) && WEXITSTATUS(status) != EXIT_SUCCESS))
+        exit(EXIT_FAILURE);
+}
+
+/*  FUNCTION: open_cache
+    INPUT:  path, the cache file, NULL for a cache in memory only.
+    OUTPUT: the cache.
 
-    if (pid1 < 0)
+    If the cache file cannot be read an error message is printed out and the program exits.
+*/
+Split_cache *open_cache(const char *path)
+{
+    Split_cache *cache;
+    Split_status status = split_cache_open(&cache, path);
+    if (status != SPLIT_OK)
     {
-        perror("Fork 1 failed");
+        fprintf(stderr, "ERROR: %s: %s, must stop.\n", path ? path : "cache", split_strerror(status));
         exit(EXIT_FAILURE);
     }
-    else if (pid1 > 0) // parent process reads line by line from stdin and writes it to the pipe
+    return cache;
+}
+
+/*  FUNCTION: close_cache
+    INPUT:  cache, the cache or NULL.
+            verbose, whether to print the hits and misses on stderr.
+    OUTPUT: void
+
+    Saves the cache to its file, if any, and frees it. A cache that cannot be saved is reported but does not change the exit status, the output is complete.
+*/
+void close_cache(Split_cache *cache, bool verbose)
+{
+    if (cache == NULL)
+        return;
+    Split_status status = split_cache_save(cache);
+    if (status != SPLIT_OK)
+        fprintf(stderr, "Warning: the cache was not saved: %s.\n", split_strerror(status));
+    if (verbose)
     {
-        // close the unused read end of the pipe
-        close(fd[0]);
+        unsigned long long hits, misses;
+        size_t entries;
+        split_cache_counters(cache, &hits, &misses, &entries);
+        fprintf(stderr, "Cache: %llu hits, %llu misses, %zu lines\n", hits, misses, entries);
+    }
+    split_cache_close(cache);
+}
 
-        while (read_one_line(stdin, &line, col_width) != EOF)
-        {
-            linelen = strlen(line) + 1;              // + 1 to include the terminating null character
-            write(fd[1], &linelen, sizeof(linelen)); // send the size of the line to the child process
-            write(fd[1], line, linelen);             // send the line itself to the child process
-        }
-        // the write is finished, close the write end of the pipe
-        close(fd[1]);
-        // free the memory allocated by read_one_line
-        free(line);
-        // wait for the (first) child process to finish
-        if (waitpid(pid1, NULL, 0) != pid1)
-        {
-            perror("waitpid 1 error");
-            exit(EXIT_FAILURE);
-        }
+/*      The struct contains the receiver of the pages of sp_main:
+        Out_stream *out - the output buffer.
+        Page_index *index - the index of the pages, NULL if none.
+        Split_ctx *ctx - the context laying out the pages, asked where they start.
+*/
+typedef struct Sp_sink
+{
+    Out_stream *out;
+    Page_index *index;
+    Split_ctx *ctx;
+} Sp_sink;
+
+/*  FUNCTION: page_sink
+    INPUT:  ctx, a pointer to the Sp_sink.
+            page, a page laid out by the library.
+            len, the number of bytes of the page.
+    OUTPUT: 0, write errors terminate the program.
+*/
+static int page_sink(void *ctx, const char *page, size_t len)
+{
+    Sp_sink *sink = ctx;
+    out_write(sink->out, page, len);
+    if (sink->index != NULL)
+    {
+        Split_origin origin;
+        split_page_origin(sink->ctx, &origin);
+        index_page(sink->index, &origin, len);
     }
-    else // child process reads lines from pipe, process them, and writes the output to a new pipe
+    return 0;
+}
+
+/*  FUNCTION: sp_main
+    INPUT:  in, the input source.
+            out, the output buffer.
+            layout, the layout of the pages.
+            cache, the cache of the justified lines, NULL if none.
+            index, the index of the pages, NULL if none.
+            first_page, last_page, the pages written (see split_set_pages).
+    OUTPUT: the number of pages of the text (up to last_page).
+
+    This is the single process version of the mp_main funciont. It takes as input the parameters related to the desired layout for the output text and prints it with a given number of columns and rows per page and a certain spacing between the columns (if the input had empty lines pagination is done properly).
+
+    The layout is done by libsplittext: the input is fed to the library in large pieces (the whole mapping for a regular file) and the pages it returns are written through the output buffer. If the library fails, the pages completed so far are written (and the lines justified so far cached), the error is printed out and the program exits.
+*/
+unsigned long long sp_main(In_stream *in, Out_stream *out, const Split_layout *layout, Split_cache *cache, Page_index *index, unsigned long long first_page, unsigned long long last_page)
+{
+    Split_ctx *ctx;
+    Sp_sink sink = {.out = out, .index = index};
+    Split_status status = split_open(&ctx, layout, page_sink, &sink);
+    sink.ctx = ctx;
+    if (status == SPLIT_OK && cache != NULL)
+        status = split_set_cache(ctx, cache);
+    if (status == SPLIT_OK)
     {
-        // close the unused write end of the pipe
-        close(fd[1]);
+        split_set_pages(ctx, first_page, last_page);
+        split_set_stats(ctx, stats);
+    }
+    if (status != SPLIT_OK)
+    {
+        fprintf(stderr, "ERROR: %s, must stop.\n", split_strerror(status));
+        exit(EXIT_FAILURE);
+    }
 
-        // variables for second the fork
-        pid_t pid2; // the child process id returned by the second fork()
-        int fd2[2]; // file descriptors for the read and write ends of the second pipe
+    const char *data;
+    ssize_t n;
+    while (status == SPLIT_OK)
+    {
+        stats_begin(STAGE_READ);
+        n = next_chunk(in, &data);
+        stats_end(STAGE_READ);
+        if (n == 0)
+            break;
+        status = split_feed(ctx, data, n);
+    }
+    if (status == SPLIT_OK)
+        status = split_finish(ctx);
+    if (status != SPLIT_OK)
+    {
+        close_output(out);
+        fprintf(stderr, "ERROR: %s, must stop.\n", split_error(ctx));
+        split_close(ctx);
+        close_cache(cache, false);
+        if (index != NULL)
+            close_index(index);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long long n_pages = split_page_count(ctx);
+    split_close(ctx);
+    return n_pages;
+}
 
-        // open a new pipe
-        if (pipe(fd2) == -1)
-        {
-            perror("Pipe 2 failed");
-            exit(EXIT_FAILURE);
-        }
+/*  FUNCTION: parse_pages
+    INPUT:  spec, the pages as given to --pages: A-B, A or A-.
+            first, last, where the first and the last page are stored (SPLIT_END for last with A-).
+    OUTPUT: 0 on success, -1 if spec is not valid (first and last are left as they were).
+*/
+int parse_pages(const char *spec, unsigned long long *first, unsigned long long *last)
+{
+    char *end;
+    if (!isdigit((unsigned char)*spec))
+        return -1;
+    unsigned long long a = strtoull(spec, &end, 10), b = a;
+    if (*end == '-')
+    {
+        const char *rest = end + 1;
+        if (*rest == '\0')
+            b = SPLIT_END;
+        else if (!isdigit((unsigned char)*rest) || (b = strtoull(rest, &end, 10), *end != '\0'))
+            return -1;
+    }
+    else if (*end != '\0')
+        return -1;
+    if (a < 1 || b < a || a == SPLIT_END)
+        return -1;
+    *first = a;
+    *last = b;
+    return 0;
+}
 
-        // second fork
-        if ((pid2 = fork()) < 0)
-        {
-            perror("Fork 2 failed");
-            exit(EXIT_FAILURE);
-        }
-        else if (pid2 > 0) // second parent process, it will read from the first pipe and write to the second
-        {
-            // close the unused read end of the second pipe
-            close(fd2[0]);
+/*  FUNCTION: read_batch
+    INPUT:  in, the input source.
+            batch, the batch to fill.
+            col_width, the width (number of visible characters) of each column.
+    OUTPUT: the number of lines read, 0 if the input is ended, or LONG_WORD if a word is larger than a column (the error has been printed out, the lines before it are in the batch).
 
-            // allocate a matrix of the size of a page, this matrix will be rewritten every time
-            char **out_lines = alloc_2d(alloc_n_rows, alloc_page_width);
+    Reads up to BATCH_LINES lines into the arena of the batch, which is reset first: once it holds the largest batch the lines are read without allocating.
+*/
+static ssize_t read_batch(In_stream *in, Par_batch *batch, int col_width)
+{
+    size_t n = 0;
+    ssize_t cnt = 0;
+    if (arena_reset(&batch->text) == -1)
+    {
+        perror("Error allocating the lines of a batch");
+        exit(EXIT_FAILURE);
+    }
+    while (n < BATCH_LINES && (cnt = read_one_line(in, &batch->text, &batch->lines[n].text, col_width)) != EOF)
+    {
+        if (cnt == LONG_WORD)
+            break;
+        n++;
+    }
+    batch->n_lines = n;
+    return cnt == LONG_WORD ? LONG_WORD : (ssize_t)n;
+}
 
-            // read from the first pipe
-            while (1)
-            {
-                // read the size of the line to read
-                nbytes = read(fd[0], &linelen, sizeof(linelen));
-                if (nbytes <= 0) // no more data to read
-                    break;
-                // actual read
-                line = resize_buffer(&line, linelen);
-                nbytes = read(fd[0], line, linelen);
-                if (nbytes <= 0)
-                {
-                    perror("Pipe 1 read terminated unexpectedly");
-                    exit(EXIT_FAILURE);
-                }
-
-                // process the data. The variable pos_data stores the current position of the read buffer and of the output array.
-                pos_data.line_ptr = line;
-                // skip if more than one empty line is found
-                if (process_empty_line(&line, &empty_line, pos_data))
-                {
-                    continue;
-                }
-                // fill pages until there are words in the line
-                while (strcmp(pos_data.line_ptr, "") != 0)
-                {
-                    pos_data = process_one_line(n_cols, col_width, n_rows, spacing, out_lines, pos_data);
-                    if (pos_data.i == 0 && pos_data.j == 0)
-                    {                                        // the page is ended: add the separator and reset
-                        strcpy(out_lines[n_rows], new_page); // this is safe because the size is checked at the beginning of the main function
-                        for (int i = 0; i <= n_rows; i++)    // write on the second pipe
-                            write(fd2[1], out_lines[i], alloc_page_width);
-                        // printf("%s\n", out_lines[i]);
-                        for (int i = 0; i <= n_rows; i++) // reset the page array
-                            out_lines[i][0] = '\0';
-                    }
-                }
-            }
-            for (int i = 0; i <= n_rows; i++)
-            {                                // write the last page
-                if (out_lines[i][0] == '\0') // no more lines to read
-                    break;
-                write(fd2[1], out_lines[i], alloc_page_width);
-            }
-            // printf("%s\n", out_lines[i]);
-            // close both pipes
-            close(fd[0]);
-            close(fd2[1]);
-            // free memory allocated
-            free(line);
-            free_2d(out_lines, alloc_n_rows);
-            // wait for children to terminate
-            if (waitpid(pid2, NULL, 0) != pid2) // wait for second child
-                perror("waitpid 2 error");
+/*  FUNCTION: place_batch
+    INPUT:  out, the output buffer.
+            batch, a batch whose lines have been broken into rows.
+            n_cols, n_rows, spacing, col_width, alloc_n_rows, the layout of the page.
+            page, the page.
+            pos_data, pointer to the current position on the page.
+            empty_line, pointer to the flag telling whether the previous line was empty.
+            blank, a row of col_width spaces.
+    OUTPUT: void
+
+    Places the rows of the lines of the batch on the pages in order, writing every page as soon as it is full. Empty lines are handled as in sp_main: duplicates and those at the top of a page are discarded, the others become a row of spaces unless they fall at the top of a column.
+
+    The time spent placing the rows is counted as layout, the time spent writing the pages as output.
+*/
+static void place_batch(Out_stream *out, Par_batch *batch, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, Page *page, Pr_data *pos_data, bool *empty_line, const char *blank)
+{
+    stats_begin(STAGE_LAYOUT);
+    for (size_t k = 0; k < batch->n_lines; k++)
+    {
+        Par_line *pl = &batch->lines[k];
+        // skip if more than one empty line is found
+        if (process_empty_line(&pl->text, empty_line, *pos_data))
+        {
+            continue;
         }
-        else // second child reads data from second pipe and write them on the stdout
+        size_t n = (pl->text[0] == '\n') ? (pos_data->i != 0) : pl->broken.n_rows;
+        for (size_t r = 0; r < n; r++)
         {
-            // close unused write end of the second pipe
-            close(fd2[1]);
-            line = resize_buffer(&line, alloc_page_width);
-            // while there are data to read
-            while ((nbytes = read(fd2[0], line, alloc_page_width)) > 0)
+            if (pl->text[0] == '\n')
+                *pos_data = place_row(n_cols, n_rows, spacing, page, *pos_data, blank, col_width);
+            else
             {
-                if (write(STDOUT_FILENO, line, strlen(line)) != strlen(line))
-                {
-                    perror("write error");
-                    exit(EXIT_FAILURE);
-                }
-                write(STDOUT_FILENO, "\n", 1);
+                size_t start = (r == 0) ? 0 : pl->broken.ends[r - 1];
+                *pos_data = place_row(n_cols, n_rows, spacing, page, *pos_data, pl->broken.rows + start, pl->broken.ends[r] - start);
+            }
+            if (pos_data->i == 0 && pos_data->j == 0)
+            { // the page is ended: add the separator and reset
+                set_row(page, n_rows, new_page); // this is safe because the size is checked at the beginning of the main function
+                stats_end(STAGE_LAYOUT);
+                write_one_page(out, page, alloc_n_rows);
+                stats_begin(STAGE_LAYOUT);
+                clear_page(page); // reset the page
             }
-            // close second pipe
-            close(fd2[0]);
-            // free allocated memory
-            free(line);
         }
     }
+    stats_end(STAGE_LAYOUT);
 }
 
-/*  FUNCTION: sp_main
-    INPUT:  n_cols, the number of columns for the output.
+/*  FUNCTION: pj_main
+    INPUT:  in, the input source.
+            out, the output buffer.
+            n_threads, the number of threads breaking the lines into rows.
+            n_cols, the number of columns for the output.
             n_rows, the number of rows per page for the output.
             spacing, the number of spaces between columns.
             col_width, the width (number of visible characters) of each column.
             alloc_n_rows, the number of rows per page (including the new page symbol).
             alloc_page_width, the width of a row in memory.
-    OUTPUT: void
+    OUTPUT: 0 on success, -1 if a word is larger than a column (the error has been printed out).
 
-    This is the single process version of the mp_main funciont. It takes as input the parameters related to the desired layout for the output text and prints it with a given number of columns and rows per page and a certain spacing between the columns (if the input had empty lines pagination is done properly).
+    This is the multi-threaded version of sp_main, its output is the same. How a line is broken into rows and justified depends only on the width of the columns, only the position of the rows on the page must be computed in order. Hence the lines are read in batches and the batches are broken into rows by a pool of n_threads threads, while the main thread places the rows of the previous batch on the pages and writes them.
+
+    Two batches are used alternately: while the workers break one batch, the main thread reads the next one and, once the workers are done and have been given the next batch, it places the rows of the first one.
+
+    If a word is larger than a column the reading stops, the lines read before it are placed as usual and only the completed pages are written, as sp_main does: the caller writes them out with close_output and exits.
 */
-void sp_main(int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width)
+int pj_main(In_stream *in, Out_stream *out, int n_threads, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width)
 {
-    // Variables to prcess rows
-    char *line = NULL;
-    Pr_data pos_data = {.line_ptr = line, .i = 0, .j = 0};
+    Pr_data pos_data = {.line_ptr = NULL, .i = 0, .j = 0};
     bool empty_line = false;
+    Par_pool pool;
 
-    // allocate a matrix of the size of a page, this matrix will be rewritten every time
-    char **out_lines = alloc_2d(alloc_n_rows, alloc_page_width);
+    // allocate a page, it will be rewritten every time
+    Page page = alloc_page(alloc_n_rows, alloc_page_width);
+    // the row used for an empty line and the two batches
+    char *blank = malloc(col_width);
+    Par_batch *cur = calloc(2, sizeof(*cur));
+    if (blank == NULL || cur == NULL)
+    {
+        perror("Error allocating the batches");
+        exit(EXIT_FAILURE);
+    }
+    memset(blank, ' ', col_width);
+    Par_batch *next = cur + 1;
 
-    while (read_one_line(stdin, &line, col_width) != EOF)
+    start_pool(&pool, n_threads, col_width, alloc_page_width);
+    bool failed = read_batch(in, cur, col_width) == LONG_WORD;
+    if (cur->n_lines > 0)
+        submit_batch(&pool, cur);
+    while (cur->n_lines > 0)
     {
-        // process the data. The variable pos_data stores the current position of the read buffer and of the output array.
-        pos_data.line_ptr = line;
-        // skip if more than one empty line is found
-        if (process_empty_line(&line, &empty_line, pos_data))
-        {
-            continue;
-        }
-        // fill pages until there are words in the line
-        while (strcmp(pos_data.line_ptr, "") != 0)
-        {
-            pos_data = process_one_line(n_cols, col_width, n_rows, spacing, out_lines, pos_data);
-            if (pos_data.i == 0 && pos_data.j == 0)
-            { // the page is ended: add the separator and reset
-                strcpy(out_lines[n_rows], new_page); // safe because the size has been checked at the beginning 
-                write_one_page(STDOUT_FILENO, out_lines, alloc_n_rows);
-                for (int i = 0; i < alloc_n_rows; i++) // reset the page array
-                    out_lines[i][0] = '\0';
-            }
-        }
+        next->n_lines = 0;
+        if (!failed) // read while the workers break the current batch
+            failed = read_batch(in, next, col_width) == LONG_WORD;
+        wait_batch(&pool);
+        if (next->n_lines > 0)
+            submit_batch(&pool, next);
+        place_batch(out, cur, n_cols, n_rows, spacing, col_width, alloc_n_rows, &page, &pos_data, &empty_line, blank);
+        Par_batch *tmp = cur;
+        cur = next;
+        next = tmp;
     }
-    // write the last page
-    write_one_page(STDOUT_FILENO, out_lines, alloc_n_rows);
+    stop_pool(&pool);
+
+    // write the last page, unless the input was not read to the end
+    if (!failed)
+        write_one_page(out, &page, alloc_n_rows);
     // free allocated memory
-    free(line);
-    free_2d(out_lines, alloc_n_rows);
+    free_batch(cur);
+    free_batch(next);
+    free(cur < next ? cur : next);
+    free(blank);
+    free_page(&page);
+    return failed ? -1 : 0;
 }
\ No newline at end of file
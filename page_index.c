@@ -0,0 +1,55 @@
+#include "page_index.h"
+
+/*  FUNCTION: open_index
+    INPUT:  ix, the index to open.
+            path, the index file.
+            layout, the layout of the pages.
+    OUTPUT: void
+*/
+void open_index(Page_index *ix, const char *path, const Split_layout *layout)
+{
+    ix->path = path;
+    ix->out_pos = 0;
+    ix->f = fopen(path, "wb");
+    if (ix->f == NULL || fwrite(INDEX_MAGIC, sizeof(INDEX_MAGIC) - 1, 1, ix->f) != 1 || fwrite(layout, sizeof(*layout), 1, ix->f) != 1)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  FUNCTION: index_page
+    INPUT:  ix, an open index.
+            origin, where the text of the page starts.
+            len, the length of the page.
+    OUTPUT: void
+
+    The entries go through the buffer of the stream, an index costs one write every few hundred pages.
+*/
+void index_page(Page_index *ix, const Split_origin *origin, size_t len)
+{
+    Index_entry e = {.out_offset = ix->out_pos, .out_len = len, .para = origin->para, .in_offset = origin->in_offset,
+                     .word_offset = origin->word_offset, .after_empty = origin->after_empty};
+    if (fwrite(&e, sizeof(e), 1, ix->f) != 1)
+    {
+        perror(ix->path);
+        exit(EXIT_FAILURE);
+    }
+    ix->out_pos += len;
+}
+
+/*  FUNCTION: close_index
+    INPUT:  ix, an open index.
+    OUTPUT: void
+
+    If the index cannot be written an error message is printed out and the program exits.
+*/
+void close_index(Page_index *ix)
+{
+    if (fclose(ix->f) != 0)
+    {
+        perror(ix->path);
+        exit(EXIT_FAILURE);
+    }
+    ix->f = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef PAGE_INDEX_H
+#define PAGE_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "splittext.h"
+
+#define INDEX_MAGIC "SPLTIDX1" // first bytes of an index file
+
+/*  The index of the pages of an output, to reach page N without scanning the output for the separators. The file is the magic (8 bytes), the layout (Split_layout, four int), then one entry per page in the order of the output, so that the entry of page N (counted from 0) is at offset 24 + 48 * N. The numbers are in the byte order of the machine that wrote the file.
+*/
+
+/*      The struct contains the entry of a page:
+        uint64_t out_offset, out_len - where the page is in the output and its length, the separator included.
+        uint64_t para, in_offset, word_offset, after_empty - where its text starts in the input (see Split_origin): laying out the input from there, with the same layout, produces the page and the following ones.
+*/
+typedef struct Index_entry
+{
+    uint64_t out_offset, out_len;
+    uint64_t para, in_offset, word_offset, after_empty;
+} Index_entry;
+
+/*      The struct contains an index being written:
+        FILE *f - the index file.
+        const char *path - its name, for the error messages.
+        uint64_t out_pos - the length of the output so far.
+*/
+typedef struct Page_index
+{
+    FILE *f;
+    const char *path;
+    uint64_t out_pos;
+} Page_index;
+
+/*  FUNCTION: open_index
+    INPUT:  ix, the index to open.
+            path, the index file.
+            layout, the layout of the pages.
+    OUTPUT: void
+
+    If the file cannot be created an error message is printed out and the program exits.
+*/
+void open_index(Page_index *ix, const char *path, const Split_layout *layout);
+
+/*  FUNCTION: index_page
+    INPUT:  ix, an open index.
+            origin, where the text of the page starts.
+            len, the length of the page.
+    OUTPUT: void
+
+    Appends the entry of the page, which follows the previous one in the output. If the index cannot be written an error message is printed out and the program exits.
+*/
+void index_page(Page_index *ix, const Split_origin *origin, size_t len);
+
+/*  FUNCTION: close_index
+    INPUT:  ix, an open index.
+    OUTPUT: void
+*/
+void close_index(Page_index *ix);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "parallel.h"
+
+/*  FUNCTION: break_par_line
+    INPUT:  pl, the line to break.
+            col_width, the width of a column.
+            scratch, a page of CHUNK_ROWS empty rows used by break_line.
+    OUTPUT: void
+
+    Empty lines have no rows, they are handled while placing the rows. If the memory cannot be allocated an error message is printed out and the program exits.
+*/
+static void break_par_line(Par_line *pl, int col_width, Page *scratch)
+{
+    pl->broken.rows_len = 0;
+    pl->broken.n_rows = 0;
+    if (pl->text[0] == '\0')
+        return;
+    if (break_line(pl->text, col_width, scratch, &pl->broken) == -1)
+    {
+        perror("Error reallocating the rows of a line");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  FUNCTION: worker
+    INPUT:  arg, a pointer to the pool.
+    OUTPUT: NULL
+
+    Each worker waits for a new batch, then takes the lines of the batch one at a time (the lines are shared through an atomic counter, so long lines do not leave the other workers idle) and breaks them into rows. When the last line of the batch is done and no worker is still looking at the batch, the main thread is woken: from then on the main thread can refill the batch safely.
+*/
+static void *worker(void *arg)
+{
+    Par_pool *pool = arg;
+    Page scratch = alloc_page(CHUNK_ROWS, pool->alloc_width);
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (!pool->stop && pool->generation == seen)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->stop)
+            break;
+        seen = pool->generation;
+        Par_batch *batch = pool->batch;
+        if (batch == NULL) // woken too late, the batch is already done
+            continue;
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+
+        Stage_time layout = {0};
+        if (stats != NULL)
+            stage_begin(&layout);
+        size_t n_done = 0, k;
+        while ((k = atomic_fetch_add(&batch->next, 1)) < batch->n_lines)
+        {
+            break_par_line(&batch->lines[k], pool->col_width, &scratch);
+            n_done++;
+        }
+        if (stats != NULL)
+            stage_end(&layout);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->layout.wall += layout.wall;
+        pool->layout.cpu += layout.cpu;
+        batch->done += n_done;
+        pool->active--;
+        if (batch->done == batch->n_lines && pool->active == 0)
+            pthread_cond_signal(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free_page(&scratch);
+    return NULL;
+}
+
+/*  FUNCTION: start_pool
+    INPUT:  pool, a pointer to the pool to start.
+            n_threads, the number of worker threads.
+            col_width, the width of a column.
+            alloc_width, the width of a row in memory.
+    OUTPUT: void
+
+    If a thread cannot be created an error message is printed out and the program exits.
+*/
+void start_pool(Par_pool *pool, int n_threads, int col_width, int alloc_width)
+{
+    pool->n_threads = n_threads;
+    pool->col_width = col_width;
+    pool->alloc_width = alloc_width;
+    pool->batch = NULL;
+    pool->generation = 0;
+    pool->active = 0;
+    pool->stop = false;
+    pool->layout = (Stage_time){0};
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->threads = malloc(n_threads * sizeof(*pool->threads));
+    if (pool->threads == NULL)
+    {
+        perror("Error allocating the threads");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < n_threads; t++)
+    {
+        if ((errno = pthread_create(&pool->threads[t], NULL, worker, pool)) != 0)
+        {
+            perror("Error creating a thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*  FUNCTION: submit_batch
+    INPUT:  pool, a pointer to a started pool.
+            batch, the batch whose lines must be broken into rows.
+    OUTPUT: void
+*/
+void submit_batch(Par_pool *pool, Par_batch *batch)
+{
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&batch->next, 0);
+    batch->done = 0;
+    pool->batch = batch;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*  FUNCTION: wait_batch
+    INPUT:  pool, a pointer to a started pool.
+    OUTPUT: void
+*/
+void wait_batch(Par_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->batch != NULL && (pool->batch->done < pool->batch->n_lines || pool->active > 0))
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pool->batch = NULL;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*  FUNCTION: stop_pool
+    INPUT:  pool, a pointer to a started pool.
+    OUTPUT: void
+
+    Once the workers are terminated, the time they spent is added to the statistics of the process.
+*/
+void stop_pool(Par_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->n_threads; t++)
+        pthread_join(pool->threads[t], NULL);
+    stats_add(STAGE_LAYOUT, &pool->layout);
+    free(pool->threads);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->finished);
+}
+
+/*  FUNCTION: free_batch
+    INPUT:  batch, a pointer to a batch.
+    OUTPUT: void
+*/
+void free_batch(Par_batch *batch)
+{
+    for (size_t k = 0; k < BATCH_LINES; k++)
+        free_line_rows(&batch->lines[k].broken);
+    arena_free(&batch->text);
+}
\ No newline at end of file
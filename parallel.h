@@ -0,0 +1,117 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include "processing.h"
+#include "alloc_utils.h"
+#include "io_utils.h"
+
+#define BATCH_LINES 1024 // number of input lines of a batch
+#define CHUNK_ROWS 64    // rows produced by each call of process_one_line in a worker
+
+/*      The struct contains an input line of a batch and the rows it is broken into:
+        char *text - the line as returned by read_one_line, in the arena of the batch.
+        Line_rows broken - the justified rows of the line, its buffers are reused from batch to batch.
+*/
+typedef struct Par_line
+{
+    char *text;
+    Line_rows broken;
+} Par_line;
+
+/*      The struct contains a batch of lines:
+        Par_line lines[] - the lines, BATCH_LINES of them.
+        size_t n_lines - the number of lines actually read.
+        atomic size_t next - the next line to be taken by a worker.
+        size_t done - the number of lines broken so far (protected by the lock of the pool).
+        Arena text - the memory of the lines, reset before the batch is read again.
+*/
+typedef struct Par_batch
+{
+    Par_line lines[BATCH_LINES];
+    size_t n_lines;
+    _Atomic size_t next;
+    size_t done;
+    Arena text;
+} Par_batch;
+
+/*      The struct contains a pool of threads breaking the lines of a batch:
+        pthread_t *threads - the worker threads.
+        int n_threads - the number of workers.
+        int col_width, alloc_width - the width of a column and the width of a row in memory.
+        pthread_mutex_t lock - protects the fields below.
+        pthread_cond_t work - signalled when a batch is submitted or the pool is stopped.
+        pthread_cond_t finished - signalled when all the lines of the batch are broken.
+        Par_batch *batch - the batch being processed, NULL if none.
+        unsigned long generation - incremented for each batch submitted.
+        int active - the number of workers working on the batch.
+        bool stop - tells the workers to terminate.
+        Stage_time layout - the time spent by the workers breaking the lines, when the statistics are enabled.
+*/
+typedef struct Par_pool
+{
+    pthread_t *threads;
+    int n_threads;
+    int col_width;
+    int alloc_width;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    Par_batch *batch;
+    unsigned long generation;
+    int active;
+    bool stop;
+    Stage_time layout;
+} Par_pool;
+
+/*  FUNCTION: start_pool
+    INPUT:  pool, a pointer to the pool to start.
+            n_threads, the number of worker threads.
+            col_width, the width of a column.
+            alloc_width, the width of a row in memory.
+    OUTPUT: void
+
+    Starts the worker threads, which wait for batches to break.
+*/
+void start_pool(Par_pool *pool, int n_threads, int col_width, int alloc_width);
+
+/*  FUNCTION: submit_batch
+    INPUT:  pool, a pointer to a started pool.
+            batch, the batch whose lines must be broken into rows.
+    OUTPUT: void
+
+    Hands the batch to the workers and returns at once. Only one batch at a time can be submitted.
+*/
+void submit_batch(Par_pool *pool, Par_batch *batch);
+
+/*  FUNCTION: wait_batch
+    INPUT:  pool, a pointer to a started pool.
+    OUTPUT: void
+
+    Waits until all the lines of the submitted batch are broken into rows.
+*/
+void wait_batch(Par_pool *pool);
+
+/*  FUNCTION: stop_pool
+    INPUT:  pool, a pointer to a started pool.
+    OUTPUT: void
+
+    Terminates the workers and releases the pool.
+*/
+void stop_pool(Par_pool *pool);
+
+/*  FUNCTION: free_batch
+    INPUT:  batch, a pointer to a batch.
+    OUTPUT: void
+
+    Frees the buffers of the lines of the batch.
+*/
+void free_batch(Par_batch *batch);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,562 @@
+#include "pipeline.h"
+
+/*      The struct contains the arguments of a thread of the pipeline:
+        Pipeline *pl - the pipeline.
+        Pipe_stage first - the first stage run by the thread.
+        pthread_t id - the thread.
+*/
+typedef struct Pipe_thread
+{
+    Pipeline *pl;
+    Pipe_stage first;
+    pthread_t id;
+} Pipe_thread;
+
+/*  FUNCTION: grow_buf
+    INPUT:  b, a buffer.
+            need, the number of bytes required.
+    OUTPUT: void
+
+    Doubles the capacity of the buffer (starting from PIPE_BYTES) until it holds need bytes, the content is kept. If the reallocation fails an error message is printed out and the program exits.
+*/
+static void grow_buf(Pipe_buf *b, size_t need)
+{
+    if (need <= b->cap)
+        return;
+    size_t new_cap = b->cap ? b->cap : PIPE_BYTES;
+    while (new_cap < need)
+        new_cap *= 2;
+    char *tmp = realloc(b->mem, new_cap);
+    if (tmp == NULL)
+    {
+        perror("Error allocating a buffer of the pipeline");
+        exit(EXIT_FAILURE);
+    }
+    stats_alloc();
+    b->mem = tmp;
+    b->cap = new_cap;
+}
+
+/*  FUNCTION: queue_push
+    INPUT:  q, a queue.
+            b, the buffer to append.
+    OUTPUT: void
+
+    Never blocks: a hop has PIPE_DEPTH buffers, so its queues cannot hold more than that.
+*/
+static void queue_push(Pipe_queue *q, Pipe_buf *b)
+{
+    pthread_mutex_lock(&q->lock);
+    q->slot[(q->head + q->count) % PIPE_DEPTH] = b;
+    q->count++;
+    pthread_cond_signal(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*  FUNCTION: queue_pop
+    INPUT:  q, a queue.
+            wait, where the time spent blocked is added, when the statistics are enabled.
+    OUTPUT: the first buffer of the queue, NULL if the queue is closed and empty.
+
+    Blocks while the queue is empty: this is where a stage faster than its neighbours waits for them.
+*/
+static Pipe_buf *queue_pop(Pipe_queue *q, Stage_time *wait)
+{
+    Pipe_buf *b = NULL;
+    pthread_mutex_lock(&q->lock);
+    bool blocked = q->count == 0 && !q->closed && stats != NULL;
+    if (blocked)
+        stage_begin(wait);
+    while (q->count == 0 && !q->closed)
+        pthread_cond_wait(&q->changed, &q->lock);
+    if (blocked)
+        stage_end(wait);
+    if (q->count > 0)
+    {
+        b = q->slot[q->head];
+        q->head = (q->head + 1) % PIPE_DEPTH;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return b;
+}
+
+/*  FUNCTION: queue_close
+    INPUT:  q, a queue.
+    OUTPUT: void
+*/
+static void queue_close(Pipe_queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = true;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/*  FUNCTION: busy_begin
+    INPUT:  pl, a pipeline.
+            s, a stage.
+    OUTPUT: void
+*/
+static void busy_begin(Pipeline *pl, Pipe_stage s)
+{
+    if (stats != NULL)
+        stage_begin(&pl->busy[s]);
+}
+
+/*  FUNCTION: busy_end
+    INPUT:  pl, a pipeline.
+            s, a stage.
+    OUTPUT: void
+*/
+static void busy_end(Pipeline *pl, Pipe_stage s)
+{
+    if (stats != NULL)
+        stage_end(&pl->busy[s]);
+}
+
+/*  FUNCTION: get_buf
+    INPUT:  pl, a pipeline.
+            s, the stage that fills the buffer.
+    OUTPUT: an empty buffer of the hop after the stage.
+
+    Blocks until the next stage gives a buffer back: this bounds the memory and slows down a stage faster than the next one. The time blocked is not counted as work of the stage.
+*/
+static Pipe_buf *get_buf(Pipeline *pl, Pipe_stage s)
+{
+    busy_end(pl, s);
+    Pipe_buf *b = queue_pop(&pl->empty[s], &pl->wait_write[s]);
+    busy_begin(pl, s);
+    b->data = b->mem;
+    b->len = 0;
+    return b;
+}
+
+/*  FUNCTION: release
+    INPUT:  pl, a pipeline.
+            s, the stage that received the buffer.
+            b, the buffer.
+    OUTPUT: void
+
+    Gives the buffer back to the previous stage.
+*/
+static void release(Pipeline *pl, Pipe_stage s, Pipe_buf *b)
+{
+    queue_push(&pl->empty[s - 1], b);
+}
+
+static void handle(Pipeline *pl, Pipe_stage s, Pipe_buf *b);
+
+/*  FUNCTION: pass
+    INPUT:  pl, a pipeline.
+            s, the stage that filled the buffer.
+            b, the buffer.
+    OUTPUT: void
+
+    Hands the buffer over to the next stage: nothing is copied, the next stage owns the buffer until it releases it. If the next stage runs on the same thread it is called directly, otherwise the buffer is queued.
+*/
+static void pass(Pipeline *pl, Pipe_stage s, Pipe_buf *b)
+{
+    if (pl->group[s + 1] == pl->group[s])
+    {
+        busy_end(pl, s);
+        handle(pl, s + 1, b);
+        busy_begin(pl, s);
+    }
+    else
+    {
+        queue_push(&pl->full[s], b);
+    }
+}
+
+/*  FUNCTION: read_input
+    INPUT:  pl, a pipeline.
+    OUTPUT: void
+
+    The input is cut in buffers of about PIPE_BYTES that end at a newline (except the last one), so that no line is split between two buffers. A mapped input is not copied: the buffers point into the mapping. A stream is read into the memory of the buffers, and the unfinished line at the end of a buffer is moved to the start of the next one. The reading stops early if a word larger than a column has been found. If the read fails an error message is printed out and the program exits.
+*/
+static void read_input(Pipeline *pl)
+{
+    In_stream *in = pl->in;
+    busy_begin(pl, PIPE_READ);
+    if (in->map != NULL)
+    {
+        const char *data;
+        size_t left = next_chunk(in, &data); // the whole mapping
+        while (left > 0 && !atomic_load(&pl->failed))
+        {
+            size_t n = left;
+            if (n > PIPE_BYTES)
+            { // extend the buffer to the end of its last line
+                const char *nl = memchr(data + PIPE_BYTES - 1, '\n', left - (PIPE_BYTES - 1));
+                if (nl != NULL)
+                    n = nl - data + 1;
+            }
+            Pipe_buf *b = get_buf(pl, PIPE_READ);
+            b->data = data;
+            b->len = n;
+            data += n;
+            left -= n;
+            pass(pl, PIPE_READ, b);
+        }
+    }
+    else
+    {
+        Pipe_buf *b = get_buf(pl, PIPE_READ);
+        size_t keep = 0; // the bytes of an unfinished line at the start of b
+        while (!atomic_load(&pl->failed))
+        {
+            if (b->cap - keep < PIPE_BYTES / 2)
+                grow_buf(b, keep + PIPE_BYTES);
+            size_t n = fread(b->mem + keep, 1, b->cap - keep, in->fin);
+            if (n == 0 && ferror(in->fin))
+            {
+                perror("read error");
+                exit(EXIT_FAILURE);
+            }
+            if (n == 0)
+                break;
+            size_t len = keep + n;
+            size_t whole = len; // the bytes up to the last newline
+            while (whole > keep && b->mem[whole - 1] != '\n')
+                whole--;
+            if (whole == keep)
+            { // no line ends here, keep reading into the same buffer
+                keep = len;
+                continue;
+            }
+            Pipe_buf *next = get_buf(pl, PIPE_READ);
+            keep = len - whole;
+            if (next->cap < keep + PIPE_BYTES / 2)
+                grow_buf(next, keep + PIPE_BYTES);
+            memcpy(next->mem, b->mem + whole, keep);
+            b->data = b->mem; // the memory may have been reallocated
+            b->len = whole;
+            pass(pl, PIPE_READ, b);
+            b = next;
+        }
+        if (keep > 0) // the last line lacks the newline
+        {
+            b->data = b->mem;
+            b->len = keep;
+            pass(pl, PIPE_READ, b);
+        }
+        else
+        {
+            queue_push(&pl->empty[PIPE_READ], b);
+        }
+    }
+    busy_end(pl, PIPE_READ);
+}
+
+/*  FUNCTION: tokenize_buf
+    INPUT:  pl, a pipeline.
+            b, a buffer of raw lines.
+    OUTPUT: void
+
+    Each line is tokenized into a new buffer as a record: its size (a size_t) followed by the tokenized line. A record has room for the raw line + '\n' + '\0', so that an empty line can become "\n" in place. If a word is larger than a column an error message is printed out, the lines before it are passed on and the following buffers are discarded.
+*/
+static void tokenize_buf(Pipeline *pl, Pipe_buf *b)
+{
+    if (atomic_load(&pl->failed))
+    {
+        release(pl, PIPE_TOKENIZE, b);
+        return;
+    }
+    Pipe_buf *o = get_buf(pl, PIPE_TOKENIZE);
+    const char *p = b->data, *end = b->data + b->len;
+    const char *long_word;
+    size_t long_len;
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t linelen = (nl != NULL) ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+        size_t size = sizeof(size_t) + linelen + 2;
+        warn_long_line(linelen);
+        grow_buf(o, o->len + size);
+        char *rec = o->mem + o->len;
+        int cnt = tokenize_line(p, p + linelen, rec + sizeof(size_t), pl->col_width, &long_word, &long_len);
+        if (cnt < 0)
+        {
+            fprintf(stderr, "ERROR: read a word (%.*s) larger (%lu) than a column (%d), must stop.\n", (int)long_len, long_word, long_len, pl->col_width);
+            atomic_store(&pl->failed, true);
+            break;
+        }
+        memcpy(rec, &size, sizeof(size));
+        o->len += size;
+        stats_line(linelen, cnt);
+        p += linelen;
+    }
+    o->data = o->mem;
+    release(pl, PIPE_TOKENIZE, b);
+    if (o->len > 0)
+        pass(pl, PIPE_TOKENIZE, o);
+    else
+        queue_push(&pl->empty[PIPE_TOKENIZE], o);
+}
+
+/*  FUNCTION: render_page
+    INPUT:  pl, a pipeline.
+    OUTPUT: void
+
+    The rows of the page, up to the first empty one, are appended to the buffer of the pages, each one followed by a newline. A buffer without room for another page is passed to the writer first. The page is then cleared.
+*/
+static void render_page(Pipeline *pl)
+{
+    Page *page = &pl->page;
+    size_t max = (size_t)pl->alloc_n_rows * (pl->alloc_page_width + 1);
+    if (pl->pages != NULL && pl->pages->cap - pl->pages->len < max)
+    {
+        pass(pl, PIPE_LAYOUT, pl->pages);
+        pl->pages = NULL;
+    }
+    if (pl->pages == NULL)
+    {
+        pl->pages = get_buf(pl, PIPE_LAYOUT);
+        grow_buf(pl->pages, max);
+        pl->pages->data = pl->pages->mem;
+    }
+    char *dst = pl->pages->mem + pl->pages->len;
+    for (int i = 0; i < pl->alloc_n_rows && page->len[i] != 0; i++)
+    {
+        memcpy(dst, page_row(page, i), page->len[i]);
+        dst += page->len[i];
+        *dst++ = '\n';
+    }
+    if (stats != NULL && page->len[0] != 0)
+        stats->pages++;
+    pl->pages->len = dst - pl->pages->mem;
+    clear_page(page);
+}
+
+/*  FUNCTION: layout_buf
+    INPUT:  pl, a pipeline.
+            b, a buffer of tokenized lines.
+    OUTPUT: void
+
+    The lines are laid out where they lie in the buffer, as in the loop of the single-process version: every page filled gets the separator and is rendered.
+*/
+static void layout_buf(Pipeline *pl, Pipe_buf *b)
+{
+    char *p = b->mem, *end = b->mem + b->len;
+    while (p < end)
+    {
+        size_t size;
+        memcpy(&size, p, sizeof(size));
+        char *line = p + sizeof(size);
+        p += size;
+        // skip if more than one empty line is found
+        if (process_empty_line(&line, &pl->empty_line, pl->pos_data))
+            continue;
+        pl->pos_data = start_line(pl->pos_data, line);
+        // fill pages until there are words in the line
+        while (*pl->pos_data.line_ptr != '\0')
+        {
+            pl->pos_data = process_one_line(pl->n_cols, pl->col_width, pl->n_rows, pl->spacing, &pl->page, pl->pos_data);
+            if (pl->pos_data.i == 0 && pl->pos_data.j == 0)
+            { // the page is ended: add the separator and render it
+                set_row(&pl->page, pl->n_rows, NEW_PAGE);
+                render_page(pl);
+            }
+        }
+    }
+    release(pl, PIPE_LAYOUT, b);
+}
+
+/*  FUNCTION: finish_layout
+    INPUT:  pl, a pipeline.
+    OUTPUT: void
+
+    Renders the last page, unless the text was stopped by a word larger than a column, and passes the pages still buffered to the writer.
+*/
+static void finish_layout(Pipeline *pl)
+{
+    busy_begin(pl, PIPE_LAYOUT);
+    if (!atomic_load(&pl->failed) && pl->page.len[0] != 0)
+        render_page(pl);
+    if (pl->pages != NULL)
+    {
+        if (pl->pages->len > 0)
+            pass(pl, PIPE_LAYOUT, pl->pages);
+        else
+            queue_push(&pl->empty[PIPE_LAYOUT], pl->pages);
+        pl->pages = NULL;
+    }
+    busy_end(pl, PIPE_LAYOUT);
+}
+
+/*  FUNCTION: write_buf
+    INPUT:  pl, a pipeline.
+            b, a buffer of pages.
+    OUTPUT: void
+*/
+static void write_buf(Pipeline *pl, Pipe_buf *b)
+{
+    out_write(pl->out, b->data, b->len);
+    release(pl, PIPE_WRITE, b);
+}
+
+/*  FUNCTION: handle
+    INPUT:  pl, a pipeline.
+            s, the stage receiving the buffer (not PIPE_READ).
+            b, the buffer.
+    OUTPUT: void
+*/
+static void handle(Pipeline *pl, Pipe_stage s, Pipe_buf *b)
+{
+    busy_begin(pl, s);
+    if (s == PIPE_TOKENIZE)
+        tokenize_buf(pl, b);
+    else if (s == PIPE_LAYOUT)
+        layout_buf(pl, b);
+    else
+        write_buf(pl, b);
+    busy_end(pl, s);
+}
+
+/*  FUNCTION: run_group
+    INPUT:  arg, a pointer to a Pipe_thread.
+    OUTPUT: NULL
+
+    Runs the stages of a thread: the first one takes its buffers from the queue of the previous thread (or reads the input) and the others are called by pass. When the queue is closed the stages are finished in order and the queue of the next thread is closed.
+*/
+static void *run_group(void *arg)
+{
+    Pipeline *pl = ((Pipe_thread *)arg)->pl;
+    Pipe_stage s = ((Pipe_thread *)arg)->first;
+    if (s == PIPE_READ)
+    {
+        read_input(pl);
+    }
+    else
+    {
+        Pipe_buf *b;
+        while ((b = queue_pop(&pl->full[s - 1], &pl->wait_read[s])) != NULL)
+            handle(pl, s, b);
+    }
+    for (; s < PIPE_WRITE; s++)
+    {
+        if (s == PIPE_LAYOUT)
+            finish_layout(pl);
+        if (pl->group[s + 1] != pl->group[s])
+        {
+            queue_close(&pl->full[s]);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*  FUNCTION: parse_stages
+    INPUT:  spec, the threads of the pipeline: comma separated groups of the letters r (read), t (tokenize), l (layout) and w (write), e.g. "rt,l,w".
+            group, where the thread of each stage is stored.
+    OUTPUT: the number of threads, or -1 if spec does not list the four stages once and in order.
+*/
+int parse_stages(const char *spec, int group[N_PIPE_STAGES])
+{
+    static const char letters[] = "rtlw";
+    int s = 0, g = 0;
+    bool empty_group = true;
+    for (const char *c = spec; *c != '\0'; c++)
+    {
+        if (*c == ',')
+        {
+            if (empty_group)
+                return -1;
+            g++;
+            empty_group = true;
+        }
+        else if (s < N_PIPE_STAGES && *c == letters[s])
+        {
+            group[s++] = g;
+            empty_group = false;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+    return (s == N_PIPE_STAGES && !empty_group) ? g + 1 : -1;
+}
+
+/*  FUNCTION: run_pipeline
+    INPUT:  in, the input source.
+            out, the output buffer.
+            group, the thread of each stage, as returned by parse_stages.
+            n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width, the layout of the page.
+    OUTPUT: 0 on success, -1 if a word larger than a column was found.
+
+    Each hop starts with PIPE_DEPTH empty buffers, which then go around between its two stages. The thread of the writer is the calling thread, the others are created here. Once all of them are done, the time of each stage is added to the statistics of the process: reading and tokenizing as read, the blocked time of all the stages as blocked reading and writing. If a thread cannot be created an error message is printed out and the program exits.
+*/
+int run_pipeline(In_stream *in, Out_stream *out, const int group[N_PIPE_STAGES], int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width)
+{
+    Pipeline *pl = calloc(1, sizeof(*pl));
+    if (pl == NULL)
+    {
+        perror("Error allocating the pipeline");
+        exit(EXIT_FAILURE);
+    }
+    pl->in = in;
+    pl->out = out;
+    pl->n_cols = n_cols;
+    pl->n_rows = n_rows;
+    pl->spacing = spacing;
+    pl->col_width = col_width;
+    pl->alloc_n_rows = alloc_n_rows;
+    pl->alloc_page_width = alloc_page_width;
+    memcpy(pl->group, group, sizeof(pl->group));
+    pl->n_groups = group[PIPE_WRITE] + 1;
+    pl->page = alloc_page(alloc_n_rows, alloc_page_width);
+    pl->pos_data = (Pr_data){.line_ptr = NULL, .i = 0, .j = 0};
+    for (int h = 0; h < N_PIPE_STAGES - 1; h++)
+    {
+        pthread_mutex_init(&pl->full[h].lock, NULL);
+        pthread_cond_init(&pl->full[h].changed, NULL);
+        pthread_mutex_init(&pl->empty[h].lock, NULL);
+        pthread_cond_init(&pl->empty[h].changed, NULL);
+        for (int k = 0; k < PIPE_DEPTH; k++)
+            queue_push(&pl->empty[h], &pl->bufs[h][k]);
+    }
+
+    // one thread for each group, the first stage of a group follows a change of group
+    Pipe_thread threads[N_PIPE_STAGES];
+    int n = 0;
+    for (int s = 0; s < N_PIPE_STAGES; s++)
+        if (s == 0 || group[s] != group[s - 1])
+            threads[n++] = (Pipe_thread){.pl = pl, .first = s};
+    for (int t = 0; t < n - 1; t++)
+    {
+        if ((errno = pthread_create(&threads[t].id, NULL, run_group, &threads[t])) != 0)
+        {
+            perror("Error creating a thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    run_group(&threads[n - 1]);
+    for (int t = 0; t < n - 1; t++)
+        pthread_join(threads[t].id, NULL);
+
+    stats_add(STAGE_READ, &pl->busy[PIPE_READ]);
+    stats_add(STAGE_READ, &pl->busy[PIPE_TOKENIZE]);
+    stats_add(STAGE_LAYOUT, &pl->busy[PIPE_LAYOUT]);
+    stats_add(STAGE_OUTPUT, &pl->busy[PIPE_WRITE]);
+    for (int s = 0; s < N_PIPE_STAGES; s++)
+    {
+        stats_add(STAGE_WAIT_READ, &pl->wait_read[s]);
+        stats_add(STAGE_WAIT_WRITE, &pl->wait_write[s]);
+    }
+
+    int ret = atomic_load(&pl->failed) ? -1 : 0;
+    for (int h = 0; h < N_PIPE_STAGES - 1; h++)
+    {
+        for (int k = 0; k < PIPE_DEPTH; k++)
+            free(pl->bufs[h][k].mem);
+        pthread_mutex_destroy(&pl->full[h].lock);
+        pthread_cond_destroy(&pl->full[h].changed);
+        pthread_mutex_destroy(&pl->empty[h].lock);
+        pthread_cond_destroy(&pl->empty[h].changed);
+    }
+    free_page(&pl->page);
+    free(pl);
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include "io_utils.h"
+#include "processing.h"
+#include "alloc_utils.h"
+#include "stats.h"
+
+#define PIPE_BYTES (1 << 18) // bytes of input, of tokenized lines or of pages carried by a buffer
+#define PIPE_DEPTH 4         // buffers between two stages
+
+/*      The stages of the pipeline, in order:
+        PIPE_READ - reads the input in buffers ending at a newline.
+        PIPE_TOKENIZE - tokenizes the lines of a buffer.
+        PIPE_LAYOUT - lays out the tokenized lines on the pages and renders the pages as text.
+        PIPE_WRITE - writes the pages.
+*/
+typedef enum Pipe_stage
+{
+    PIPE_READ,
+    PIPE_TOKENIZE,
+    PIPE_LAYOUT,
+    PIPE_WRITE,
+    N_PIPE_STAGES
+} Pipe_stage;
+
+/*      The struct contains a buffer passed from a stage to the next one:
+        char *mem - the memory owned by the buffer.
+        size_t cap - the capacity of mem.
+        const char *data - the data carried, in mem or (for a memory-mapped input) in the mapping.
+        size_t len - the number of bytes of data.
+*/
+typedef struct Pipe_buf
+{
+    char *mem;
+    size_t cap;
+    const char *data;
+    size_t len;
+} Pipe_buf;
+
+/*      The struct contains a bounded queue of buffers:
+        Pipe_buf *slot[] - the buffers queued, PIPE_DEPTH at most.
+        int head, count - the position of the first buffer and the number of buffers.
+        bool closed - set when no more buffers will be pushed.
+        pthread_mutex_t lock - protects the fields above.
+        pthread_cond_t changed - signalled when a buffer is pushed or popped, or the queue is closed.
+*/
+typedef struct Pipe_queue
+{
+    Pipe_buf *slot[PIPE_DEPTH];
+    int head, count;
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Pipe_queue;
+
+/*      The struct contains the state of a pipeline:
+        In_stream *in, Out_stream *out - the input and the output.
+        int n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width - the layout of the page.
+        int group[] - the thread running each stage, consecutive stages of the same thread call each other directly.
+        int n_groups - the number of threads.
+        Pipe_buf bufs[][] - the buffers of each hop (from a stage to the next one), PIPE_DEPTH of them.
+        Pipe_queue full[], empty[] - for each hop, the buffers carrying data to the next stage and the ones given back to the stage that fills them.
+        Page page, Pr_data pos_data, bool empty_line - the state of the layout.
+        Pipe_buf *pages - the buffer where the layout renders the pages, NULL if none.
+        atomic bool failed - set when a word larger than a column is found, the stages stop reading.
+        Stage_time busy[], wait_read[], wait_write[] - the time each stage spent working and blocked on the queues, when the statistics are enabled.
+*/
+typedef struct Pipeline
+{
+    In_stream *in;
+    Out_stream *out;
+    int n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width;
+    int group[N_PIPE_STAGES];
+    int n_groups;
+    Pipe_buf bufs[N_PIPE_STAGES - 1][PIPE_DEPTH];
+    Pipe_queue full[N_PIPE_STAGES - 1];
+    Pipe_queue empty[N_PIPE_STAGES - 1];
+    Page page;
+    Pr_data pos_data;
+    bool empty_line;
+    Pipe_buf *pages;
+    _Atomic bool failed;
+    Stage_time busy[N_PIPE_STAGES];
+    Stage_time wait_read[N_PIPE_STAGES];
+    Stage_time wait_write[N_PIPE_STAGES];
+} Pipeline;
+
+/*  FUNCTION: parse_stages
+    INPUT:  spec, the threads of the pipeline: comma separated groups of the letters r (read), t (tokenize), l (layout) and w (write), e.g. "rt,l,w".
+            group, where the thread of each stage is stored.
+    OUTPUT: the number of threads, or -1 if spec does not list the four stages once and in order.
+*/
+int parse_stages(const char *spec, int group[N_PIPE_STAGES]);
+
+/*  FUNCTION: run_pipeline
+    INPUT:  in, the input source.
+            out, the output buffer.
+            group, the thread of each stage, as returned by parse_stages.
+            n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width, the layout of the page.
+    OUTPUT: 0 on success, -1 if a word larger than a column was found (the error message has been printed out and the pages completed before it have been written to out).
+
+    Lays out the text with the stages running on their threads, connected by bounded queues. The output is the same as the single-process version.
+*/
+int run_pipeline(In_stream *in, Out_stream *out, const int group[N_PIPE_STAGES], int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width);
+
+#endif
\ No newline at end of file
@@ -17,18 +17,11 @@ bool is_ascii(unsigned char c)
    INPUT: character array str
    OUTPUT: integer value of data type size_t.
    
-   This funcion calculates the length of a string in terms of ASCII characters (i.e., the number of characters shown).
+   This funcion calculates the length of a string in terms of ASCII characters (i.e., the number of characters shown). The bytes that are not UTF-8 continuation bytes are counted by the vectorised utf8_width kernel.
  */
 size_t strdisplen(const char *str)
 {
-    int i = 0, cnt = 0;
-    while (str[i] != '\0')
-    {
-        if (is_ascii(str[i]))
-            cnt++;
-        i++;
-    }
-    return cnt;
+    return utf8_width(str, str + strlen(str));
 }
 
 /* FUNCTION: fill_with_char
@@ -45,40 +38,60 @@ char *fill_with_char(char *str, char c, size_t n)
     return str;
 }
 
+/*  FUNCTION: start_line
+    INPUT: a Pr_data struct which stores the current position
+           the line to be processed
+    OUTPUT: the pos_data struct pointing to the beginning of the line.
+
+    The function stores the beginning and the end of the line and checks once for the whole line whether it is pure ASCII, so that process_one_line can measure the columns with plain length arithmetic.
+*/
+Pr_data start_line(Pr_data pos_data, char *line)
+{
+    pos_data.line_ptr = line;
+    pos_data.line_end = line + strlen(line);
+    pos_data.line_stop = NULL;
+    pos_data.ascii = is_ascii_text(line, pos_data.line_end);
+    return pos_data;
+}
+
 /*  FUNCTION: process_one_line
     INPUT: the number of columns
            the width of the columns
            the number of rows
            the spacing between the columns
-           an array of output lines
+           the page where the rows are written
            a Pr_data struct which stores the current position.
     OUTPUT: returns the pos_data struct after processing the current line. This struct is used to keep track of the
             current position when processing a line longer than a page.
 
-    This function processes the input line in pos_data.line_ptr and formats the text according to the given column width. The formatted line is then appended to the current row of the out_lines array.
+    This function processes the input line in pos_data.line_ptr and formats the text according to the given column width. The formatted line is then appended to the current row of the page.
+
+    The rows of the page are not null terminated, the length of each row is kept in the page, so appending a piece of a column costs only the copy of the piece.
 
     The function uses two nested loops to process all lines and columns. For each column and each line, it computes the number of words and spaces in the incoming string, and based on this information, it makes the necessary adjustments to justify the text. If the line does not fill the whole column, it pads it with spaces until the end of the column is reached.
 */
 
-Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, char **out_lines, Pr_data pos_data)
+Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, Page *page, Pr_data pos_data)
 {
     for (int j = pos_data.j; j < n_cols; j++)
     {
         for (int i = pos_data.i; i < n_rows; i++)
         {
+            char *row = page_row(page, i); // the row, page->len[i] bytes are already used
             char *ln_ptr = pos_data.line_ptr;
             int space_cnt = 0;
             int word_cnt = 0;
             int char_cnt = 0;
-            while (*ln_ptr != '\0' && char_cnt < col_width)
+            /* advance ln_ptr counting the spaces passed and the characters (i.e. the bytes that do not begin with 10) reached, the terminating '\0' included. Since each byte is at most one character, the next col_width - char_cnt bytes can be taken in one go: for ASCII lines this is exact, otherwise the bytes are measured by the vectorised kernel and the step is repeated for the characters still missing.
+            */
+            while (ln_ptr < pos_data.line_end && char_cnt < col_width)
             {
-                if (*ln_ptr == ' ')
-                {
-                    space_cnt++;
-                }
-                ln_ptr++;
-                if (is_ascii(*ln_ptr))
-                    char_cnt++; // do not increment if the byte do not begins with 10
+                size_t step = pos_data.line_end - ln_ptr;
+                if (step > col_width - char_cnt)
+                    step = col_width - char_cnt;
+                space_cnt += count_byte(ln_ptr, ln_ptr + step, ' ');
+                char_cnt += pos_data.ascii ? step : utf8_width(ln_ptr + 1, ln_ptr + step + 1);
+                ln_ptr += step;
             }
             /* ln_ptr at the end points \0 or one character beyond the max width of the column.
 
@@ -89,14 +102,19 @@ Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, cha
                 // check not to be in the first line of a column so as not to add the empty line due to \n or not to be left with an empty string in case it is exactly multiple of the column size.
                 if ((i != 0 || strcmp(pos_data.line_ptr, "\n") != 0) && strcmp(pos_data.line_ptr, "") != 0)
                 {
-                    // append the remainder of the paragraph to the current line, strcat is safe because we have already seen that line is shorter than the column and therefore it will necessarily be shorter than the allocated row
-                    strcat(out_lines[i], pos_data.line_ptr);
+                    // append the remainder of the paragraph to the current line, the copy is safe because we have already seen that line is shorter than the column and therefore it will necessarily be shorter than the allocated row
+                    memcpy(row + page->len[i], pos_data.line_ptr, ln_ptr - pos_data.line_ptr);
+                    page->len[i] += ln_ptr - pos_data.line_ptr;
 
                     // the -1 is to remove '\n'
-                    fill_with_char(out_lines[i] + strlen(out_lines[i]) - 1, ' ', col_width - char_cnt + 1);
+                    memset(row + page->len[i] - 1, ' ', col_width - char_cnt + 1);
+                    page->len[i] += col_width - char_cnt;
                     // if not in the last column add the space between the columns
                     if (j != n_cols - 1)
-                        fill_with_char(out_lines[i] + strlen(out_lines[i]), ' ', spacing);
+                    {
+                        memset(row + page->len[i], ' ', spacing);
+                        page->len[i] += spacing;
+                    }
 
                     // before returning, identify the point from which to resume with the new line
                     if (i < n_rows - 1)
@@ -125,11 +143,13 @@ Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, cha
             */
             if (((*ln_ptr == ' ' || *ln_ptr == '\n')) && (*(ln_ptr - 1) != ' '))
             {
-                strncat(out_lines[i], pos_data.line_ptr, ln_ptr - pos_data.line_ptr);
+                memcpy(row + page->len[i], pos_data.line_ptr, ln_ptr - pos_data.line_ptr);
+                page->len[i] += ln_ptr - pos_data.line_ptr;
                 pos_data.line_ptr = ln_ptr + 1; // restart from the character after the space or \n (in the latter case it will be \0)
                 if (j < n_cols - 1)
                 {
-                    fill_with_char(out_lines[i] + strlen(out_lines[i]), ' ', spacing);
+                    memset(row + page->len[i], ' ', spacing);
+                    page->len[i] += spacing;
                 }
                 continue; // go to the next row
             }
@@ -160,7 +180,7 @@ Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, cha
 
             // copy the string inserting the spaces in the right place
             char_cnt = 0;
-            char *dst = out_lines[i] + strlen(out_lines[i]); // copy the characters from the end of the already stored string
+            char *dst = row + page->len[i]; // copy the characters from the end of the already stored string
             for (int iw = 0; iw < word_cnt - 1; iw++)
             {
                 while ((*dst++ = *pos_data.line_ptr++) != ' ')
@@ -183,11 +203,12 @@ Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, cha
                 memset(dst, ' ', col_width - char_cnt);
                 dst += col_width - char_cnt;
             }
-            memset(dst, '\0', 1);
             if (j < n_cols - 1) // if it's not the last column add spaces between columns
             {
-                fill_with_char(dst, ' ', spacing);
+                memset(dst, ' ', spacing);
+                dst += spacing;
             }
+            page->len[i] = dst - row;
         }
         pos_data.i = 0; // after the first loop it must restart from 0
     }
@@ -198,6 +219,317 @@ Pr_data process_one_line(int n_cols, int col_width, int n_rows, int spacing, cha
     return pos_data;
 }
 
+/*  FUNCTION: skip_one_line
+    INPUT: n_cols, the number of columns
+           col_width, the width of the columns
+           n_rows, the number of rows
+           pos_data, the current position
+    OUTPUT: the position after the current line, as process_one_line would return it.
+
+    The rows are measured as in process_one_line and the three cases are the same, but only the position moves: a row ending with a whole word resumes after it, a row ending in the middle of a word resumes after the last space of the row. It stops at pos_data.line_stop as span_one_line does.
+*/
+Pr_data skip_one_line(int n_cols, int col_width, int n_rows, Pr_data pos_data)
+{
+    for (int j = pos_data.j; j < n_cols; j++)
+    {
+        for (int i = pos_data.i; i < n_rows; i++)
+        {
+            if (pos_data.line_stop != NULL && pos_data.line_ptr >= pos_data.line_stop) // wait for the rest of the line
+            {
+                pos_data.i = i, pos_data.j = j;
+                return pos_data;
+            }
+            char *ln_ptr = pos_data.line_ptr;
+            int char_cnt = 0;
+            while (ln_ptr < pos_data.line_end && char_cnt < col_width)
+            {
+                size_t step = pos_data.line_end - ln_ptr;
+                if (step > col_width - char_cnt)
+                    step = col_width - char_cnt;
+                char_cnt += pos_data.ascii ? step : utf8_width(ln_ptr + 1, ln_ptr + step + 1);
+                ln_ptr += step;
+            }
+
+            // 1. the paragraph is ended
+            if (*ln_ptr == '\0')
+            {
+                if ((i != 0 || strcmp(pos_data.line_ptr, "\n") != 0) && strcmp(pos_data.line_ptr, "") != 0)
+                {
+                    if (i < n_rows - 1)
+                        pos_data.i = i + 1, pos_data.j = j;
+                    else if (j < n_cols - 1)
+                        pos_data.i = 0, pos_data.j = j + 1;
+                    else
+                        pos_data.i = 0, pos_data.j = 0;
+                }
+                else
+                {
+                    pos_data.i = i, pos_data.j = j;
+                }
+                pos_data.line_ptr = ln_ptr;
+                return pos_data;
+            }
+
+            // 2. the row ends with a whole word
+            if (((*ln_ptr == ' ' || *ln_ptr == '\n')) && (*(ln_ptr - 1) != ' '))
+            {
+                pos_data.line_ptr = ln_ptr + 1;
+                continue;
+            }
+
+            // 3. the last word does not fit: the row ends at the previous space
+            ln_ptr--;
+            while (*ln_ptr != ' ')
+                ln_ptr--;
+            pos_data.line_ptr = ln_ptr + 1;
+        }
+        pos_data.i = 0;
+    }
+
+    pos_data.i = 0;
+    pos_data.j = 0;
+    return pos_data;
+}
+
+/*  FUNCTION: set_span
+    INPUT: page, a page
+           i, j, the row and the column
+           k, the piece of the column (0 or 1)
+           off, len, the text of the piece
+           gap, the number of spaces written for each space of the text
+           n_gaps, the number of spaces in the text
+           pad, the number of spaces after the text
+    OUTPUT: void
+*/
+static void set_span(Span_page *page, int i, int j, int k, size_t off, size_t len, unsigned gap, int n_gaps, unsigned pad)
+{
+    page->spans[2 * (i * page->n_cols + j) + k] = (Span){.off = off, .len = len, .gap = gap, .pad = pad};
+    page->bytes += len + (size_t)n_gaps * (gap - 1) + pad;
+    page->n_filled[i] = j + 1;
+}
+
+/*  FUNCTION: span_one_line
+    INPUT: n_cols, the number of columns
+           col_width, the width of the columns
+           n_rows, the number of rows
+           spacing, the spacing between the columns
+           page, the page where the pieces of the rows are recorded
+           text, the buffer the line is in
+           pos_data, the current position
+    OUTPUT: the position after the current line, as process_one_line would return it.
+
+    The rows are measured and the three cases handled as in process_one_line, but a row is recorded instead of written:
+    1. the end of the paragraph is its remaining words, padded with spaces up to the width of the column;
+    2. a row ending with a whole word is its words as they are in the line;
+    3. a justified row is its words but the last, each of their spaces widened to the space between the words, followed by the extra space and by the last word. A single word is padded with spaces.
+    In every case the spaces between the columns are added to the padding of the last piece. If pos_data.line_stop is set the function returns as soon as a row would start from it, with the position of that row.
+*/
+Pr_data span_one_line(int n_cols, int col_width, int n_rows, int spacing, Span_page *page, const char *text, Pr_data pos_data)
+{
+    for (int j = pos_data.j; j < n_cols; j++)
+    {
+        int sep = (j < n_cols - 1) ? spacing : 0; // the spaces after the column
+        for (int i = pos_data.i; i < n_rows; i++)
+        {
+            if (pos_data.line_stop != NULL && pos_data.line_ptr >= pos_data.line_stop) // wait for the rest of the line
+            {
+                pos_data.i = i, pos_data.j = j;
+                return pos_data;
+            }
+            char *ln_ptr = pos_data.line_ptr;
+            size_t off = pos_data.line_ptr - text;
+            int space_cnt = 0;
+            int char_cnt = 0;
+            while (ln_ptr < pos_data.line_end && char_cnt < col_width)
+            {
+                size_t step = pos_data.line_end - ln_ptr;
+                if (step > col_width - char_cnt)
+                    step = col_width - char_cnt;
+                space_cnt += count_byte(ln_ptr, ln_ptr + step, ' ');
+                char_cnt += pos_data.ascii ? step : utf8_width(ln_ptr + 1, ln_ptr + step + 1);
+                ln_ptr += step;
+            }
+
+            // 1. the paragraph is ended: its rest without the '\n', padded to the width of the column
+            if (*ln_ptr == '\0')
+            {
+                if ((i != 0 || strcmp(pos_data.line_ptr, "\n") != 0) && strcmp(pos_data.line_ptr, "") != 0)
+                {
+                    set_span(page, i, j, 0, off, ln_ptr - pos_data.line_ptr - 1, 1, 0, col_width - char_cnt + 1 + sep);
+                    set_span(page, i, j, 1, 0, 0, 1, 0, 0);
+                    if (i < n_rows - 1)
+                        pos_data.i = i + 1, pos_data.j = j;
+                    else if (j < n_cols - 1)
+                        pos_data.i = 0, pos_data.j = j + 1;
+                    else
+                        pos_data.i = 0, pos_data.j = 0;
+                }
+                else
+                {
+                    pos_data.i = i, pos_data.j = j;
+                }
+                pos_data.line_ptr = ln_ptr;
+                return pos_data;
+            }
+
+            // 2. the row ends with a whole word, the text is already justified
+            if (((*ln_ptr == ' ' || *ln_ptr == '\n')) && (*(ln_ptr - 1) != ' '))
+            {
+                set_span(page, i, j, 0, off, ln_ptr - pos_data.line_ptr, 1, 0, sep);
+                set_span(page, i, j, 1, 0, 0, 1, 0, 0);
+                pos_data.line_ptr = ln_ptr + 1;
+                continue;
+            }
+
+            // 3. the last word does not fit: the row ends at the previous space and the spaces are spread between the words
+            int word_cnt = space_cnt;
+            ln_ptr--;
+            while (*ln_ptr != ' ')
+            {
+                if (is_ascii(*ln_ptr))
+                    space_cnt++;
+                ln_ptr--;
+            }
+            int spc_bw = 1;
+            if (word_cnt > 1)
+                spc_bw = space_cnt / (word_cnt - 1);
+            int spc_ex = 0;
+            if (word_cnt > 1)
+                spc_ex = space_cnt % (word_cnt - 1);
+
+            const char *last = ln_ptr; // the beginning of the last word of the row
+            while (last > pos_data.line_ptr && *(last - 1) != ' ')
+                last--;
+            if (word_cnt == 1) // just one word, left align
+            {
+                set_span(page, i, j, 0, off, ln_ptr - pos_data.line_ptr, 1, 0, col_width - (ln_ptr - pos_data.line_ptr) + sep);
+                set_span(page, i, j, 1, 0, 0, 1, 0, 0);
+            }
+            else
+            {
+                set_span(page, i, j, 0, off, last - 1 - pos_data.line_ptr, spc_bw, word_cnt - 2, spc_bw + spc_ex);
+                set_span(page, i, j, 1, last - text, ln_ptr - last, 1, 0, sep);
+            }
+            pos_data.line_ptr = ln_ptr + 1;
+        }
+        pos_data.i = 0;
+    }
+
+    pos_data.i = 0;
+    pos_data.j = 0;
+    return pos_data;
+}
+
+/*  FUNCTION: span_row
+    INPUT: n_cols, the number of columns
+           n_rows, the number of rows
+           spacing, the spacing between the columns
+           page, the page where the pieces of the rows are recorded
+           pos_data, the current position
+           off, len, the row in the buffer the page refers to
+           pad, the number of spaces after the row
+    OUTPUT: the next position.
+*/
+Pr_data span_row(int n_cols, int n_rows, int spacing, Span_page *page, Pr_data pos_data, size_t off, size_t len, int pad)
+{
+    int sep = (pos_data.j != n_cols - 1) ? spacing : 0;
+    set_span(page, pos_data.i, pos_data.j, 0, off, len, 1, 0, pad + sep);
+    set_span(page, pos_data.i, pos_data.j, 1, 0, 0, 1, 0, 0);
+
+    if (pos_data.i < n_rows - 1)
+        pos_data.i++;
+    else if (pos_data.j < n_cols - 1)
+        pos_data.i = 0, pos_data.j++;
+    else
+        pos_data.i = 0, pos_data.j = 0;
+    return pos_data;
+}
+
+/*  FUNCTION: render_span_page
+    INPUT: page, the page
+           text, the buffer the page refers to
+           last_row, the row added after the last one, NULL for none
+           dst, where the rows are written
+    OUTPUT: the number of bytes written.
+
+    Every piece is copied straight from the buffer: a piece whose spaces are not widened is a single memcpy, otherwise its words are copied one by one with the spaces between them.
+*/
+size_t render_span_page(const Span_page *page, const char *text, const char *last_row, char *dst)
+{
+    char *start = dst;
+    for (int i = 0; i < page->n_rows && page->n_filled[i] != 0; i++)
+    {
+        const Span *s = &page->spans[2 * i * page->n_cols];
+        for (int k = 0; k < 2 * page->n_filled[i]; k++, s++)
+        {
+            const char *p = text + s->off, *end = p + s->len;
+            if (s->gap != 1)
+            {
+                const char *space;
+                while ((space = memchr(p, ' ', end - p)) != NULL)
+                {
+                    memcpy(dst, p, space - p);
+                    dst += space - p;
+                    memset(dst, ' ', s->gap);
+                    dst += s->gap;
+                    p = space + 1;
+                }
+            }
+            memcpy(dst, p, end - p);
+            dst += end - p;
+            memset(dst, ' ', s->pad);
+            dst += s->pad;
+        }
+        *dst++ = '\n';
+    }
+    if (last_row != NULL)
+    {
+        size_t len = strlen(last_row);
+        memcpy(dst, last_row, len);
+        dst += len;
+        *dst++ = '\n';
+    }
+    return dst - start;
+}
+
+/*  FUNCTION: place_row
+    INPUT: the number of columns
+           the number of rows
+           the spacing between the columns
+           the page where the rows are written
+           a Pr_data struct which stores the current position
+           a row of a column, as produced by process_one_line on a page with a single column
+           the length in bytes of the row
+    OUTPUT: the pos_data struct pointing to the next position.
+
+    The row is copied at the end of the current row of the page followed, if it is not in the last column, by the spaces between the columns. Then the position moves to the next row, to the top of the next column or, if the page is ended, to 0,0.
+*/
+Pr_data place_row(int n_cols, int n_rows, int spacing, Page *page, Pr_data pos_data, const char *row, size_t len)
+{
+    char *dst = page_row(page, pos_data.i) + page->len[pos_data.i];
+    memcpy(dst, row, len);
+    page->len[pos_data.i] += len;
+    if (pos_data.j != n_cols - 1)
+    {
+        memset(dst + len, ' ', spacing);
+        page->len[pos_data.i] += spacing;
+    }
+
+    if (pos_data.i < n_rows - 1)
+    { // go to the next line
+        pos_data.i++;
+    }
+    else if (pos_data.j < n_cols - 1)
+    { // if reached the last row and not in the last column go to the next column
+        pos_data.i = 0, pos_data.j++;
+    }
+    else
+    { // the page is ended, restart from 0
+        pos_data.i = 0, pos_data.j = 0;
+    }
+    return pos_data;
+}
+
 /* FUNCTION copy_word
    INPUT: a pointer to a destination character array (dst)
           a pointer to a source character array (src).
@@ -210,3 +542,186 @@ void copy_word(char *dst, char *src)
         ;
     *dst = '\0';
 }
+
+/* FUNCTION: process_empty_line
+ * INPUT:   a pointer to a pointer of char (char** line), the line to be checked
+            a pointer to a boolean (bool* empty_line), whether an empty line has been already found
+            a struct Pr_data (struct Pr_data pos_data), the position on the page (to determine whether the line is the  frirst of a page)
+ * OUTPUT:  boolean value. If the line is empty and it is not the firts time an empty line is found, the function
+            returns true (indicating that the line should be discarded). Otherwise, it returns false. In any case the functon updates the value of *empty_line to match what it has found.
+ */
+bool process_empty_line(char **line, bool *empty_line, Pr_data pos_data)
+{
+    if (**line == '\0')
+    { // if this is the first time that reads an empty row and it is not the first row of a page
+        if (!*empty_line && !(pos_data.i == 0 && pos_data.j == 0))
+        {
+            strcpy(*line, "\n"); // newline whill become a row of spaces
+            *empty_line = true;
+        }
+        else
+        { // tell the caller to discard duplicate empty lines
+            return true;
+        }
+    }
+    else
+    {
+        *empty_line = false;
+    }
+
+    return false;
+}
+
+/*  FUNCTION: fix_utf8
+    INPUT: word, a word copied on the output
+           n, the number of bytes of the word
+    OUTPUT: void
+
+    The width of a word is the number of its bytes that are not UTF-8 continuation bytes, so a run of continuation bytes would be as wide as nothing and the rows, sized for at most UTF8_MAX_BYTES bytes per character, could not hold it. Every continuation byte beyond the third after another byte, or at the start of the word, is replaced by '?': valid UTF-8 is left as it is.
+*/
+static void fix_utf8(char *word, size_t n)
+{
+    int run = UTF8_MAX_BYTES - 1; // the continuation bytes since the last other byte, a word cannot start with one
+    for (size_t k = 0; k < n; k++)
+    {
+        if (((unsigned char)word[k] & 0xC0) != 0x80)
+            run = 0;
+        else if (++run >= UTF8_MAX_BYTES)
+            word[k] = '?';
+    }
+}
+
+/*  FUNCTION: tokenize_line
+    INPUT: line, the raw line (not null terminated)
+           end, the end of the raw line
+           out, the string where the processed line is written, at least 2 bytes longer than the raw line
+           col_width, the width of a column
+           long_word, where to store the first word larger than a column
+           long_len, where to store the length of that word
+    OUTPUT: the number of words of the line, or -1 if a word is larger than a column.
+
+    The line is tokenized in a single pass: skip_blanks and find_blank (vectorised where the CPU allows it) delimit each word, which is checked against the column width and copied right after the previous one, followed by a single space. A running cursor keeps the end of the output, so the cost is linear in the length of the line. Lines without words are empty lines. The function does not allocate nor print anything, what to do with a word too large is up to the caller.
+
+    In a line that is not all ASCII the runs of continuation bytes are cut by fix_utf8, so that no character takes more than UTF8_MAX_BYTES bytes, as row_capacity assumes, whatever the input.
+*/
+int tokenize_line(const char *line, const char *end, char *out, int col_width, const char **long_word, size_t *long_len)
+{
+    int cnt = 0;
+    bool ascii = is_ascii_text(line, end);
+    const char *pline = skip_blanks(line, end);
+    char *dst = out; // running cursor on the output
+    while (pline != end)
+    {
+        const char *word_end = find_blank(pline, end);
+        size_t n = word_end - pline;
+        if (n > col_width)
+        {
+            *long_word = pline;
+            *long_len = n;
+            return -1;
+        }
+        memcpy(dst, pline, n);
+        if (!ascii)
+            fix_utf8(dst, n);
+        dst += n;
+        *dst++ = ' ';
+        cnt++;
+        pline = skip_blanks(word_end, end);
+    }
+    // replace the last space with the newline character
+    if (cnt > 0)
+        *(dst - 1) = '\n';
+    *dst = '\0';
+
+    return cnt;
+}
+
+/*  FUNCTION: grow_rows
+    INPUT: buf, pointer to the buffer to grow
+           cap, pointer to the capacity of the buffer (in elements)
+           need, the number of elements required
+           size, the size of an element
+    OUTPUT: 0 on success, -1 if the memory could not be allocated (the buffer is left as it was).
+
+    Doubles the capacity of the buffer until it holds need elements.
+*/
+static int grow_rows(void **buf, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap)
+        return 0;
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need)
+        new_cap *= 2;
+    void *tmp = realloc(*buf, new_cap * size);
+    if (tmp == NULL)
+        return -1;
+    stats_alloc();
+    *buf = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+/*  FUNCTION: break_line
+    INPUT: line, the processed line, not empty
+           col_width, the width of a column
+           scratch, a page of a single column with all its rows empty
+           out, where the rows are stored
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
+
+    The line is laid out by process_one_line on the scratch page, so that the rows are exactly the ones the single process version would produce. Whenever the page is full, its rows are appended to out and the page is reused.
+*/
+int break_line(char *line, int col_width, Page *scratch, Line_rows *out)
+{
+    Pr_data pos_data = {.i = 0, .j = 0};
+    int n_rows = scratch->n_rows;
+    out->rows_len = 0;
+    out->n_rows = 0;
+
+    pos_data = start_line(pos_data, line);
+    while (*pos_data.line_ptr != '\0')
+    {
+        pos_data = process_one_line(1, col_width, n_rows, 0, scratch, pos_data);
+        int used = pos_data.i == 0 ? n_rows : pos_data.i; // (0, 0) means that all the rows were filled
+        for (int r = 0; r < used; r++)
+        {
+            size_t len = scratch->len[r];
+            if (grow_rows((void **)&out->rows, &out->rows_cap, out->rows_len + len, 1) == -1 ||
+                grow_rows((void **)&out->ends, &out->ends_cap, out->n_rows + 1, sizeof(*out->ends)) == -1)
+            {
+                clear_page(scratch);
+                return -1;
+            }
+            memcpy(out->rows + out->rows_len, page_row(scratch, r), len);
+            out->rows_len += len;
+            out->ends[out->n_rows++] = out->rows_len;
+            scratch->len[r] = 0;
+        }
+        pos_data.i = 0;
+        pos_data.j = 0;
+    }
+    return 0;
+}
+
+/*  FUNCTION: free_line_rows
+    INPUT: out, the rows of a line
+    OUTPUT: void
+*/
+void free_line_rows(Line_rows *out)
+{
+    free(out->rows);
+    free(out->ends);
+    memset(out, 0, sizeof(*out));
+}
+
+/*  FUNCTION: row_capacity
+    INPUT: n_cols, the number of columns
+           col_width, the width of the columns
+           spacing, the spacing between the columns
+    OUTPUT: the number of bytes to allocate for a row of a page.
+
+    A row must hold a line of characters of the largest UTF-8 encoding (4 bytes) in every column, + 1 for the space written after the last word of a column while it is copied. tokenize_line guarantees that no character of the input is longer.
+*/
+size_t row_capacity(int n_cols, int col_width, int spacing)
+{
+    return (size_t)col_width * n_cols * UTF8_MAX_BYTES + (size_t)spacing * (n_cols - 1) + 1;
+}
\ No newline at end of file
@@ -5,6 +5,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include "scan_utils.h"
+#include "alloc_utils.h"
+
+#define NEW_PAGE "\n %%% \n" // newpage delimiter
+#define LINE_WINDOW (1 << 20) // a longer line is laid out a piece of this size at a time by libsplittext (see split_feed)
 
 /* FUNCTION: is_ascii
     INPUT: an unsigned character "c"
@@ -14,10 +19,13 @@
 */
 bool is_ascii(unsigned char);
 
-/*      The struct contains 3 fields:
+/*      The struct contains 6 fields:
         size_t i - represents the current row.
         size_t j - represents the current column.
         char *line_ptr - a pointer to the next character to be read in the current line.
+        char *line_end - a pointer to the terminating null character of the current line.
+        char *line_stop - for a line given in pieces, the point from which no row is started because the rest of the line may still change it (NULL for a whole line).
+        bool ascii - whether the current line is made only of ASCII characters (one byte per character shown).
 
         The purpose of this struct is to store the state of the processing procedure that is being performed on the text input by the process_one_line function. By storing the current row and column as well as the next character to be read, the program can keep track of where it is in the input and continue processing from that point.
 */
@@ -26,8 +34,20 @@ typedef struct Pr_data
     size_t i;
     size_t j; 
     char  *line_ptr;
+    char  *line_end;
+    char  *line_stop;
+    bool   ascii;
 } Pr_data;
 
+/*  FUNCTION: start_line
+    INPUT: a Pr_data struct which stores the current position
+           the line to be processed
+    OUTPUT: the pos_data struct pointing to the beginning of the line.
+
+    This function must be called on every new line before passing it to process_one_line.
+*/
+Pr_data start_line(Pr_data, char *);
+
 /*  FUNCTION: strdisplen
     INPUT: character array str
     OUTPUT: integer value of data type size_t.
@@ -51,13 +71,140 @@ char *fill_with_char(char *, char, size_t);
            the width of the columns
            the number of rows
            the spacing between the columns
-           an array of output lines
+           the page where the rows are written
            a Pr_data struct which stores the current position.
     OUTPUT: returns the pos_data struct after processing the current line. This struct is used to keep track of the
             current position when processing a line longer than a page.
     
-    This function processes the input line in pos_data.line_ptr and formats the text according to the given column width. The formatted line is then appended to the current row of the out_lines array.
+    This function processes the input line in pos_data.line_ptr and formats the text according to the given column width. The formatted line is then appended to the current row of the page.
+*/
+Pr_data process_one_line(int, int, int, int, Page *, Pr_data);
+
+/*  FUNCTION: skip_one_line
+    INPUT: the number of columns
+           the width of the columns
+           the number of rows
+           a Pr_data struct which stores the current position.
+    OUTPUT: the pos_data struct after the current line, as process_one_line would return it.
+
+    This function finds where process_one_line would break the rows and end the page, without writing the rows: no word is copied and no row is justified, so a page can be measured without being built.
+*/
+Pr_data skip_one_line(int, int, int, Pr_data);
+
+/*  FUNCTION: span_one_line
+    INPUT: the number of columns
+           the width of the columns
+           the number of rows
+           the spacing between the columns
+           the page where the pieces of the rows are recorded
+           the buffer the line is in, the pieces are offsets in it
+           a Pr_data struct which stores the current position.
+    OUTPUT: the pos_data struct after the current line, as process_one_line would return it.
+
+    This function lays out the line as process_one_line does, but records each row as pieces of the line and counts of spaces instead of copying the words: render_span_page writes the same bytes process_one_line would have written. The buffer must not change until the page is rendered. For a line given in pieces no row is started from pos_data.line_stop on: the position of that row is returned.
+*/
+Pr_data span_one_line(int, int, int, int, Span_page *, const char *, Pr_data);
+
+/*  FUNCTION: span_row
+    INPUT: the number of columns
+           the number of rows
+           the spacing between the columns
+           the page where the pieces of the rows are recorded
+           a Pr_data struct which stores the current position
+           the offset of an already justified row in the buffer the page refers to
+           the length in bytes of the row
+           the number of spaces after the row (the width of a column for a row of spaces)
+    OUTPUT: the pos_data struct pointing to the next position.
+
+    This function records an already justified row as the current row of the page and moves to the next position, as place_row does.
+*/
+Pr_data span_row(int, int, int, Span_page *, Pr_data, size_t, size_t, int);
+
+/*  FUNCTION: render_span_page
+    INPUT: the page
+           the buffer the page refers to
+           the row added after the last one (the new page symbol), NULL for none
+           where the rows are written, at least page->bytes + the number of rows + 2 + the length of the last row bytes long
+    OUTPUT: the number of bytes written.
+
+    This function writes the rows of the page up to the first empty one, each followed by a newline.
+*/
+size_t render_span_page(const Span_page *, const char *, const char *, char *);
+
+/*  FUNCTION: place_row
+    INPUT: the number of columns
+           the number of rows
+           the spacing between the columns
+           the page where the rows are written
+           a Pr_data struct which stores the current position
+           a row of a column, as produced by process_one_line on a page with a single column
+           the length in bytes of the row
+    OUTPUT: the pos_data struct pointing to the next position.
+
+    This function appends an already justified row to the current row of the page and moves to the next position, exactly as process_one_line does.
+*/
+Pr_data place_row(int, int, int, Page *, Pr_data, const char *, size_t);
+
+/*      The struct contains the rows a line is broken into:
+        char *rows - the justified rows of the line, one after the other without terminators.
+        size_t rows_len, rows_cap - the number of bytes used in rows and its capacity.
+        size_t *ends - the offset in rows of the end of each row.
+        size_t n_rows, ends_cap - the number of rows and the capacity of ends.
+*/
+typedef struct Line_rows
+{
+    char *rows;
+    size_t rows_len, rows_cap;
+    size_t *ends;
+    size_t n_rows, ends_cap;
+} Line_rows;
+
+/*  FUNCTION: break_line
+    INPUT: the processed line, not empty
+           the width of a column
+           a page of a single column with all its rows empty, used as scratch space
+           where the rows are stored, its buffers are reused
+    OUTPUT: 0 on success, -1 if the memory could not be allocated.
+
+    This function breaks a line into the rows process_one_line would write, without the spacing between the columns (which depends on the position on the page). The rows can then be placed by place_row.
+*/
+int break_line(char *, int, Page *, Line_rows *);
+
+/*  FUNCTION: free_line_rows
+    INPUT: the rows of a line
+    OUTPUT: void
+*/
+void free_line_rows(Line_rows *);
+
+/*  FUNCTION: tokenize_line
+    INPUT: the raw line (not null terminated)
+           the end of the raw line
+           the string where the processed line is written, at least 2 bytes longer than the raw line
+           the width of a column
+           where to store the first word larger than a column
+           where to store the length of that word
+    OUTPUT: the number of words of the line, or -1 if a word is larger than a column.
+
+    This function converts a raw line into a string of words separated by a single space and terminated by '\n'. A line without words becomes an empty string.
+*/
+int tokenize_line(const char *, const char *, char *, int, const char **, size_t *);
+
+/*  FUNCTION: process_empty_line
+    INPUT: a pointer to the processed line
+           a pointer to a boolean, whether an empty line has been already found
+           a Pr_data struct, the position on the page
+    OUTPUT: true if the line must be discarded.
+
+    An empty line becomes a line containing only '\n' (a row of spaces), unless it follows another empty line or it would be the first row of a page.
+*/
+bool process_empty_line(char **, bool *, Pr_data);
+
+/*  FUNCTION: row_capacity
+    INPUT: the number of columns
+           the width of the columns
+           the spacing between the columns
+    OUTPUT: the number of bytes to allocate for a row of a page.
 */
-Pr_data process_one_line(int, int, int, int, char **, Pr_data);
+size_t row_capacity(int, int, int);
 
 #endif
\ No newline at end of file
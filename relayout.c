@@ -0,0 +1,453 @@
+#include "relayout.h"
+
+/*  FUNCTION: die
+    INPUT:  what, the file or the operation that failed.
+    OUTPUT: void
+
+    Prints out the error in errno and exits.
+*/
+static void die(const char *what)
+{
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+/*  FUNCTION: join_path
+    INPUT:  path, a path.
+            suffix, the suffix to append.
+    OUTPUT: a new string, path followed by suffix.
+*/
+static char *join_path(const char *path, const char *suffix)
+{
+    size_t n = strlen(path) + strlen(suffix) + 1;
+    char *s = malloc(n);
+    if (s == NULL)
+        die("Error allocating a path");
+    snprintf(s, n, "%s%s", path, suffix);
+    return s;
+}
+
+/*  FUNCTION: load_text
+    INPUT:  in, the input source.
+            len, where the length of the text is stored.
+            owned, where the buffer to free is stored, NULL if the text is the mapping of the input.
+    OUTPUT: the whole text.
+
+    The paragraphs are compared before any of them is laid out, so the whole input is needed: a regular file is used where it is mapped, a stream is read into memory.
+*/
+static const char *load_text(In_stream *in, size_t *len, char **owned)
+{
+    *owned = NULL;
+    if (in->map != NULL)
+    {
+        *len = in->map_len - in->map_pos;
+        return in->map + in->map_pos;
+    }
+    const char *data;
+    ssize_t n;
+    size_t cap = 0;
+    *len = 0;
+    while ((n = next_chunk(in, &data)) > 0)
+    {
+        if (*len + n > cap)
+        {
+            cap = cap ? cap : 1 << 16;
+            while (cap < *len + n)
+                cap *= 2;
+            char *tmp = realloc(*owned, cap);
+            if (tmp == NULL)
+                die("Error allocating the input");
+            *owned = tmp;
+        }
+        memcpy(*owned + *len, data, n);
+        *len += n;
+    }
+    return *owned;
+}
+
+/*  FUNCTION: split_paras
+    INPUT:  text, the text.
+            len, the length of the text.
+            ck, the checkpoint where the hashes of the paragraphs are stored.
+    OUTPUT: the offset in text of every paragraph, followed by len.
+
+    A paragraph is an input line; its newline is not hashed, so that adding the missing newline at the end of the text does not change the last paragraph.
+*/
+static size_t *split_paras(const char *text, size_t len, Checkpoint *ck)
+{
+    size_t cap = 1024, n = 0, pos = 0;
+    size_t *starts = malloc(cap * sizeof(*starts));
+    ck->hashes = malloc(cap * sizeof(*ck->hashes));
+    while (starts != NULL && ck->hashes != NULL && pos < len)
+    {
+        if (n + 1 == cap)
+        {
+            cap *= 2;
+            starts = realloc(starts, cap * sizeof(*starts));
+            ck->hashes = realloc(ck->hashes, cap * sizeof(*ck->hashes));
+            if (starts == NULL || ck->hashes == NULL)
+                break;
+        }
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t end = nl != NULL ? (size_t)(nl - text) : len;
+        starts[n] = pos;
+        ck->hashes[n++] = hash_bytes(text + pos, end - pos, 0);
+        pos = nl != NULL ? end + 1 : len;
+    }
+    if (starts == NULL || ck->hashes == NULL)
+        die("Error allocating the paragraphs");
+    starts[n] = len;
+    ck->n_paras = n;
+    return starts;
+}
+
+/*  FUNCTION: add_page
+    INPUT:  ck, a checkpoint.
+            page, the start of a page.
+    OUTPUT: void
+*/
+static void add_page(Checkpoint *ck, Ckpt_page page)
+{
+    if (ck->n_pages == ck->pages_cap)
+    {
+        ck->pages_cap = ck->pages_cap ? 2 * ck->pages_cap : 256;
+        ck->pages = realloc(ck->pages, ck->pages_cap * sizeof(*ck->pages));
+        if (ck->pages == NULL)
+            die("Error allocating the checkpoint");
+    }
+    ck->pages[ck->n_pages++] = page;
+}
+
+/*  FUNCTION: free_checkpoint
+    INPUT:  ck, a checkpoint.
+    OUTPUT: void
+*/
+static void free_checkpoint(Checkpoint *ck)
+{
+    free(ck->hashes);
+    free(ck->pages);
+    memset(ck, 0, sizeof(*ck));
+}
+
+/*  FUNCTION: read_checkpoint
+    INPUT:  path, the checkpoint file.
+            ck, where the checkpoint is stored.
+    OUTPUT: true if the file exists and is a whole checkpoint.
+
+    The file holds the magic, the layout, the number of paragraphs, of pages and the length of the output (as uint64_t), then the hashes and the pages, in the byte order of the machine that wrote it. A file that is missing or damaged only costs a full layout.
+*/
+static bool read_checkpoint(const char *path, Checkpoint *ck)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return false;
+    char magic[sizeof(CKPT_MAGIC) - 1];
+    uint64_t head[3];
+    struct stat st;
+    bool ok = fstat(fileno(f), &st) == 0 && fread(magic, sizeof(magic), 1, f) == 1 &&
+              memcmp(magic, CKPT_MAGIC, sizeof(magic)) == 0 && fread(&ck->layout, sizeof(ck->layout), 1, f) == 1 &&
+              fread(head, sizeof(head), 1, f) == 1 &&
+              head[0] <= (uint64_t)st.st_size / sizeof(uint64_t) && head[1] <= (uint64_t)st.st_size / sizeof(Ckpt_page) &&
+              (uint64_t)st.st_size == sizeof(magic) + sizeof(ck->layout) + sizeof(head) + head[0] * sizeof(uint64_t) + head[1] * sizeof(Ckpt_page);
+    if (ok)
+    {
+        ck->n_paras = head[0];
+        ck->n_pages = ck->pages_cap = head[1];
+        ck->out_len = head[2];
+        ck->hashes = malloc((ck->n_paras + 1) * sizeof(*ck->hashes));
+        ck->pages = malloc((ck->n_pages + 1) * sizeof(*ck->pages));
+        ok = ck->hashes != NULL && ck->pages != NULL &&
+             fread(ck->hashes, sizeof(*ck->hashes), ck->n_paras, f) == ck->n_paras &&
+             fread(ck->pages, sizeof(*ck->pages), ck->n_pages, f) == ck->n_pages;
+    }
+    fclose(f);
+    if (!ok)
+        free_checkpoint(ck);
+    return ok;
+}
+
+/*  FUNCTION: write_checkpoint
+    INPUT:  path, the checkpoint file.
+            ck, the checkpoint.
+    OUTPUT: void
+
+    The checkpoint is written to path.tmp, which then replaces path.
+*/
+static void write_checkpoint(const char *path, const Checkpoint *ck)
+{
+    char *tmp = join_path(path, ".tmp");
+    FILE *f = fopen(tmp, "wb");
+    uint64_t head[3] = {ck->n_paras, ck->n_pages, ck->out_len};
+    if (f == NULL || fwrite(CKPT_MAGIC, sizeof(CKPT_MAGIC) - 1, 1, f) != 1 ||
+        fwrite(&ck->layout, sizeof(ck->layout), 1, f) != 1 || fwrite(head, sizeof(head), 1, f) != 1 ||
+        fwrite(ck->hashes, sizeof(*ck->hashes), ck->n_paras, f) != ck->n_paras ||
+        fwrite(ck->pages, sizeof(*ck->pages), ck->n_pages, f) != ck->n_pages || fclose(f) != 0 ||
+        rename(tmp, path) == -1)
+        die(path);
+    free(tmp);
+}
+
+/*  FUNCTION: copy_out
+    INPUT:  from, the old output.
+            pos, the offset of the bytes to copy.
+            n, the number of bytes.
+            to, the new output, positioned where the bytes go.
+    OUTPUT: void
+
+    The bytes are copied by the kernel (copy_file_range), or through a buffer where it cannot.
+*/
+static void copy_out(int from, uint64_t pos, uint64_t n, int to)
+{
+    off_t off = pos;
+    while (n > 0)
+    {
+        ssize_t c = copy_file_range(from, &off, to, NULL, n, 0);
+        if (c > 0)
+        {
+            n -= c;
+            continue;
+        }
+        if (c == 0 || (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP))
+            die("Error copying the previous output");
+        char buf[1 << 16];
+        c = pread(from, buf, n < sizeof(buf) ? n : sizeof(buf), off);
+        if (c <= 0)
+            die("Error copying the previous output");
+        struct iovec iov = {.iov_base = buf, .iov_len = c};
+        write_all(to, &iov, 1);
+        off += c;
+        n -= c;
+    }
+}
+
+/*  FUNCTION: put_page
+    INPUT:  out, the output buffer.
+            page, the page.
+            alloc_n_rows, the number of rows of the page (including the new page symbol).
+    OUTPUT: the number of bytes written.
+
+    Writes the rows of the page, up to the first empty one, each one followed by a newline, and clears the page.
+*/
+static size_t put_page(Out_stream *out, Page *page, int alloc_n_rows)
+{
+    size_t len = 0;
+    stats_begin(STAGE_OUTPUT);
+    for (int i = 0; i < alloc_n_rows && page->len[i] != 0; i++)
+    {
+        out_write(out, page_row(page, i), page->len[i]);
+        out_write(out, "\n", 1);
+        len += page->len[i] + 1;
+    }
+    if (stats != NULL && len > 0)
+        stats->pages++;
+    clear_page(page);
+    stats_end(STAGE_OUTPUT);
+    return len;
+}
+
+/*  FUNCTION: find_page
+    INPUT:  ck, a checkpoint.
+            para, offset, empty_line, the start of a page.
+    OUTPUT: the index of the page of ck starting there, -1 if none.
+
+    The pages are sorted by paragraph and offset.
+*/
+static ssize_t find_page(const Checkpoint *ck, uint64_t para, uint64_t offset, uint64_t empty_line)
+{
+    size_t lo = 0, hi = ck->n_pages;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const Ckpt_page *pg = &ck->pages[mid];
+        if (pg->para < para || (pg->para == para && pg->offset < offset))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < ck->n_pages && ck->pages[lo].para == para && ck->pages[lo].offset == offset && ck->pages[lo].empty_line == empty_line)
+        return lo;
+    return -1;
+}
+
+/*  FUNCTION: run_relayout
+    INPUT:  in, the input source.
+            out_path, the output file, updated in place.
+            n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width, the layout of the pages.
+            out_cap, the size of the output buffer.
+            verbose, whether to print on stderr how much of the output was reused.
+    OUTPUT: 0 on success, -1 if a word is larger than a column.
+
+    The text is split into paragraphs and compared with the checkpoint: the first changed paragraph is found from the start and the unchanged paragraphs are counted from the end. The layout restarts at the last old page that starts before the first changed paragraph, with the position and the empty line flag of that page, after copying the old output up to it. Every new page is recorded; once one starts among the unchanged paragraphs at the end, where an old page started (same paragraph counted from the end, same offset, same flag), the layout from there on would be the old one, so the rest of the old output and of its pages are copied instead.
+*/
+int run_relayout(In_stream *in, const char *out_path, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width, size_t out_cap, bool verbose)
+{
+    size_t len;
+    char *owned;
+    stats_begin(STAGE_READ);
+    const char *text = load_text(in, &len, &owned);
+    Checkpoint cur = {.layout = {.n_cols = n_cols, .n_rows = n_rows, .col_width = col_width, .spacing = spacing}};
+    size_t *starts = split_paras(text, len, &cur);
+    stats_end(STAGE_READ);
+
+    // the previous run is used only if it had the same layout and its output is untouched
+    char *ckpt_path = join_path(out_path, CKPT_SUFFIX);
+    char *tmp_path = join_path(out_path, ".tmp");
+    Checkpoint old = {0};
+    int old_fd = -1;
+    struct stat st;
+    if (read_checkpoint(ckpt_path, &old))
+    {
+        if (memcmp(&old.layout, &cur.layout, sizeof(cur.layout)) == 0 && (old_fd = open(out_path, O_RDONLY)) != -1 &&
+            (fstat(old_fd, &st) == -1 || (uint64_t)st.st_size != old.out_len))
+        {
+            close(old_fd);
+            old_fd = -1;
+        }
+        if (old_fd == -1)
+            free_checkpoint(&old);
+    }
+
+    // the first changed paragraph, and the unchanged paragraphs at the end
+    size_t n_min = old.n_paras < cur.n_paras ? old.n_paras : cur.n_paras;
+    size_t first = 0, tail = 0;
+    while (first < n_min && old.hashes[first] == cur.hashes[first])
+        first++;
+    while (tail < n_min - first && old.hashes[old.n_paras - 1 - tail] == cur.hashes[cur.n_paras - 1 - tail])
+        tail++;
+
+    // restart from the page containing the first changed paragraph
+    Ckpt_page start = {0};
+    for (size_t k = 0; k < old.n_pages && (old.pages[k].para < first || (old.pages[k].para == first && old.pages[k].offset == 0)); k++)
+    {
+        if (k > 0)
+            add_page(&cur, start);
+        start = old.pages[k];
+    }
+    add_page(&cur, start);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        die(tmp_path);
+    if (start.out > 0)
+        copy_out(old_fd, 0, start.out, fd);
+    Out_stream out;
+    open_output(&out, fd, out_cap);
+
+    Page page;
+    if (init_page(&page, alloc_n_rows, alloc_page_width) == -1)
+        die("Error allocating the page");
+    char *line = NULL;
+    size_t line_cap = 0;
+    Pr_data pos_data = {.line_ptr = NULL, .i = 0, .j = 0};
+    bool empty_line = start.empty_line;
+    uint64_t out_pos = start.out, reused = start.out;
+    size_t p = start.para;
+    bool joined = false;
+    for (; p < cur.n_paras && !joined; p++)
+    {
+        const char *raw = text + starts[p];
+        size_t raw_len = starts[p + 1] - starts[p];
+        const char *long_word;
+        size_t long_len;
+        stats_begin(STAGE_READ);
+        if (raw_len + 2 > line_cap)
+        {
+            warn_long_line(raw_len);
+            line_cap = 2 * (raw_len + 2);
+            free(line);
+            if ((line = malloc(line_cap)) == NULL)
+                die("Error allocating the line");
+            stats_alloc();
+        }
+        int cnt = tokenize_line(raw, raw + raw_len, line, col_width, &long_word, &long_len);
+        stats_line(raw_len, cnt);
+        stats_end(STAGE_READ);
+        if (cnt < 0)
+        { // the previous output and checkpoint are kept
+            fprintf(stderr, "ERROR: read a word (%.*s) larger (%lu) than a column (%d), must stop.\n", (int)long_len, long_word, long_len, col_width);
+            close_output(&out);
+            close(fd);
+            unlink(tmp_path);
+            return -1;
+        }
+
+        char *l = line;
+        if (p == start.para && start.offset > 0)
+        { // the page starts in the middle of the paragraph
+            pos_data = start_line(pos_data, l);
+            pos_data.line_ptr = l + start.offset;
+        }
+        else
+        {
+            // skip if more than one empty line is found
+            if (process_empty_line(&l, &empty_line, pos_data))
+                continue;
+            pos_data = start_line(pos_data, l);
+        }
+        stats_begin(STAGE_LAYOUT);
+        while (*pos_data.line_ptr != '\0' && !joined)
+        {
+            pos_data = process_one_line(n_cols, col_width, n_rows, spacing, &page, pos_data);
+            if (pos_data.i == 0 && pos_data.j == 0)
+            { // the page is ended: add the separator, write it and record where the next one starts
+                set_row(&page, n_rows, NEW_PAGE);
+                stats_end(STAGE_LAYOUT);
+                out_pos += put_page(&out, &page, alloc_n_rows);
+                stats_begin(STAGE_LAYOUT);
+                Ckpt_page next = {.para = p, .offset = pos_data.line_ptr - l, .out = out_pos, .empty_line = empty_line};
+                if (*pos_data.line_ptr == '\0')
+                    next = (Ckpt_page){.para = p + 1, .offset = 0, .out = out_pos, .empty_line = empty_line};
+                add_page(&cur, next);
+
+                ssize_t q = -1;
+                if (old_fd != -1 && next.para >= cur.n_paras - tail)
+                    q = find_page(&old, next.para - cur.n_paras + old.n_paras, next.offset, next.empty_line);
+                if (q >= 0)
+                { // the layout has reconverged with the old one: copy the rest of the old output
+                    const Ckpt_page *from = &old.pages[q];
+                    flush_output(&out);
+                    copy_out(old_fd, from->out, old.out_len - from->out, fd);
+                    reused += old.out_len - from->out;
+                    for (size_t k = q + 1; k < old.n_pages; k++)
+                    {
+                        Ckpt_page pg = old.pages[k];
+                        pg.para = pg.para - old.n_paras + cur.n_paras;
+                        pg.out = pg.out - from->out + out_pos;
+                        add_page(&cur, pg);
+                    }
+                    out_pos += old.out_len - from->out;
+                    joined = true;
+                }
+            }
+        }
+        stats_end(STAGE_LAYOUT);
+    }
+    size_t laid_out = p - start.para;
+    if (!joined) // write the last page
+        out_pos += put_page(&out, &page, alloc_n_rows);
+    cur.out_len = out_pos;
+    close_output(&out);
+    if (close(fd) == -1)
+        die(tmp_path);
+
+    // without the checkpoint a crash between the two renames only costs a full layout
+    unlink(ckpt_path);
+    if (rename(tmp_path, out_path) == -1)
+        die(out_path);
+    write_checkpoint(ckpt_path, &cur);
+
+    if (verbose)
+        fprintf(stderr, "Relayout: %zu of %zu paragraphs laid out, %llu of %llu bytes of output reused\n", laid_out, cur.n_paras,
+                (unsigned long long)reused, (unsigned long long)cur.out_len);
+    if (old_fd != -1)
+        close(old_fd);
+    free_page(&page);
+    free(line);
+    free(starts);
+    free(owned);
+    free(ckpt_path);
+    free(tmp_path);
+    free_checkpoint(&old);
+    free_checkpoint(&cur);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef RELAYOUT_H
+#define RELAYOUT_H
+
+#define _GNU_SOURCE // copy_file_range
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "io_utils.h"
+#include "processing.h"
+#include "alloc_utils.h"
+#include "splittext.h"
+#include "cache.h"
+#include "stats.h"
+
+#define CKPT_MAGIC "SPLTCKP1" // first bytes of a checkpoint file
+#define CKPT_SUFFIX ".ckpt"   // the checkpoint of FILE is FILE.ckpt
+
+/*      The struct contains the state of the layout at the start of a page, enough to lay out the rest of the text from there:
+        uint64_t para - the paragraph (input line) the page starts in.
+        uint64_t offset - the offset, in the tokenized paragraph, of the first word of the page.
+        uint64_t out - the offset of the page in the output.
+        uint64_t empty_line - whether the last paragraph laid out before the page was empty (see process_empty_line).
+
+        A page starts with an empty position (row 0 of column 0), so no other part of Pr_data needs to be saved.
+*/
+typedef struct Ckpt_page
+{
+    uint64_t para;
+    uint64_t offset;
+    uint64_t out;
+    uint64_t empty_line;
+} Ckpt_page;
+
+/*      The struct contains the checkpoint of a text, kept next to its output:
+        Split_layout layout - the layout of the output.
+        uint64_t *hashes, size_t n_paras - the hash of every paragraph of the input (without its newline), and their number.
+        Ckpt_page *pages, size_t n_pages, pages_cap - the start of every page, the number of pages and the capacity of pages.
+        uint64_t out_len - the length of the output.
+*/
+typedef struct Checkpoint
+{
+    Split_layout layout;
+    uint64_t *hashes;
+    size_t n_paras;
+    Ckpt_page *pages;
+    size_t n_pages, pages_cap;
+    uint64_t out_len;
+} Checkpoint;
+
+/*  FUNCTION: run_relayout
+    INPUT:  in, the input source.
+            out_path, the output file, updated in place.
+            n_cols, n_rows, spacing, col_width, alloc_n_rows, alloc_page_width, the layout of the pages.
+            out_cap, the size of the output buffer.
+            verbose, whether to print on stderr how much of the output was reused.
+    OUTPUT: 0 on success, -1 if a word is larger than a column (the error has been printed out and the output file is left as it was).
+
+    Lays out the input into out_path as the single-process version would, reusing the previous output of out_path where the text has not changed. The checkpoint of the previous run (out_path.ckpt) tells where the paragraphs and the pages started: the pages before the first changed paragraph are copied, the layout restarts from the page containing it, and as soon as a new page starts where an old page started, at the same place of the same unchanged paragraphs that end the text, the rest of the old output is copied too. The output and the checkpoint are written to temporary files that replace the old ones. If a file cannot be read or written an error message is printed out and the program exits.
+*/
+int run_relayout(In_stream *in, const char *out_path, int n_cols, int n_rows, int spacing, int col_width, int alloc_n_rows, int alloc_page_width, size_t out_cap, bool verbose);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "scan_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/*  The kernels classify the text in blocks of 32 (AVX2) or 16 (SSE2) bytes, building a bit mask with one bit per byte of the block. Depending on the kind of scan a bit is set for:
+    - blank characters: the byte is equal to ' ' or, once 9 is subtracted, it is not greater than 4 as an unsigned value (the range '\t'...'\r');
+    - UTF-8 continuation bytes: the byte, seen as a signed value, is less than -64 (i.e. it begins with 10);
+    - non ASCII bytes: the most significant bit of the byte is set;
+    - a given byte: the byte is equal to it.
+    Searches look for the first set (or unset) bit of the mask, counts add up the population count of the masks. The bytes left over after the last whole block are examined by the scalar loops, so no byte after end is ever read.
+
+    SSE2 is always available on x86-64, AVX2 is used only if the CPU reports it at runtime. On other architectures only the scalar code is compiled. Whatever the level, the results are the same: bench/kernels -S checks it, forcing each level in turn.
+*/
+
+enum scan_kind
+{
+    KIND_BLANK,
+    KIND_CONT,
+    KIND_HIGH,
+    KIND_BYTE
+};
+
+static const char *const level_names[] = {"scalar", "sse2", "avx2"};
+
+static enum scan_level level = SCAN_SCALAR; // set before main by init_scan_level, changed only by scan_force
+static const char *env_rejected = NULL;     // the value of SCAN_ENV that could not be used, NULL if none
+
+/*  FUNCTION: best_level
+    INPUT:  void
+    OUTPUT: the best instruction set supported by the CPU.
+*/
+static enum scan_level best_level(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? SCAN_AVX2 : __builtin_cpu_supports("sse2") ? SCAN_SSE2 : SCAN_SCALAR;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+/*  FUNCTION: init_scan_level
+    INPUT:  void
+    OUTPUT: void
+
+    Runs before main (and when the shared library is loaded), before any thread can scan, so level is written once and only read afterwards. The environment variable SPLIT_TEXT_SCAN (scalar, sse2 or avx2) forces a level; a level that is not known or not supported by the CPU is ignored, the best one is used and scan_env_rejected tells the program, nothing is printed.
+*/
+__attribute__((constructor)) static void init_scan_level(void)
+{
+    level = best_level();
+    const char *name = getenv(SCAN_ENV);
+    if (name != NULL && scan_force(name) == -1)
+        env_rejected = name;
+}
+
+/*  FUNCTION: scan_env_rejected
+    INPUT:  void
+    OUTPUT: the value of SCAN_ENV, if it was ignored because it is not a level supported by the CPU, NULL otherwise.
+*/
+const char *scan_env_rejected(void)
+{
+    return env_rejected;
+}
+
+/*  FUNCTION: scan_force
+    INPUT:  name, the name of a level: scalar, sse2 or avx2.
+    OUTPUT: 0 on success, -1 if the level is not known or not supported by the CPU (the level is left as it was).
+*/
+int scan_force(const char *name)
+{
+    for (int k = SCAN_SCALAR; k <= SCAN_AVX2; k++)
+        if (strcmp(name, level_names[k]) == 0)
+        {
+            if (k > (int)best_level())
+                return -1;
+            level = k;
+            return 0;
+        }
+    return -1;
+}
+
+/*  FUNCTION: scan_level_name
+    INPUT:  void
+    OUTPUT: the name of the level in use.
+*/
+const char *scan_level_name(void)
+{
+    return level_names[level];
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2"))) static unsigned mask_sse2(const char *p, enum scan_kind kind, char c)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m;
+    switch (kind)
+    {
+    case KIND_BLANK:
+    {
+        __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+        m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8('\r' - '\t')), t),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        break;
+    }
+    case KIND_CONT:
+        m = _mm_cmplt_epi8(v, _mm_set1_epi8(-64));
+        break;
+    case KIND_HIGH:
+        m = v;
+        break;
+    default:
+        m = _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+        break;
+    }
+    return (unsigned)_mm_movemask_epi8(m) & 0xFFFF;
+}
+
+__attribute__((target("avx2"))) static unsigned mask_avx2(const char *p, enum scan_kind kind, char c)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i m;
+    switch (kind)
+    {
+    case KIND_BLANK:
+    {
+        __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8('\r' - '\t')), t),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+        break;
+    }
+    case KIND_CONT:
+        m = _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), v);
+        break;
+    case KIND_HIGH:
+        m = v;
+        break;
+    default:
+        m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+        break;
+    }
+    return (unsigned)_mm256_movemask_epi8(m);
+}
+
+/*  FUNCTION: find_blocks
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+            kind, the class of bytes looked for
+            c, the byte looked for if kind is KIND_BYTE
+            negate, true to look for the first byte NOT in the class
+    OUTPUT: a pointer to the byte found or to the first byte of the tail shorter than a block.
+*/
+static const char *find_blocks(const char *p, const char *end, enum scan_kind kind, char c, bool negate)
+{
+    unsigned flip = negate ? ~0u : 0;
+    switch (level)
+    {
+    case SCAN_AVX2:
+        for (; end - p >= 32; p += 32)
+        {
+            unsigned m = mask_avx2(p, kind, c) ^ flip;
+            if (m != 0)
+                return p + __builtin_ctz(m);
+        }
+        // fall through, a tail of 16 bytes or more is still worth a SSE2 block
+    case SCAN_SSE2:
+        for (; end - p >= 16; p += 16)
+        {
+            unsigned m = (mask_sse2(p, kind, c) ^ flip) & 0xFFFF;
+            if (m != 0)
+                return p + __builtin_ctz(m);
+        }
+        break;
+    default:
+        break;
+    }
+    return p;
+}
+
+/*  FUNCTION: count_blocks
+    INPUT:  p, a pointer to the pointer to the first character to examine, it is moved to the tail shorter than a block
+            end, a pointer one past the last character to examine
+            kind, the class of bytes to count
+            c, the byte to count if kind is KIND_BYTE
+    OUTPUT: the number of bytes of the class found in the whole blocks.
+*/
+static size_t count_blocks(const char **pp, const char *end, enum scan_kind kind, char c)
+{
+    const char *p = *pp;
+    size_t cnt = 0;
+    switch (level)
+    {
+    case SCAN_AVX2:
+        for (; end - p >= 32; p += 32)
+            cnt += __builtin_popcount(mask_avx2(p, kind, c));
+        // fall through
+    case SCAN_SSE2:
+        for (; end - p >= 16; p += 16)
+            cnt += __builtin_popcount(mask_sse2(p, kind, c));
+        break;
+    default:
+        break;
+    }
+    *pp = p;
+    return cnt;
+}
+#endif
+
+/*  FUNCTION: skip_blanks
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: a pointer to the first character in [p, end) that is not blank, end if there is none.
+
+    Runs of blanks are usually one character long, so the first character is tested before entering the vectorised scan.
+*/
+const char *skip_blanks(const char *p, const char *end)
+{
+    if (p < end && !is_blank(*p))
+        return p;
+#ifdef SCAN_X86
+    p = find_blocks(p, end, KIND_BLANK, 0, true);
+#endif
+    while (p < end && is_blank(*p))
+        p++;
+    return p;
+}
+
+/*  FUNCTION: find_blank
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: a pointer to the first blank character in [p, end), end if there is none.
+*/
+const char *find_blank(const char *p, const char *end)
+{
+#ifdef SCAN_X86
+    p = find_blocks(p, end, KIND_BLANK, 0, false);
+#endif
+    while (p < end && !is_blank(*p))
+        p++;
+    return p;
+}
+
+/*  FUNCTION: utf8_width
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: the number of bytes in [p, end) that are not UTF-8 continuation bytes.
+
+    The continuation bytes are counted and subtracted from the length of the range.
+*/
+size_t utf8_width(const char *p, const char *end)
+{
+    size_t cont = 0;
+    size_t len = end - p;
+#ifdef SCAN_X86
+    cont = count_blocks(&p, end, KIND_CONT, 0);
+#endif
+    for (; p < end; p++)
+        if ((*p & 0xC0) == 0x80)
+            cont++;
+    return len - cont;
+}
+
+/*  FUNCTION: is_ascii_text
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: true if no byte in [p, end) has the most significant bit set.
+*/
+bool is_ascii_text(const char *p, const char *end)
+{
+#ifdef SCAN_X86
+    p = find_blocks(p, end, KIND_HIGH, 0, false);
+#endif
+    while (p < end && (unsigned char)*p < 0x80)
+        p++;
+    return p == end;
+}
+
+/*  FUNCTION: count_byte
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+            c, the byte to count
+    OUTPUT: the number of occurrences of c in [p, end).
+*/
+size_t count_byte(const char *p, const char *end, char c)
+{
+    size_t cnt = 0;
+#ifdef SCAN_X86
+    cnt = count_blocks(&p, end, KIND_BYTE, c);
+#endif
+    for (; p < end; p++)
+        if (*p == c)
+            cnt++;
+    return cnt;
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef SCAN_UTILS_H
+#define SCAN_UTILS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define UTF8_MAX_BYTES 4           // the longest UTF-8 encoding of a character
+#define SCAN_ENV "SPLIT_TEXT_SCAN" // environment variable forcing the level of the scans
+
+/*      The instruction sets the scans can use, from the slowest:
+        SCAN_SCALAR - one byte at a time.
+        SCAN_SSE2 - 16 bytes at a time (x86).
+        SCAN_AVX2 - 32 bytes at a time (x86 with AVX2).
+*/
+enum scan_level
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+};
+
+/*  FUNCTION: scan_force
+    INPUT:  name, the name of a level: scalar, sse2 or avx2.
+    OUTPUT: 0 on success, -1 if the level is not known or not supported by the CPU (the level is left as it was).
+
+    Makes the scans use the level, it must be called before any thread scans. By default the best level supported by the CPU is used, unless SCAN_ENV names another one.
+*/
+int scan_force(const char *name);
+
+/*  FUNCTION: scan_env_rejected
+    INPUT:  void
+    OUTPUT: the value of SCAN_ENV, if it was ignored because it is not a level supported by the CPU, NULL otherwise.
+
+    The scans never print anything: the program reports the ignored value if it wants to.
+*/
+const char *scan_env_rejected(void);
+
+/*  FUNCTION: scan_level_name
+    INPUT:  void
+    OUTPUT: the name of the level in use.
+*/
+const char *scan_level_name(void);
+
+/*  FUNCTION: is_blank
+    INPUT:  a character c
+    OUTPUT: a boolean value.
+
+    Checks whether c separates words, i.e. it is one of " \t\n\v\f\r" (the characters skipped by sscanf("%s") in the C locale).
+*/
+static inline bool is_blank(char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+/*  FUNCTION: skip_blanks
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: a pointer to the first character in [p, end) that is not blank, end if there is none.
+*/
+const char *skip_blanks(const char *p, const char *end);
+
+/*  FUNCTION: find_blank
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: a pointer to the first blank character in [p, end), end if there is none.
+*/
+const char *find_blank(const char *p, const char *end);
+
+/*  FUNCTION: utf8_width
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: the number of characters shown, i.e. the number of bytes in [p, end) that are not UTF-8 continuation bytes.
+*/
+size_t utf8_width(const char *p, const char *end);
+
+/*  FUNCTION: is_ascii_text
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+    OUTPUT: true if all the bytes in [p, end) are ASCII characters, so that every byte is a character shown.
+*/
+bool is_ascii_text(const char *p, const char *end);
+
+/*  FUNCTION: count_byte
+    INPUT:  p, a pointer to the first character to examine
+            end, a pointer one past the last character to examine
+            c, the byte to count
+    OUTPUT: the number of occurrences of c in [p, end).
+*/
+size_t count_byte(const char *p, const char *end, char c);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,368 @@
+#include "server.h"
+
+static volatile sig_atomic_t stop_serving = 0; // set by SIGINT and SIGTERM
+
+/*  FUNCTION: on_stop
+    INPUT:  sig, the signal received.
+    OUTPUT: void
+*/
+static void on_stop(int sig)
+{
+    stop_serving = 1;
+}
+
+/*  FUNCTION: reserve
+    INPUT:  buf, pointer to the buffer to grow.
+            cap, pointer to the capacity of the buffer.
+            need, the number of bytes required.
+    OUTPUT: void
+
+    Doubles the capacity of the buffer until it holds need bytes. If the reallocation fails an error message is printed out and the program exits.
+*/
+static void reserve(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return;
+    size_t new_cap = *cap ? *cap : SERVE_READ;
+    while (new_cap < need)
+        new_cap *= 2;
+    char *tmp = realloc(*buf, new_cap);
+    if (tmp == NULL)
+    {
+        perror("Error allocating the buffer of a connection");
+        exit(EXIT_FAILURE);
+    }
+    *buf = tmp;
+    *cap = new_cap;
+}
+
+/*  FUNCTION: reply
+    INPUT:  c, a connection.
+            data, the bytes to send.
+            n, the number of bytes.
+    OUTPUT: void
+
+    Appends the bytes to the reply, moving the bytes not yet sent to the start of the buffer first.
+*/
+static void reply(Conn *c, const char *data, size_t n)
+{
+    if (c->out_pos > 0)
+    {
+        memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+        c->out_len -= c->out_pos;
+        c->out_pos = 0;
+    }
+    reserve(&c->out, &c->out_cap, c->out_len + n);
+    memcpy(c->out + c->out_len, data, n);
+    c->out_len += n;
+}
+
+/*  FUNCTION: reply_error
+    INPUT:  c, a connection.
+            message, the description of the error.
+    OUTPUT: void
+
+    Sends the outcome of a failed request, the rest of its text is discarded.
+*/
+static void reply_error(Conn *c, const char *message)
+{
+    reply(c, "ERR ", 4);
+    reply(c, message, strlen(message));
+    reply(c, "\n", 1);
+    c->failed = true;
+}
+
+/*  FUNCTION: page_reply
+    INPUT:  ctx, a pointer to the connection.
+            page, a page as text.
+            len, the length of the page.
+    OUTPUT: 0
+
+    The sink of the contexts of the connections: the page is appended to the reply.
+*/
+static int page_reply(void *ctx, const char *page, size_t len)
+{
+    Conn *c = ctx;
+    char head[32];
+    int n = snprintf(head, sizeof(head), "P %zu\n", len);
+    reply(c, head, n);
+    reply(c, page, len);
+    return 0;
+}
+
+/*  FUNCTION: start_request
+    INPUT:  c, a connection.
+            header, the header line of a request (without the newline).
+    OUTPUT: void
+
+    The context of the connection is reused if the layout is the same as the previous request. A malformed header (a length which is not a number of at most SERVE_BODY_MAX bytes included) closes the connection, an invalid layout fails the request.
+*/
+static void start_request(Conn *c, const char *header)
+{
+    Split_layout layout;
+    int n = 0;
+    char *end = NULL;
+    unsigned long long len = 0;
+    sscanf(header, "%d %d %d %d %n", &layout.n_cols, &layout.n_rows, &layout.col_width, &layout.spacing, &n);
+    errno = 0;
+    if (n > 0 && isdigit((unsigned char)header[n])) // not %zu, which takes a sign and turns -1 into SIZE_MAX
+        len = strtoull(header + n, &end, 10);
+    if (end == NULL || errno == ERANGE || len > SERVE_BODY_MAX || end[strspn(end, " \t\r")] != '\0')
+    {
+        reply_error(c, "malformed request");
+        c->closing = true;
+        return;
+    }
+    c->in_body = true;
+    c->body_left = len;
+    c->failed = false;
+    if (layout.spacing < 1)
+    {
+        reply_error(c, split_strerror(SPLIT_ERR_LAYOUT));
+        return;
+    }
+    if (c->ctx == NULL || memcmp(&layout, &c->layout, sizeof(layout)) != 0)
+    {
+        split_close(c->ctx);
+        Split_status status = split_open(&c->ctx, &layout, page_reply, c);
+        if (status == SPLIT_OK && c->cache != NULL && (status = split_set_cache(c->ctx, c->cache)) != SPLIT_OK)
+        {
+            split_close(c->ctx);
+            c->ctx = NULL;
+        }
+        if (status != SPLIT_OK)
+        {
+            reply_error(c, split_strerror(status));
+            return;
+        }
+        c->layout = layout;
+    }
+}
+
+/*  FUNCTION: end_request
+    INPUT:  c, a connection.
+    OUTPUT: void
+*/
+static void end_request(Conn *c)
+{
+    if (!c->failed)
+    {
+        if (split_finish(c->ctx) == SPLIT_OK)
+            reply(c, "OK\n", 3);
+        else
+            reply_error(c, split_error(c->ctx));
+    }
+    if (c->ctx != NULL)
+        split_reset(c->ctx);
+    c->in_body = false;
+    c->failed = false;
+}
+
+/*  FUNCTION: handle_input
+    INPUT:  c, a connection.
+    OUTPUT: void
+
+    Handles the bytes received: the headers are parsed and the text is fed to the context straight from the receive buffer, as it arrives. Only an incomplete header is kept for the next call.
+*/
+static void handle_input(Conn *c)
+{
+    size_t pos = 0;
+    while (pos < c->in_len && !c->closing)
+    {
+        if (!c->in_body)
+        {
+            char *nl = memchr(c->in + pos, '\n', c->in_len - pos);
+            if (nl == NULL)
+            {
+                if (c->in_len - pos > SERVE_HEADER_MAX)
+                {
+                    reply_error(c, "malformed request");
+                    c->closing = true;
+                }
+                break;
+            }
+            *nl = '\0';
+            start_request(c, c->in + pos);
+            pos = nl - c->in + 1;
+        }
+        else
+        {
+            size_t n = c->in_len - pos < c->body_left ? c->in_len - pos : c->body_left;
+            if (!c->failed && split_feed(c->ctx, c->in + pos, n) != SPLIT_OK)
+                reply_error(c, split_error(c->ctx));
+            pos += n;
+            c->body_left -= n;
+        }
+        if (c->in_body && c->body_left == 0 && !c->closing)
+            end_request(c);
+    }
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+}
+
+/*  FUNCTION: close_conn
+    INPUT:  c, a connection.
+    OUTPUT: void
+*/
+static void close_conn(Conn *c)
+{
+    close(c->fd);
+    split_close(c->ctx);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+/*  FUNCTION: open_socket
+    INPUT:  path, the path of the socket.
+    OUTPUT: the listening socket.
+
+    A stale socket left at path by a previous server is replaced, any other file is not. If the socket cannot be created an error message is printed out and the program exits.
+*/
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct stat st;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Error: the socket path %s is too long.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1 ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/*  FUNCTION: serve
+    INPUT:  path, the path of the socket.
+            verbose, whether to print the connections on stderr.
+            cache, the cache of the justified lines, NULL if none.
+    OUTPUT: void
+
+    A poll loop watches the listening socket and the connections. A connection is read while its pending reply is smaller than SERVE_OUT_HIGH, so a client that does not read its pages stops being read instead of growing the reply without bound, and it is written whenever it has pending bytes. A connection closed by the client, or failing, is dropped without affecting the others. If poll fails an error message is printed out and the program exits.
+*/
+void serve(const char *path, bool verbose, Split_cache *cache)
+{
+    int lfd = open_socket(path);
+    struct sigaction sa = {.sa_handler = on_stop};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL); // no SA_RESTART: poll returns at once
+    sigaction(SIGTERM, &sa, NULL);
+    if (verbose)
+        fprintf(stderr, "Listening on %s\n", path);
+
+    Conn **conns = NULL;
+    struct pollfd *fds = NULL;
+    size_t n_conns = 0, cap = 0;
+    while (!stop_serving)
+    {
+        if (cap < n_conns + 1)
+        {
+            cap = cap ? 2 * cap : 16;
+            conns = realloc(conns, cap * sizeof(*conns));
+            fds = realloc(fds, cap * sizeof(*fds));
+            if (conns == NULL || fds == NULL)
+            {
+                perror("Error allocating the connections");
+                exit(EXIT_FAILURE);
+            }
+        }
+        fds[0] = (struct pollfd){.fd = lfd, .events = POLLIN};
+        for (size_t k = 0; k < n_conns; k++)
+        {
+            Conn *c = conns[k];
+            short events = 0;
+            if (!c->closing && c->out_len - c->out_pos < SERVE_OUT_HIGH)
+                events |= POLLIN;
+            if (c->out_len > c->out_pos)
+                events |= POLLOUT;
+            fds[k + 1] = (struct pollfd){.fd = c->fd, .events = events};
+        }
+        if (poll(fds, n_conns + 1, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        // serve the connections, dropping the ones that are done
+        size_t kept = 0;
+        for (size_t k = 0; k < n_conns; k++)
+        {
+            Conn *c = conns[k];
+            short revents = fds[k + 1].revents;
+            bool drop = false;
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                reserve(&c->in, &c->in_cap, c->in_len + SERVE_READ);
+                ssize_t n = recv(c->fd, c->in + c->in_len, SERVE_READ, 0);
+                if (n > 0)
+                {
+                    c->in_len += n;
+                    handle_input(c);
+                }
+                else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+                {
+                    c->closing = true; // the client is gone or has finished sending
+                }
+            }
+            if (c->out_len > c->out_pos)
+            {
+                ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n > 0)
+                    c->out_pos += n;
+                else if (n == -1 && errno != EAGAIN && errno != EINTR)
+                    drop = true;
+                if (c->out_pos == c->out_len)
+                    c->out_pos = c->out_len = 0;
+            }
+            if (drop || (c->closing && c->out_len == 0))
+            {
+                if (verbose)
+                    fprintf(stderr, "Connection %d closed\n", c->fd);
+                close_conn(c);
+            }
+            else
+            {
+                conns[kept++] = c;
+            }
+        }
+        n_conns = kept;
+
+        // accept the new connections
+        if (fds[0].revents & POLLIN)
+        {
+            int fd;
+            while (n_conns + 1 < cap && (fd = accept(lfd, NULL, NULL)) != -1)
+            {
+                Conn *c = calloc(1, sizeof(*c));
+                if (c == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+                {
+                    perror("Error accepting a connection");
+                    exit(EXIT_FAILURE);
+                }
+                c->fd = fd;
+                c->cache = cache;
+                conns[n_conns++] = c;
+                if (verbose)
+                    fprintf(stderr, "Connection %d opened\n", fd);
+            }
+        }
+    }
+
+    for (size_t k = 0; k < n_conns; k++)
+        close_conn(conns[k]);
+    free(conns);
+    free(fds);
+    close(lfd);
+    unlink(path);
+}
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "splittext.h"
+
+#define SERVE_READ (1 << 16)        // bytes received at a time from a client
+#define SERVE_OUT_HIGH (1 << 20)    // pending reply bytes above which a client is not read until they are sent
+#define SERVE_HEADER_MAX 256        // longest request header
+#define SERVE_BODY_MAX (1ULL << 40) // longest text of a request
+
+/*  The protocol of the server, over a stream Unix domain socket. A client sends any number of requests on a connection, each one a header line followed by the text:
+
+        <columns> <rows> <width> <spacing> <length>\n
+        <length bytes of text>
+
+    and the server answers each request, in order, with the pages as soon as they are laid out, then with the outcome:
+
+        P <length>\n<length bytes of a page>     for every page (the last one has no separator)
+        OK\n                                     if the text has been laid out
+        ERR <message>\n                          otherwise, the pages sent before it are the ones completed before the error
+
+    After an ERR the rest of the text is discarded and the connection can be used again, except after a malformed header (a length with a sign, or longer than SERVE_BODY_MAX, is malformed), which closes it.
+*/
+
+/*      The struct contains the state of a connection, kept (with its buffers) from request to request:
+        int fd - the socket.
+        char *in, size_t in_len, in_cap - the bytes received not yet handled, and the capacity of in.
+        char *out, size_t out_pos, out_len, out_cap - the reply: the bytes from out_pos to out_len are still to be sent.
+        Split_ctx *ctx - the layout context, reopened only when a request changes the layout.
+        Split_layout layout - the layout of ctx.
+        size_t body_left - the bytes of the text of the current request still to be received.
+        bool in_body - whether the header of the current request has been received.
+        bool failed - whether the current request failed, its text is discarded.
+        bool closing - whether the connection is closed once the reply has been sent.
+        Split_cache *cache - the cache of the justified lines shared by all the connections, NULL if none.
+*/
+typedef struct Conn
+{
+    int fd;
+    char *in;
+    size_t in_len, in_cap;
+    char *out;
+    size_t out_pos, out_len, out_cap;
+    Split_ctx *ctx;
+    Split_layout layout;
+    size_t body_left;
+    bool in_body;
+    bool failed;
+    bool closing;
+    Split_cache *cache;
+} Conn;
+
+/*  FUNCTION: serve
+    INPUT:  path, the path of the socket.
+            verbose, whether to print the connections on stderr.
+            cache, the cache of the justified lines, NULL if none.
+    OUTPUT: void
+
+    Lays out the texts sent by the clients connected to the socket until SIGINT or SIGTERM, then removes the socket. All the clients are served by a single thread with an event loop, so they can share the cache: a line justified for one client is a hit for the others.
+*/
+void serve(const char *path, bool verbose, Split_cache *cache);
+
+#endif
\ No newline at end of file
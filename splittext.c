@@ -0,0 +1,698 @@
+#include "splittext.h"
+#include "processing.h"
+#include "alloc_utils.h"
+#include "stats.h"
+#include "cache.h"
+
+#define SCRATCH_ROWS 64 // rows of the page where the lines not found in the cache are broken
+
+/*      The struct contains the state of the layout of a text:
+        Split_layout layout - the layout of the pages.
+        int alloc_n_rows - the number of rows of the page (including the new page symbol).
+        Span_page page - the page being filled, as pieces of text.
+        Pr_data pos_data - the position on the page and in the current line.
+        bool empty_line - whether the last line was empty.
+        char *text, size_t text_len, text_cap - the text the page refers to (the tokenized lines laid out on it and the rows taken from the cache), its length and capacity.
+        char *line - the current line, tokenized, in text.
+        bool streaming - whether the current line is longer than the window and is being laid out in pieces.
+        size_t line_base, line_words - for a line laid out in pieces, the bytes of its tokenized words dropped from text before line, and its words so far.
+        size_t window - the longest piece of a line tokenized at once.
+        char *carry, size_t carry_len, carry_cap - the part of a line received without its newline, its length and capacity.
+        char *out, size_t out_cap - the buffer where a page is rendered for the sink, and its capacity.
+        Split_sink sink, void *sink_ctx - the receiver of the pages.
+        Split_status status - the last error, SPLIT_OK if none.
+        char *message - the description of the last error, allocated only for SPLIT_ERR_WORD.
+        Split_cache *cache - the cache of the justified lines, NULL if none.
+        Page scratch - the single column page where the lines missing from the cache are broken into rows.
+        Line_rows rows - the rows of the last line missing from the cache.
+        unsigned long long n_paras, in_pos, line_in - the lines of the text received so far, their bytes, and the offset of the current line.
+        Split_origin origin - where the text of the page being filled starts.
+        unsigned long long page_no - the pages of the text completed so far.
+        unsigned long long first_page, last_page - the pages passed to the sink (see split_set_pages).
+        unsigned long long text_pages - the pages of the last text finished.
+        Proc_stats *stats - the counters of the context, NULL if it is not measured (see split_set_stats).
+*/
+struct Split_ctx
+{
+    Split_layout layout;
+    int alloc_n_rows;
+    Span_page page;
+    Pr_data pos_data;
+    bool empty_line;
+    char *text;
+    size_t text_len, text_cap;
+    char *line;
+    bool streaming;
+    size_t line_base, line_words;
+    size_t window;
+    char *carry;
+    size_t carry_len, carry_cap;
+    char *out;
+    size_t out_cap;
+    Split_sink sink;
+    void *sink_ctx;
+    Split_status status;
+    char *message;
+    Split_cache *cache;
+    Page scratch;
+    Line_rows rows;
+    unsigned long long n_paras, in_pos, line_in;
+    Split_origin origin;
+    unsigned long long page_no;
+    unsigned long long first_page, last_page;
+    unsigned long long text_pages;
+    Proc_stats *stats;
+};
+
+/*  FUNCTION: fail
+    INPUT:  ctx, a context.
+            status, an error code.
+    OUTPUT: status.
+
+    Records the error, the next calls return it until the context is reset.
+*/
+static Split_status fail(Split_ctx *ctx, Split_status status)
+{
+    ctx->status = status;
+    return status;
+}
+
+/*  FUNCTION: emit_page
+    INPUT:  ctx, a context.
+            next, where the text of the next page starts, NULL after the last page.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_NOMEM or SPLIT_ERR_SINK.
+
+    The rows of the page, up to the first empty one, are rendered from their pieces in the output buffer, each one followed by a newline, and passed to the sink; a page followed by another one ends with the separator. The words are copied only here, once, and the buffer grows to the largest page actually seen. Nothing is passed if the page is empty. The page is then cleared.
+*/
+static Split_status emit_page(Split_ctx *ctx, const Split_origin *next)
+{
+    Span_page *page = &ctx->page;
+    int stop = 0;
+    counters_begin(ctx->stats, STAGE_OUTPUT);
+    if (page->bytes > 0)
+    {
+        if (reserve_buffer(&ctx->out, &ctx->out_cap, page->bytes + ctx->alloc_n_rows + 1 + strlen(NEW_PAGE)) == -1)
+        {
+            counters_end(ctx->stats, STAGE_OUTPUT);
+            return fail(ctx, SPLIT_ERR_NOMEM);
+        }
+        size_t len = render_span_page(page, ctx->text, next != NULL ? NEW_PAGE : NULL, ctx->out);
+        stop = ctx->sink(ctx->sink_ctx, ctx->out, len);
+        if (ctx->stats != NULL)
+            ctx->stats->pages++;
+    }
+    clear_span_page(page);
+    if (next != NULL)
+        ctx->origin = *next;
+    counters_end(ctx->stats, STAGE_OUTPUT);
+    return stop ? fail(ctx, SPLIT_ERR_SINK) : SPLIT_OK;
+}
+
+/*  FUNCTION: next_origin
+    INPUT:  ctx, a context whose page has just been filled by the current line.
+            word, the first word of the current line not laid out.
+    OUTPUT: where the text of the next page starts: the rest of the current line, or the next line if none is left.
+*/
+static Split_origin next_origin(const Split_ctx *ctx, const char *word)
+{
+    if (*word == '\0')
+        return (Split_origin){.para = ctx->n_paras, .in_offset = ctx->in_pos, .word_offset = 0, .after_empty = ctx->empty_line};
+    return (Split_origin){.para = ctx->n_paras - 1, .in_offset = ctx->line_in, .word_offset = ctx->line_base + (word - ctx->line), .after_empty = ctx->empty_line};
+}
+
+/*  FUNCTION: word_error
+    INPUT:  ctx, a context.
+            word, the word larger than a column.
+            len, the length of the word.
+    OUTPUT: SPLIT_ERR_WORD.
+
+    The description of the error contains the whole word, if the memory for it cannot be allocated split_error falls back to the generic description.
+*/
+static Split_status word_error(Split_ctx *ctx, const char *word, size_t len)
+{
+    const char *fmt = "read a word (%.*s) larger (%lu) than a column (%d)";
+    int n = snprintf(NULL, 0, fmt, (int)len, word, len, ctx->layout.col_width);
+    free(ctx->message);
+    ctx->message = malloc(n + 1);
+    if (ctx->message != NULL)
+        snprintf(ctx->message, n + 1, fmt, (int)len, word, len, ctx->layout.col_width);
+    return fail(ctx, SPLIT_ERR_WORD);
+}
+
+/*  FUNCTION: rows_word_offset
+    INPUT:  line, a processed line.
+            rows, the rows of the line.
+            n, the number of rows laid out.
+    OUTPUT: the offset in line of the first word of the row n.
+
+    The rows hold whole words, so the words of the first n rows are counted and skipped in the line.
+*/
+static size_t rows_word_offset(const char *line, const Line_rows *rows, size_t n)
+{
+    size_t words = 0;
+    for (size_t r = 0; r < n; r++)
+    {
+        bool in_word = false;
+        for (const char *p = rows->rows + (r ? rows->ends[r - 1] : 0); p < rows->rows + rows->ends[r]; p++)
+        {
+            if (*p != ' ' && !in_word)
+                words++;
+            in_word = *p != ' ';
+        }
+    }
+    const char *q = line;
+    while (words-- > 0 && (q = strchr(q, ' ')) != NULL)
+        q++;
+    return q != NULL ? (size_t)(q - line) : strlen(line);
+}
+
+/*  FUNCTION: place_cached
+    INPUT:  ctx, a context with a cache.
+    OUTPUT: SPLIT_OK or an error code.
+
+    The current line (not a discarded empty line) is looked up in the cache; if it is missing it is broken into rows, as process_one_line would write them, and added. Then its rows are copied after the line in the text of the page, which must outlive the entry, and placed on the pages one by one: an empty line becomes a row of spaces unless it falls at the top of a column, as in the single process version.
+*/
+static Split_status place_cached(Split_ctx *ctx)
+{
+    const Split_layout *l = &ctx->layout;
+    const Line_rows *rows = NULL;
+    size_t n, rows_off = ctx->text_len;
+    counters_begin(ctx->stats, STAGE_LAYOUT);
+    if (ctx->line[0] == '\n')
+        n = ctx->pos_data.i != 0;
+    else
+    {
+        size_t len = strlen(ctx->line);
+        rows = cache_lookup(ctx->cache, ctx->line, len, l->col_width);
+        if (ctx->stats != NULL && rows != NULL)
+            ctx->stats->cache_hits++;
+        else if (ctx->stats != NULL)
+            ctx->stats->cache_misses++;
+        if (rows == NULL)
+        {
+            if (break_line(ctx->line, l->col_width, &ctx->scratch, &ctx->rows) == -1 ||
+                cache_insert(ctx->cache, ctx->line, len, l->col_width, &ctx->rows) == -1)
+            {
+                counters_end(ctx->stats, STAGE_LAYOUT);
+                return fail(ctx, SPLIT_ERR_NOMEM);
+            }
+            rows = &ctx->rows;
+        }
+        n = rows->n_rows;
+        size_t line_off = ctx->line - ctx->text;
+        if (reserve_buffer(&ctx->text, &ctx->text_cap, rows_off + rows->rows_len) == -1)
+        {
+            counters_end(ctx->stats, STAGE_LAYOUT);
+            return fail(ctx, SPLIT_ERR_NOMEM);
+        }
+        ctx->line = ctx->text + line_off;
+        memcpy(ctx->text + rows_off, rows->rows, rows->rows_len);
+        ctx->text_len = rows_off + rows->rows_len;
+    }
+    for (size_t r = 0; r < n; r++)
+    {
+        if (rows == NULL)
+            ctx->pos_data = span_row(l->n_cols, l->n_rows, l->spacing, &ctx->page, ctx->pos_data, 0, 0, l->col_width);
+        else
+        {
+            size_t start = (r == 0) ? 0 : rows->ends[r - 1];
+            ctx->pos_data = span_row(l->n_cols, l->n_rows, l->spacing, &ctx->page, ctx->pos_data, rows_off + start, rows->ends[r] - start, 0);
+        }
+        if (ctx->pos_data.i == 0 && ctx->pos_data.j == 0)
+        { // the page is ended: pass it to the sink
+            Split_origin next = next_origin(ctx, ctx->line + ((rows == NULL || r + 1 == n) ? strlen(ctx->line) : rows_word_offset(ctx->line, rows, r + 1)));
+            ctx->page_no++;
+            counters_end(ctx->stats, STAGE_LAYOUT);
+            if (emit_page(ctx, &next) != SPLIT_OK)
+                return ctx->status;
+            counters_begin(ctx->stats, STAGE_LAYOUT);
+        }
+    }
+    counters_end(ctx->stats, STAGE_LAYOUT);
+    return SPLIT_OK;
+}
+
+/*  FUNCTION: drop_text
+    INPUT:  ctx, a context laying out a line in pieces, whose page has just been passed to the sink.
+    OUTPUT: void
+
+    Nothing refers to the text before the position any more: it is dropped once it is larger than the rest, so that moving the rest costs no more than the text laid out since the last time.
+*/
+static void drop_text(Split_ctx *ctx)
+{
+    Pr_data *pos = &ctx->pos_data;
+    size_t dead = pos->line_ptr - ctx->text;
+    if (dead == 0 || dead < ctx->text_len - dead)
+        return;
+    ctx->line_base += pos->line_ptr - ctx->line;
+    memmove(ctx->text, pos->line_ptr, ctx->text_len - dead + 1);
+    ctx->text_len -= dead;
+    ctx->line = ctx->text;
+    pos->line_ptr = ctx->text;
+    pos->line_end -= dead;
+    if (pos->line_stop != NULL)
+        pos->line_stop -= dead;
+}
+
+/*  FUNCTION: place_line
+    INPUT:  ctx, a context whose position points into the current line.
+    OUTPUT: SPLIT_OK or an error code.
+
+    The line is laid out on the pages from the position to its end, or to pos_data.line_stop for a line given in pieces: every page filled gets the separator and is passed to the sink, and the pages before the first one wanted are only measured. This is the loop of the single process version of split_text.
+*/
+static Split_status place_line(Split_ctx *ctx)
+{
+    // fill pages until there are words in the line, or until the last page wanted
+    while (*ctx->pos_data.line_ptr != '\0' && ctx->page_no < ctx->last_page &&
+           (ctx->pos_data.line_stop == NULL || ctx->pos_data.line_ptr < ctx->pos_data.line_stop))
+    {
+        bool measure = ctx->page_no + 1 < ctx->first_page; // a page before the range is not built
+        counters_begin(ctx->stats, STAGE_LAYOUT);
+        if (measure)
+            ctx->pos_data = skip_one_line(ctx->layout.n_cols, ctx->layout.col_width, ctx->layout.n_rows, ctx->pos_data);
+        else
+            ctx->pos_data = span_one_line(ctx->layout.n_cols, ctx->layout.col_width, ctx->layout.n_rows, ctx->layout.spacing, &ctx->page, ctx->text, ctx->pos_data);
+        counters_end(ctx->stats, STAGE_LAYOUT);
+        if (ctx->pos_data.i == 0 && ctx->pos_data.j == 0)
+        { // the page is ended: pass it to the sink
+            Split_origin next = next_origin(ctx, ctx->pos_data.line_ptr);
+            ctx->page_no++;
+            if (measure)
+            { // the page is counted although it is not built
+                ctx->origin = next;
+                if (ctx->stats != NULL)
+                    ctx->stats->pages++;
+            }
+            else if (emit_page(ctx, &next) != SPLIT_OK)
+                return ctx->status;
+            if (ctx->streaming)
+                drop_text(ctx);
+        }
+    }
+    return SPLIT_OK;
+}
+
+/*  FUNCTION: lay_out_line
+    INPUT:  ctx, a context.
+            raw, a raw line (not null terminated).
+            len, the number of bytes of the line, its newline included.
+    OUTPUT: SPLIT_OK or an error code.
+
+    The line is tokenized, duplicate empty lines and empty lines at the top of a page are discarded, then the line is laid out on the pages by place_line; with a cache the line goes through place_cached instead.
+
+    The page refers to the lines laid out on it, so the line is tokenized after them in the text of the page; the text starts again from the beginning with the first line of a page.
+*/
+static Split_status lay_out_line(Split_ctx *ctx, const char *raw, size_t len)
+{
+    const char *long_word;
+    size_t long_len;
+
+    counters_begin(ctx->stats, STAGE_READ);
+    if (ctx->pos_data.i == 0 && ctx->pos_data.j == 0) // nothing refers to the text
+        ctx->text_len = 0;
+    // the processed line is at most as long as the raw line + '\n' + '\0'
+    if (reserve_buffer(&ctx->text, &ctx->text_cap, ctx->text_len + len + 2) == -1)
+    {
+        counters_end(ctx->stats, STAGE_READ);
+        return fail(ctx, SPLIT_ERR_NOMEM);
+    }
+    ctx->line = ctx->text + ctx->text_len;
+    ctx->line_base = 0;
+    ctx->text_len += len + 2;
+    int cnt = tokenize_line(raw, raw + len, ctx->line, ctx->layout.col_width, &long_word, &long_len);
+    counters_line(ctx->stats, len, cnt);
+    ctx->line_in = ctx->in_pos;
+    ctx->in_pos += len;
+    ctx->n_paras++;
+    counters_end(ctx->stats, STAGE_READ);
+    if (cnt < 0)
+        return word_error(ctx, long_word, long_len);
+
+    // skip if more than one empty line is found
+    if (process_empty_line(&ctx->line, &ctx->empty_line, ctx->pos_data))
+        return SPLIT_OK;
+    if (ctx->cache != NULL && ctx->first_page == 1 && ctx->last_page == SPLIT_END)
+        return place_cached(ctx);
+    ctx->pos_data = start_line(ctx->pos_data, ctx->line);
+    return place_line(ctx);
+}
+
+/*  FUNCTION: stream_piece
+    INPUT:  ctx, a context.
+            raw, a piece of a line longer than the window (not null terminated).
+            len, the number of bytes of the piece.
+            last, whether the piece ends the line.
+            used, where the number of bytes of the piece consumed is stored.
+    OUTPUT: SPLIT_OK or an error code.
+
+    A long line is laid out a piece at a time, so that its memory is bounded by the window and the page instead of its length. Unless the piece ends the line its last word may go on in the next piece: the piece is consumed up to its last blank (nothing, if the word may still fit a column), and the rows are laid out only up to where the next words could change them, about four columns of bytes before the end of the words received (see span_one_line). The words are tokenized after the rest of the line not laid out yet, separated by a space: the tokenized line, hence the pages, are the same as if the line had been tokenized whole. The cache is not used for such lines.
+*/
+static Split_status stream_piece(Split_ctx *ctx, const char *raw, size_t len, bool last, size_t *used)
+{
+    const char *long_word;
+    size_t long_len;
+    Pr_data *pos = &ctx->pos_data;
+    size_t n = len;
+
+    if (!last)
+    {
+        while (n > 0 && !is_blank(raw[n - 1]))
+            n--;
+        if (n == 0 && len <= (size_t)ctx->layout.col_width)
+        {
+            *used = 0;
+            return SPLIT_OK;
+        }
+        if (n == 0) // a word larger than a column, found by tokenize_line
+            n = len;
+    }
+    *used = n;
+
+    counters_begin(ctx->stats, STAGE_READ);
+    size_t line_off, ptr_off = 0;
+    if (!ctx->streaming)
+    { // the first piece of the line
+        if (pos->i == 0 && pos->j == 0) // nothing refers to the text
+            ctx->text_len = 0;
+        line_off = ctx->text_len;
+        ctx->streaming = true;
+        ctx->line_base = ctx->line_words = 0;
+        ctx->line_in = ctx->in_pos;
+        ctx->n_paras++;
+    }
+    else
+    {
+        line_off = ctx->line - ctx->text;
+        ptr_off = pos->line_ptr - ctx->text;
+    }
+    if (reserve_buffer(&ctx->text, &ctx->text_cap, ctx->text_len + n + 2) == -1)
+    {
+        counters_end(ctx->stats, STAGE_READ);
+        return fail(ctx, SPLIT_ERR_NOMEM);
+    }
+    ctx->line = ctx->text + line_off;
+    char *dst = ctx->text + ctx->text_len;
+    int cnt = tokenize_line(raw, raw + n, dst, ctx->layout.col_width, &long_word, &long_len);
+    ctx->in_pos += n;
+    if (cnt < 0)
+    {
+        counters_end(ctx->stats, STAGE_READ);
+        return word_error(ctx, long_word, long_len);
+    }
+    size_t tok_len = strlen(dst);
+    if (cnt > 0 && !last) // the line goes on
+        dst[tok_len - 1] = ' ';
+    else if (cnt == 0 && last && ctx->line_words > 0) // the line ends with the words of the previous piece
+        dst[-1] = '\n';
+    ctx->text_len += tok_len;
+    ctx->line_words += cnt;
+    if (last)
+        counters_line(ctx->stats, ctx->in_pos - ctx->line_in, ctx->line_words);
+    counters_end(ctx->stats, STAGE_READ);
+
+    Split_status status = SPLIT_OK;
+    if (ctx->line_words == 0)
+    { // no word so far: wait for one, or it is an empty line
+        if (last)
+        {
+            ctx->streaming = false;
+            ctx->text_len += 2; // the empty line may become "\n"
+            if (!process_empty_line(&ctx->line, &ctx->empty_line, *pos))
+            {
+                *pos = start_line(*pos, ctx->line);
+                status = place_line(ctx);
+            }
+        }
+        return status;
+    }
+    if (ctx->line_words == (size_t)cnt)
+    { // the first words of the line
+        ctx->empty_line = false;
+        *pos = start_line(*pos, ctx->line);
+    }
+    else
+    {
+        pos->line_ptr = ctx->text + ptr_off;
+        pos->line_end = ctx->text + ctx->text_len;
+        pos->ascii = is_ascii_text(pos->line_ptr, pos->line_end);
+    }
+    // a row may read up to a column of characters after its start, and the character after them
+    size_t guard = (size_t)UTF8_MAX_BYTES * (ctx->layout.col_width + 1) + 1;
+    if (last)
+        pos->line_stop = NULL;
+    else
+        pos->line_stop = (size_t)(pos->line_end - pos->line_ptr) > guard ? pos->line_end - guard : pos->line_ptr;
+    status = place_line(ctx);
+    if (last)
+        ctx->streaming = false;
+    return status;
+}
+
+/*  FUNCTION: split_open
+    INPUT:  ctx, where to store the new context.
+            layout, the layout of the pages.
+            sink, the function receiving the pages.
+            sink_ctx, the first argument passed to sink.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_LAYOUT or SPLIT_ERR_NOMEM.
+
+    The page is allocated once for the whole life of the context, the text it refers to and the buffer where it is rendered grow with the lines and the pages.
+*/
+Split_status split_open(Split_ctx **ctx, const Split_layout *layout, Split_sink sink, void *sink_ctx)
+{
+    *ctx = NULL;
+    if (layout->n_cols < 1 || layout->n_rows < 1 || layout->col_width < 1 || layout->spacing < 0 || sink == NULL)
+        return SPLIT_ERR_LAYOUT;
+    size_t width = row_capacity(layout->n_cols, layout->col_width, layout->spacing);
+    if (width < strlen(NEW_PAGE))
+        return SPLIT_ERR_LAYOUT;
+
+    Split_ctx *c = calloc(1, sizeof(*c));
+    if (c == NULL)
+        return SPLIT_ERR_NOMEM;
+    c->layout = *layout;
+    c->alloc_n_rows = layout->n_rows + 1; // one extra line for the newpage symbol
+    c->sink = sink;
+    c->sink_ctx = sink_ctx;
+    c->first_page = 1;
+    c->last_page = SPLIT_END;
+    c->window = LINE_WINDOW;
+    if (c->window <= (size_t)layout->col_width) // the window must hold a word
+        c->window = 2 * (size_t)layout->col_width;
+    if (init_span_page(&c->page, layout->n_rows, layout->n_cols) == -1)
+    {
+        free(c);
+        return SPLIT_ERR_NOMEM;
+    }
+    *ctx = c;
+    return SPLIT_OK;
+}
+
+/*  FUNCTION: split_set_cache
+    INPUT:  ctx, a context.
+            cache, a cache, NULL to stop using one.
+    OUTPUT: SPLIT_OK or SPLIT_ERR_NOMEM.
+
+    The scratch page is allocated the first time a cache is set.
+*/
+Split_status split_set_cache(Split_ctx *ctx, Split_cache *cache)
+{
+    if (cache != NULL && ctx->scratch.rows == NULL &&
+        init_page(&ctx->scratch, SCRATCH_ROWS, row_capacity(1, ctx->layout.col_width, 0)) == -1)
+        return SPLIT_ERR_NOMEM;
+    ctx->cache = cache;
+    return SPLIT_OK;
+}
+
+/*  FUNCTION: split_feed
+    INPUT:  ctx, a context.
+            buf, the next piece of the text.
+            len, the number of bytes of the piece.
+    OUTPUT: SPLIT_OK or an error code.
+
+    The complete lines are laid out straight from buf. Only a line split between two pieces is copied: its beginning is kept in the carry buffer and completed by the next piece. A line longer than the window is laid out in pieces by stream_piece, straight from buf a window at a time or from the carry buffer whenever it holds a window, so that neither the carry buffer nor the text grows with the length of the line.
+*/
+Split_status split_feed(Split_ctx *ctx, const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    while (ctx->status == SPLIT_OK && buf < end && ctx->page_no < ctx->last_page)
+    {
+        const char *nl = memchr(buf, '\n', end - buf);
+        size_t n = (nl != NULL) ? (size_t)(nl - buf) + 1 : (size_t)(end - buf);
+        if (ctx->carry_len == 0 && n > ctx->window)
+        {
+            stream_piece(ctx, buf, ctx->window, false, &n);
+        }
+        else if (ctx->carry_len == 0 && nl != NULL)
+        {
+            if (ctx->streaming)
+                stream_piece(ctx, buf, n, true, &n);
+            else
+                lay_out_line(ctx, buf, n);
+        }
+        else
+        { // append to the carry buffer, the line is laid out once its newline arrives
+            if (n > ctx->window - ctx->carry_len)
+            { // up to a window, then the line is laid out in pieces
+                n = ctx->window - ctx->carry_len;
+                nl = NULL;
+            }
+            if (reserve_buffer(&ctx->carry, &ctx->carry_cap, ctx->carry_len + n) == -1)
+                return fail(ctx, SPLIT_ERR_NOMEM);
+            memcpy(ctx->carry + ctx->carry_len, buf, n);
+            ctx->carry_len += n;
+            if (nl != NULL)
+            {
+                size_t used;
+                if (ctx->streaming)
+                    stream_piece(ctx, ctx->carry, ctx->carry_len, true, &used);
+                else
+                    lay_out_line(ctx, ctx->carry, ctx->carry_len);
+                ctx->carry_len = 0;
+            }
+            else if (ctx->carry_len == ctx->window)
+            { // keep only the word the next piece may complete
+                size_t used;
+                stream_piece(ctx, ctx->carry, ctx->carry_len, false, &used);
+                memmove(ctx->carry, ctx->carry + used, ctx->carry_len - used);
+                ctx->carry_len -= used;
+            }
+        }
+        buf += n;
+    }
+    return ctx->status;
+}
+
+/*  FUNCTION: split_finish
+    INPUT:  ctx, a context.
+    OUTPUT: SPLIT_OK or an error code.
+*/
+Split_status split_finish(Split_ctx *ctx)
+{
+    size_t used;
+    if (ctx->status == SPLIT_OK && ctx->streaming) // the last line lacks the newline
+        stream_piece(ctx, ctx->carry, ctx->carry_len, true, &used);
+    else if (ctx->status == SPLIT_OK && ctx->carry_len > 0)
+        lay_out_line(ctx, ctx->carry, ctx->carry_len);
+    // the last page, if not empty, counts even when it is not passed to the sink
+    ctx->text_pages = ctx->page_no + (ctx->pos_data.i != 0 || ctx->pos_data.j != 0);
+    if (ctx->stats != NULL && ctx->text_pages > ctx->page_no && ctx->page_no + 1 < ctx->first_page)
+        ctx->stats->pages++; // the last page is only measured, emit_page does not count it
+    if (ctx->status == SPLIT_OK)
+        emit_page(ctx, NULL);
+    if (ctx->status != SPLIT_OK)
+        return ctx->status;
+    split_reset(ctx);
+    return SPLIT_OK;
+}
+
+/*  FUNCTION: split_set_pages
+    INPUT:  ctx, a context.
+            first, last, the first and the last page passed to the sink.
+    OUTPUT: void
+*/
+void split_set_pages(Split_ctx *ctx, unsigned long long first, unsigned long long last)
+{
+    ctx->first_page = first;
+    ctx->last_page = last;
+}
+
+/*  FUNCTION: split_set_stats
+    INPUT:  ctx, a context.
+            counters, the counters the context updates, NULL to stop measuring it.
+    OUTPUT: void
+*/
+void split_set_stats(Split_ctx *ctx, Proc_stats *counters)
+{
+    ctx->stats = counters;
+}
+
+/*  FUNCTION: split_page_count
+    INPUT:  ctx, a context.
+    OUTPUT: the number of pages of the last text finished.
+*/
+unsigned long long split_page_count(const Split_ctx *ctx)
+{
+    return ctx->text_pages;
+}
+
+/*  FUNCTION: split_page_origin
+    INPUT:  ctx, a context.
+            origin, where the origin is stored.
+    OUTPUT: void
+*/
+void split_page_origin(const Split_ctx *ctx, Split_origin *origin)
+{
+    *origin = ctx->origin;
+}
+
+/*  FUNCTION: split_reset
+    INPUT:  ctx, a context.
+    OUTPUT: void
+*/
+void split_reset(Split_ctx *ctx)
+{
+    clear_span_page(&ctx->page);
+    ctx->pos_data = (Pr_data){.line_ptr = NULL, .i = 0, .j = 0};
+    ctx->empty_line = false;
+    ctx->streaming = false;
+    ctx->carry_len = 0;
+    ctx->n_paras = ctx->in_pos = 0;
+    ctx->page_no = 0;
+    ctx->origin = (Split_origin){0};
+    ctx->status = SPLIT_OK;
+    free(ctx->message);
+    ctx->message = NULL;
+}
+
+/*  FUNCTION: split_close
+    INPUT:  ctx, a context or NULL.
+    OUTPUT: void
+*/
+void split_close(Split_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    free_span_page(&ctx->page);
+    free(ctx->text);
+    free(ctx->carry);
+    free(ctx->out);
+    free(ctx->message);
+    free_page(&ctx->scratch);
+    free_line_rows(&ctx->rows);
+    free(ctx);
+}
+
+/*  FUNCTION: split_error
+    INPUT:  ctx, a context.
+    OUTPUT: a description of the last error.
+*/
+const char *split_error(const Split_ctx *ctx)
+{
+    if (ctx->status == SPLIT_ERR_WORD && ctx->message != NULL)
+        return ctx->message;
+    return split_strerror(ctx->status);
+}
+
+/*  FUNCTION: split_strerror
+    INPUT:  status, a code returned by the library.
+    OUTPUT: a description of the code.
+*/
+const char *split_strerror(Split_status status)
+{
+    switch (status)
+    {
+    case SPLIT_OK:
+        return "success";
+    case SPLIT_ERR_LAYOUT:
+        return "invalid layout";
+    case SPLIT_ERR_NOMEM:
+        return "out of memory";
+    case SPLIT_ERR_WORD:
+        return "a word is larger than a column";
+    case SPLIT_ERR_SINK:
+        return "the page sink stopped the layout";
+    case SPLIT_ERR_IO:
+        return "the cache file could not be read or written";
+    }
+    return "unknown error";
+}
\ No newline at end of file
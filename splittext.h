@@ -0,0 +1,228 @@
+#ifndef SPLITTEXT_H
+#define SPLITTEXT_H
+
+#include <stddef.h>
+
+#define SPLIT_API __attribute__((visibility("default"))) // the library is built with -fvisibility=hidden, only the split_ functions are exported
+
+/*  libsplittext: the layout engine of split_text as a library.
+
+    A context holds the layout and the position on the current page. The text is given in pieces of any size by split_feed (the pieces do not need to end at a newline) and every page is handed, as soon as it is complete, to a sink supplied by the caller; split_finish ends the text and hands over the last page. The library never terminates the program, never forks and never touches the standard streams: errors are returned as codes.
+
+        Split_ctx *ctx;
+        Split_layout layout = {.n_cols = 3, .n_rows = 47, .col_width = 22, .spacing = 10};
+        if (split_open(&ctx, &layout, my_sink, my_data) == SPLIT_OK)
+        {
+            ... split_feed(ctx, buf, len) for each piece of the text ...
+            split_finish(ctx);
+            split_close(ctx);
+        }
+*/
+
+/*      The codes returned by the functions of the library:
+        SPLIT_OK - success.
+        SPLIT_ERR_LAYOUT - the layout is not valid (a value smaller than 1, or a page too narrow for the page separator).
+        SPLIT_ERR_NOMEM - the memory could not be allocated.
+        SPLIT_ERR_WORD - a word is larger than a column, split_error tells which one.
+        SPLIT_ERR_SINK - the sink asked to stop.
+        SPLIT_ERR_IO - a cache file could not be read or written, or is not a cache file.
+
+        After an error the context keeps returning the same code until split_reset is called.
+*/
+typedef enum Split_status
+{
+    SPLIT_OK = 0,
+    SPLIT_ERR_LAYOUT,
+    SPLIT_ERR_NOMEM,
+    SPLIT_ERR_WORD,
+    SPLIT_ERR_SINK,
+    SPLIT_ERR_IO
+} Split_status;
+
+/*      The struct contains the layout of the pages:
+        int n_cols - the number of columns.
+        int n_rows - the number of rows per page.
+        int col_width - the width of a column (number of visible characters).
+        int spacing - the number of space characters between columns.
+*/
+typedef struct Split_layout
+{
+    int n_cols;
+    int n_rows;
+    int col_width;
+    int spacing;
+} Split_layout;
+
+/*  The sink receives a whole page: its rows, each one followed by '\n', and the page separator if the page is full. The page is valid only during the call. A sink returns 0 to go on, anything else to stop the layout with SPLIT_ERR_SINK.
+*/
+typedef int (*Split_sink)(void *sink_ctx, const char *page, size_t len);
+
+/*      The struct contains where the text of a page starts in the input, enough to lay out the rest of the text from the page on:
+        unsigned long long para - the paragraph (input line, counted from 0) holding the first word of the page.
+        unsigned long long in_offset - the offset in the input of the paragraph.
+        unsigned long long word_offset - the offset of the first word in the tokenized paragraph (its words separated by single spaces), 0 if the page starts with the paragraph.
+        int after_empty - whether the last paragraph laid out before the page was an empty line (so a following empty line is discarded).
+*/
+typedef struct Split_origin
+{
+    unsigned long long para;
+    unsigned long long in_offset;
+    unsigned long long word_offset;
+    int after_empty;
+} Split_origin;
+
+typedef struct Split_ctx Split_ctx;
+
+#define SPLIT_END (~0ULL) // a page number after the last page of any text
+
+typedef struct Split_cache Split_cache;
+
+/*  FUNCTION: split_open
+    INPUT:  ctx, where to store the new context.
+            layout, the layout of the pages.
+            sink, the function receiving the pages.
+            sink_ctx, the first argument passed to sink.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_LAYOUT or SPLIT_ERR_NOMEM.
+*/
+SPLIT_API Split_status split_open(Split_ctx **ctx, const Split_layout *layout, Split_sink sink, void *sink_ctx);
+
+/*  FUNCTION: split_feed
+    INPUT:  ctx, a context.
+            buf, the next piece of the text (UTF-8).
+            len, the number of bytes of the piece.
+    OUTPUT: SPLIT_OK or an error code.
+
+    Lays out the complete lines of the piece, passing the pages filled to the sink. A line not ended by the piece is kept until the next call. A line longer than 1 MiB is laid out a piece at a time as it arrives, so the memory used does not depend on the length of the lines; a word too large for a column is then found after the pages before it have been passed.
+*/
+SPLIT_API Split_status split_feed(Split_ctx *ctx, const char *buf, size_t len);
+
+/*  FUNCTION: split_finish
+    INPUT:  ctx, a context.
+    OUTPUT: SPLIT_OK or an error code.
+
+    Lays out the last line (if it lacks the newline) and passes the last page, if not empty, to the sink. Then the context is ready for a new text with the same layout.
+*/
+SPLIT_API Split_status split_finish(Split_ctx *ctx);
+
+/*  FUNCTION: split_set_pages
+    INPUT:  ctx, a context.
+            first, last, the first and the last page (counted from 1) passed to the sink, SPLIT_END for last to go to the end of the text.
+    OUTPUT: void
+
+    The pages before first are only measured: the lines are broken into rows and the rows counted, but no row is written or justified, so they cost little more than reading the text. After the page last the rest of the text is ignored. With first set to SPLIT_END no page is passed to the sink and split_page_count tells how many there are. The cache is not used while a range is set. By default all the pages are passed.
+*/
+SPLIT_API void split_set_pages(Split_ctx *ctx, unsigned long long first, unsigned long long last);
+
+struct Proc_stats; // the counters of stats.h
+
+/*  FUNCTION: split_set_stats
+    INPUT:  ctx, a context.
+            counters, the counters the context updates, NULL to stop measuring it.
+    OUTPUT: void
+
+    Makes the context measure its stages, lines, paragraphs, pages and cache hits on the counters (those of -P in split_text). By default a context is not measured, and the counters are not shared with other contexts unless the caller does so, on a single thread. Only the allocations are counted for the whole process, by stats_alloc.
+*/
+SPLIT_API void split_set_stats(Split_ctx *ctx, struct Proc_stats *counters);
+
+/*  FUNCTION: split_page_count
+    INPUT:  ctx, a context.
+    OUTPUT: the number of pages of the last text ended by split_finish (up to the last page of the range, if one is set).
+*/
+SPLIT_API unsigned long long split_page_count(const Split_ctx *ctx);
+
+/*  FUNCTION: split_page_origin
+    INPUT:  ctx, a context.
+            origin, where the origin is stored.
+    OUTPUT: void
+
+    Called by the sink, tells where the text of the page it receives starts. The offsets count from the start of the text (the first split_feed since the context was opened, finished or reset).
+*/
+SPLIT_API void split_page_origin(const Split_ctx *ctx, Split_origin *origin);
+
+/*  FUNCTION: split_reset
+    INPUT:  ctx, a context.
+    OUTPUT: void
+
+    Discards the text laid out so far (and the error, if any), the context is ready for a new text.
+*/
+SPLIT_API void split_reset(Split_ctx *ctx);
+
+/*  FUNCTION: split_close
+    INPUT:  ctx, a context or NULL.
+    OUTPUT: void
+
+    Frees the context, the page not yet passed to the sink is discarded.
+*/
+SPLIT_API void split_close(Split_ctx *ctx);
+
+/*  A cache remembers the rows every line has been justified into, for each column width, so that a line seen before is only placed on the page. It can be shared by several contexts of the same thread (it is not thread safe) and saved to a file, to be reused by later runs:
+
+        Split_cache *cache;
+        if (split_cache_open(&cache, "lines.cache") == SPLIT_OK)
+        {
+            split_set_cache(ctx, cache);
+            ... split_feed, split_finish ...
+            split_cache_save(cache);
+            split_close(ctx);
+            split_cache_close(cache);
+        }
+
+    The file is in the byte order of the machine that wrote it.
+*/
+
+/*  FUNCTION: split_cache_open
+    INPUT:  cache, where to store the new cache.
+            path, the cache file, NULL for a cache in memory only.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_IO or SPLIT_ERR_NOMEM.
+
+    The lines of the file are loaded if it exists, otherwise the cache starts empty.
+*/
+SPLIT_API Split_status split_cache_open(Split_cache **cache, const char *path);
+
+/*  FUNCTION: split_cache_save
+    INPUT:  cache, a cache.
+    OUTPUT: SPLIT_OK, SPLIT_ERR_IO or SPLIT_ERR_NOMEM.
+
+    Replaces the cache file with the lines of the cache. Does nothing for a cache in memory only.
+*/
+SPLIT_API Split_status split_cache_save(Split_cache *cache);
+
+/*  FUNCTION: split_cache_counters
+    INPUT:  cache, a cache.
+            hits, where the number of lines found in the cache is stored.
+            misses, where the number of lines not found, and justified, is stored.
+            entries, where the number of lines in the cache is stored.
+    OUTPUT: void
+*/
+SPLIT_API void split_cache_counters(const Split_cache *cache, unsigned long long *hits, unsigned long long *misses, size_t *entries);
+
+/*  FUNCTION: split_cache_close
+    INPUT:  cache, a cache or NULL.
+    OUTPUT: void
+
+    Frees the cache without saving it. The contexts using it must be closed first.
+*/
+SPLIT_API void split_cache_close(Split_cache *cache);
+
+/*  FUNCTION: split_set_cache
+    INPUT:  ctx, a context.
+            cache, a cache, NULL to stop using one.
+    OUTPUT: SPLIT_OK or SPLIT_ERR_NOMEM.
+
+    Every following line is looked up in the cache before being justified, the pages produced are the same.
+*/
+SPLIT_API Split_status split_set_cache(Split_ctx *ctx, Split_cache *cache);
+
+/*  FUNCTION: split_error
+    INPUT:  ctx, a context.
+    OUTPUT: a description of the last error, valid until the next call on the context.
+*/
+SPLIT_API const char *split_error(const Split_ctx *ctx);
+
+/*  FUNCTION: split_strerror
+    INPUT:  status, a code returned by the library.
+    OUTPUT: a description of the code.
+*/
+SPLIT_API const char *split_strerror(Split_status status);
+
+#endif
\ No newline at end of file
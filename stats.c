@@ -0,0 +1,142 @@
+#include "stats.h"
+
+static Proc_stats *table = NULL; // the counters of all the processes
+static int n_table = 0;          // the number of processes
+static pid_t owner;              // the first process, which writes the report
+static double start_wall;        // the start of the run
+
+static const char *stage_names[N_STAGES] = {"read", "layout", "output", "wait_read", "wait_write"};
+static const char *stage_labels[N_STAGES] = {"read/tokenize", "layout", "output", "blocked reading", "blocked writing"};
+
+/*  FUNCTION: stats_init
+    INPUT:  n_procs, the number of processes of the run.
+            names, the roles of the processes.
+    OUTPUT: void
+
+    The counters are placed in an anonymous shared mapping, so that they are inherited by the children created afterwards. If the mapping fails an error message is printed out and the program exits.
+*/
+void stats_init(int n_procs, const char *const names[])
+{
+    table = mmap(NULL, n_procs * sizeof(*table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+    {
+        perror("Error allocating the statistics");
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < n_procs; k++)
+        table[k].name = names[k];
+    n_table = n_procs;
+    owner = getpid();
+    start_wall = wall_now();
+    stats = &table[0];
+}
+
+/*  FUNCTION: stats_select
+    INPUT:  proc, the index of the current process.
+    OUTPUT: void
+*/
+void stats_select(int proc)
+{
+    if (stats != NULL)
+        stats = &table[proc];
+}
+
+/*  FUNCTION: stats_add
+    INPUT:  s, a stage.
+            t, the time measured by a thread.
+    OUTPUT: void
+*/
+void stats_add(Stage s, const Stage_time *t)
+{
+    if (stats == NULL)
+        return;
+    stats->stage[s].wall += t->wall;
+    stats->stage[s].cpu += t->cpu;
+}
+
+/*  FUNCTION: print_text
+    INPUT:  f, the stream to write to.
+    OUTPUT: void
+
+    Prints a table of the stages and the counters of each process. The blocked times are printed only when there is more than one process or a pipeline measured them.
+*/
+static void print_text(FILE *f)
+{
+    fprintf(f, "Statistics\n");
+    for (int k = 0; k < n_table; k++)
+    {
+        Proc_stats *p = &table[k];
+        fprintf(f, "process %s\n", p->name);
+        fprintf(f, "  %-16s %12s %12s\n", "stage", "wall (s)", "cpu (s)");
+        for (int s = 0; s < N_STAGES; s++)
+            if (s < STAGE_WAIT_READ || n_table > 1 || p->stage[s].wall > 0)
+                fprintf(f, "  %-16s %12.6f %12.6f\n", stage_labels[s], p->stage[s].wall, p->stage[s].cpu);
+        fprintf(f, "  %-16s %12.6f %12.6f\n", "total", p->wall, p->cpu);
+        fprintf(f, "  bytes in %llu, bytes out %llu, lines %llu, paragraphs %llu, pages %llu\n",
+                (unsigned long long)p->bytes_in, (unsigned long long)p->bytes_out, (unsigned long long)p->lines,
+                (unsigned long long)p->paragraphs, (unsigned long long)p->pages);
+        if (p->cache_hits + p->cache_misses > 0)
+            fprintf(f, "  cache hits %llu, cache misses %llu\n", (unsigned long long)p->cache_hits, (unsigned long long)p->cache_misses);
+        fprintf(f, "  allocations %llu, peak RSS %ld KB\n", (unsigned long long)p->allocs, p->peak_rss);
+    }
+}
+
+/*  FUNCTION: print_json
+    INPUT:  f, the stream to write to.
+    OUTPUT: void
+
+    Prints an object with an array of processes, each one with its stages (wall and cpu seconds) and its counters.
+*/
+static void print_json(FILE *f)
+{
+    fprintf(f, "{\"processes\": [");
+    for (int k = 0; k < n_table; k++)
+    {
+        Proc_stats *p = &table[k];
+        fprintf(f, "%s\n  {\"name\": \"%s\", \"stages\": {", k ? "," : "", p->name);
+        for (int s = 0; s < N_STAGES; s++)
+            fprintf(f, "%s\"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}", s ? ", " : "", stage_names[s], p->stage[s].wall, p->stage[s].cpu);
+        fprintf(f, "},\n   \"wall_s\": %.6f, \"cpu_s\": %.6f, \"bytes_in\": %llu, \"bytes_out\": %llu, \"lines\": %llu, \"paragraphs\": %llu, \"pages\": %llu, \"cache_hits\": %llu, \"cache_misses\": %llu, \"allocs\": %llu, \"peak_rss_kb\": %ld}",
+                p->wall, p->cpu, (unsigned long long)p->bytes_in, (unsigned long long)p->bytes_out, (unsigned long long)p->lines,
+                (unsigned long long)p->paragraphs, (unsigned long long)p->pages, (unsigned long long)p->cache_hits,
+                (unsigned long long)p->cache_misses, (unsigned long long)p->allocs, p->peak_rss);
+    }
+    fprintf(f, "\n]}\n");
+}
+
+/*  FUNCTION: stats_report
+    INPUT:  json_path, the file where the report is written as JSON, NULL to print it on stderr.
+    OUTPUT: void
+
+    The elapsed time, the CPU time of all the threads and the peak RSS of the current process are recorded. The first process waits for its children before getting here, so their counters are final when it writes the report. If the file cannot be written an error message is printed out and the program exits.
+*/
+void stats_report(const char *json_path)
+{
+    if (stats == NULL)
+        return;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    stats->wall = wall_now() - start_wall;
+    stats->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+    stats->peak_rss = ru.ru_maxrss;
+    if (getpid() != owner)
+        return;
+
+    if (json_path == NULL)
+    {
+        print_text(stderr);
+        return;
+    }
+    FILE *f = fopen(json_path, "w");
+    if (f == NULL)
+    {
+        perror(json_path);
+        exit(EXIT_FAILURE);
+    }
+    print_json(f);
+    if (fclose(f) == EOF)
+    {
+        perror(json_path);
+        exit(EXIT_FAILURE);
+    }
+}
\ No newline at end of file
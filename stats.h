@@ -0,0 +1,213 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+/*      The stages whose time is measured:
+        STAGE_READ - reading and tokenizing the input lines (read_one_line).
+        STAGE_LAYOUT - laying out the lines on the pages (process_one_line, or breaking and placing the rows with -j and -k).
+        STAGE_OUTPUT - writing the pages (write_one_page and the output buffer).
+        STAGE_WAIT_READ - blocked reading a channel (-m) or waiting for the previous stage of the pipeline (-p).
+        STAGE_WAIT_WRITE - blocked writing a channel (-m), also counted in the stage that writes, waiting for a free buffer of the pipeline (-p), or for the thread writing or compressing the output (-a, -z) when its buffers are all full.
+*/
+typedef enum Stage
+{
+    STAGE_READ,
+    STAGE_LAYOUT,
+    STAGE_OUTPUT,
+    STAGE_WAIT_READ,
+    STAGE_WAIT_WRITE,
+    N_STAGES
+} Stage;
+
+/*      The struct accumulates the time spent in a stage:
+        double wall - the elapsed time in seconds.
+        double cpu - the CPU time in seconds of the thread that measured it.
+
+        The start of a measure subtracts the current time and the end adds it, so no start time has to be kept.
+*/
+typedef struct Stage_time
+{
+    double wall;
+    double cpu;
+} Stage_time;
+
+/*      The struct contains the counters of a process:
+        const char *name - the role of the process.
+        Stage_time stage[] - the time spent in each stage.
+        uint64_t bytes_in, bytes_out - the bytes read from the input and given to the output buffer.
+        uint64_t lines, paragraphs, pages - the input lines (empty lines included), the paragraphs and the pages laid out (written, or only measured by --count-pages and before the range of --pages).
+        uint64_t cache_hits, cache_misses - the lines found in the cache of justified lines and the ones justified (-k).
+        _Atomic uint64_t allocs - the allocations and reallocations of the buffers (the threads of -j count them too).
+        bool in_par - whether the last line read belongs to a paragraph.
+        double wall, cpu - the elapsed time since the start and the CPU time of the whole process.
+        long peak_rss - the peak resident set size in KB.
+
+        The counters of all the processes live in memory shared between them, so that the first process can report the counters of its children.
+*/
+typedef struct Proc_stats
+{
+    const char *name;
+    Stage_time stage[N_STAGES];
+    uint64_t bytes_in, bytes_out;
+    uint64_t lines, paragraphs, pages;
+    uint64_t cache_hits, cache_misses;
+    _Atomic uint64_t allocs;
+    bool in_par;
+    double wall, cpu;
+    long peak_rss;
+} Proc_stats;
+
+extern Proc_stats *stats; // the counters of the current process, NULL when the statistics are disabled
+
+/*  FUNCTION: stats_init
+    INPUT:  n_procs, the number of processes of the run.
+            names, the roles of the processes.
+    OUTPUT: void
+
+    Enables the statistics: the counters of the processes are allocated in shared memory and the current process uses the first ones.
+*/
+void stats_init(int n_procs, const char *const names[]);
+
+/*  FUNCTION: stats_select
+    INPUT:  proc, the index of the current process.
+    OUTPUT: void
+
+    Called by a child process right after the fork, to count on its own counters.
+*/
+void stats_select(int proc);
+
+/*  FUNCTION: stats_report
+    INPUT:  json_path, the file where the report is written as JSON, NULL to print it on stderr.
+    OUTPUT: void
+
+    Records the totals of the current process; the first process, which ends after its children, also writes the report.
+*/
+void stats_report(const char *json_path);
+
+/*  FUNCTION: wall_now
+    INPUT:  void
+    OUTPUT: the time in seconds of the monotonic clock.
+*/
+double wall_now(void);
+
+/*  FUNCTION: stage_begin
+    INPUT:  t, the time of a stage.
+    OUTPUT: void
+*/
+void stage_begin(Stage_time *t);
+
+/*  FUNCTION: stage_end
+    INPUT:  t, the time of a stage.
+    OUTPUT: void
+*/
+void stage_end(Stage_time *t);
+
+/*  FUNCTION: stats_add
+    INPUT:  s, a stage.
+            t, the time measured by a thread.
+    OUTPUT: void
+
+    Adds the time measured by a thread to the counters of the process, the caller serialises the calls.
+*/
+void stats_add(Stage s, const Stage_time *t);
+
+/*  FUNCTION: counters_begin
+    INPUT:  p, the counters to update, NULL if none.
+            s, a stage.
+    OUTPUT: void
+
+    Starts measuring a stage on the given counters: libsplittext measures each context on its own counters (see split_set_stats).
+*/
+static inline void counters_begin(Proc_stats *p, Stage s)
+{
+    if (p != NULL)
+        stage_begin(&p->stage[s]);
+}
+
+/*  FUNCTION: counters_end
+    INPUT:  p, the counters to update, NULL if none.
+            s, a stage.
+    OUTPUT: void
+*/
+static inline void counters_end(Proc_stats *p, Stage s)
+{
+    if (p != NULL)
+        stage_end(&p->stage[s]);
+}
+
+/*  FUNCTION: counters_line
+    INPUT:  p, the counters to update, NULL if none.
+            linelen, the number of bytes of a raw input line.
+            n_words, the number of words of the line.
+    OUTPUT: void
+
+    Counts an input line. A paragraph starts with a line with words after an empty line (or at the beginning).
+*/
+static inline void counters_line(Proc_stats *p, size_t linelen, int n_words)
+{
+    if (p != NULL)
+    {
+        p->bytes_in += linelen;
+        p->lines++;
+        p->paragraphs += n_words > 0 && !p->in_par;
+        p->in_par = n_words > 0;
+    }
+}
+
+/*  FUNCTION: stats_begin
+    INPUT:  s, a stage.
+    OUTPUT: void
+
+    Starts measuring a stage of the current process, if the statistics are enabled.
+*/
+static inline void stats_begin(Stage s)
+{
+    counters_begin(stats, s);
+}
+
+/*  FUNCTION: stats_end
+    INPUT:  s, a stage.
+    OUTPUT: void
+
+    Stops measuring a stage of the current process, if the statistics are enabled.
+*/
+static inline void stats_end(Stage s)
+{
+    counters_end(stats, s);
+}
+
+/*  FUNCTION: stats_line
+    INPUT:  linelen, the number of bytes of a raw input line.
+            n_words, the number of words of the line.
+    OUTPUT: void
+
+    Counts an input line of the current process, if the statistics are enabled.
+*/
+static inline void stats_line(size_t linelen, int n_words)
+{
+    counters_line(stats, linelen, n_words);
+}
+
+/*  FUNCTION: stats_alloc
+    INPUT:  void
+    OUTPUT: void
+
+    Counts an allocation, if the statistics are enabled. It is called once the allocation has succeeded, so a failed one is not counted; the counter is atomic, since the threads of -j, -a and -p allocate too.
+*/
+static inline void stats_alloc(void)
+{
+    if (stats != NULL)
+        atomic_fetch_add_explicit(&stats->allocs, 1, memory_order_relaxed);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/*  Client of split_text --serve.
+
+    Reads a text from the standard input, sends it to the server as one request (or several, on the same connection, with -n) and writes the pages received on the standard output. The request is sent by a child process while the parent reads the reply, so a long text cannot fill both directions of the socket.
+*/
+
+/*  FUNCTION: read_all
+    INPUT:  f, a stream.
+            len, where the number of bytes read is stored.
+    OUTPUT: the whole content of the stream.
+
+    If the stream cannot be read an error message is printed out and the program exits.
+*/
+static char *read_all(FILE *f, size_t *len)
+{
+    size_t cap = 1 << 16, n = 0, got;
+    char *buf = malloc(cap);
+    while (buf != NULL && (got = fread(buf + n, 1, cap - n, f)) > 0)
+    {
+        n += got;
+        if (n == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    if (buf == NULL || ferror(f))
+    {
+        perror("Error reading the text");
+        exit(EXIT_FAILURE);
+    }
+    *len = n;
+    return buf;
+}
+
+/*  FUNCTION: write_all
+    INPUT:  fd, a descriptor.
+            data, the bytes to write.
+            n, the number of bytes.
+    OUTPUT: void
+
+    If the write fails an error message is printed out and the program exits.
+*/
+static void write_all(int fd, const char *data, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t w = write(fd, data, n);
+        if (w == -1)
+        {
+            perror("Error sending the request");
+            exit(EXIT_FAILURE);
+        }
+        data += w;
+        n -= w;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    char c_opt;
+    int n_cols = 3, n_rows = 47, col_width = 22, spacing = 10;
+    int n_requests = 1;
+
+    char help[] = "Usage: split_client [-c number] [-l number] [-w number] [-s number] [-n count] SOCKET < FILE\n\n"
+                  "-c, -l, -w, -s  The layout, as for split_text. Default to 3, 47, 22, 10\n"
+                  "-n count  Send the text count times on the same connection. Defaults to 1\n";
+
+    while ((c_opt = getopt(argc, argv, "hc:l:w:s:n:")) != -1)
+        switch (c_opt)
+        {
+        case 'c':
+            n_cols = atoi(optarg);
+            break;
+        case 'l':
+            n_rows = atoi(optarg);
+            break;
+        case 'w':
+            col_width = atoi(optarg);
+            break;
+        case 's':
+            spacing = atoi(optarg);
+            break;
+        case 'n':
+            n_requests = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s", help);
+            exit(c_opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    if (optind != argc - 1 || n_requests < 1)
+    {
+        fprintf(stderr, "%s", help);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t len;
+    char *text = read_all(stdin, &len);
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, argv[optind], sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror(argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0)
+    { // send the requests, then tell the server that there are no more
+        char header[128];
+        int n = snprintf(header, sizeof(header), "%d %d %d %d %zu\n", n_cols, n_rows, col_width, spacing, len);
+        for (int r = 0; r < n_requests; r++)
+        {
+            write_all(fd, header, n);
+            write_all(fd, text, len);
+        }
+        shutdown(fd, SHUT_WR);
+        _exit(EXIT_SUCCESS);
+    }
+
+    // read a reply for each request
+    FILE *in = fdopen(fd, "r");
+    char line[4096];
+    char *page = NULL;
+    size_t page_cap = 0;
+    int status = EXIT_SUCCESS;
+    for (int r = 0; r < n_requests && in != NULL;)
+    {
+        if (fgets(line, sizeof(line), in) == NULL)
+        {
+            fprintf(stderr, "Error: the server closed the connection.\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        size_t n;
+        if (sscanf(line, "P %zu", &n) == 1)
+        {
+            if (n > page_cap)
+                page = realloc(page, page_cap = n);
+            if ((n > 0 && page == NULL) || fread(page, 1, n, in) != n)
+            {
+                fprintf(stderr, "Error: the reply is truncated.\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+            fwrite(page, 1, n, stdout);
+        }
+        else if (strcmp(line, "OK\n") == 0)
+        {
+            r++;
+        }
+        else
+        {
+            fprintf(stderr, "%s", line); // ERR message
+            status = EXIT_FAILURE;
+            r++;
+        }
+    }
+    waitpid(pid, NULL, 0);
+    free(page);
+    free(text);
+    return status;
+}
\ No newline at end of file
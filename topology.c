@@ -0,0 +1,186 @@
+#include "topology.h"
+
+static const char stage_letters[N_MP_STAGES] = {'r', 'l', 'w'};
+static const char *const stage_roles[N_MP_STAGES] = {"reader", "formatter", "writer"};
+
+/*  FUNCTION: parse_topology
+    INPUT:  t, the topology to set.
+            spec, the stages r (read and tokenize), l (layout) and w (write) in this order, the processes separated by commas (r,l,w, rl,w or r,lw).
+    OUTPUT: the number of processes, -1 if spec is not valid (t is left as it was).
+
+    Every stage must appear once, in order, and there must be at least two processes: a single one is the single-process version.
+*/
+int parse_topology(Mp_topology *t, const char *spec)
+{
+    int proc_of[N_MP_STAGES];
+    int stage = 0, proc = 0;
+    bool empty = true; // whether the current process has no stage yet
+    for (const char *p = spec; *p != '\0'; p++)
+    {
+        if (*p == ',')
+        {
+            if (empty)
+                return -1;
+            proc++;
+            empty = true;
+        }
+        else if (stage < N_MP_STAGES && *p == stage_letters[stage])
+        {
+            proc_of[stage++] = proc;
+            empty = false;
+        }
+        else
+            return -1;
+    }
+    if (stage < N_MP_STAGES || empty || proc == 0)
+        return -1;
+
+    t->n_procs = proc + 1;
+    memcpy(t->proc_of, proc_of, sizeof(proc_of));
+    strcpy(t->spec, spec); // at most the three stages and two commas
+    for (proc = 0; proc < t->n_procs; proc++)
+        t->names[proc][0] = '\0';
+    for (stage = 0; stage < N_MP_STAGES; stage++)
+    {
+        char *name = t->names[proc_of[stage]];
+        if (name[0] != '\0')
+            strcat(name, "+");
+        strcat(name, stage_roles[stage]);
+    }
+    return t->n_procs;
+}
+
+/*  FUNCTION: cpu_list
+    INPUT:  list, a CPU list (numbers and ranges separated by commas) ending at len.
+            len, the length of the list.
+            set, where the CPUs are stored.
+    OUTPUT: 0 on success, -1 if the list is not valid.
+*/
+static int cpu_list(const char *list, size_t len, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    const char *p = list, *end = list + len;
+    if (p == end)
+        return -1;
+    while (p < end)
+    {
+        char *q;
+        errno = 0;
+        unsigned long first = strtoul(p, &q, 10), last = first;
+        if (q == p || errno != 0)
+            return -1;
+        p = q;
+        if (p < end && *p == '-')
+        {
+            last = strtoul(++p, &q, 10);
+            if (q == p || errno != 0)
+                return -1;
+            p = q;
+        }
+        if (first > last || last >= CPU_SETSIZE)
+            return -1;
+        for (unsigned long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        if (p < end && (*p != ',' || ++p == end))
+            return -1;
+    }
+    return 0;
+}
+
+/*  FUNCTION: parse_cpus
+    INPUT:  t, the topology to set.
+            spec, one CPU list per process (numbers and ranges separated by commas, as 0-3,8), the processes separated by colons.
+    OUTPUT: the number of lists, -1 if spec is not valid (t is left as it was).
+
+    The lists are only checked here, the processes parse them again when they pin themselves. Whether there is one list per process is checked by the caller, since the topology may be given afterwards.
+*/
+int parse_cpus(Mp_topology *t, const char *spec)
+{
+    char cpus[MP_MAX_PROCS][MP_CPUS_LEN];
+    int n = 0;
+    const char *p = spec;
+    for (;;)
+    {
+        const char *end = strchr(p, ':');
+        size_t len = end != NULL ? (size_t)(end - p) : strlen(p);
+        cpu_set_t set;
+        if (n == MP_MAX_PROCS || len >= MP_CPUS_LEN || cpu_list(p, len, &set) == -1)
+            return -1;
+        memcpy(cpus[n], p, len);
+        cpus[n++][len] = '\0';
+        if (end == NULL)
+            break;
+        p = end + 1;
+    }
+    memset(t->cpus, 0, sizeof(t->cpus));
+    memcpy(t->cpus, cpus, n * sizeof(*cpus));
+    return n;
+}
+
+/*  FUNCTION: parse_pipe_size
+    INPUT:  t, the topology to set.
+            spec, a number of bytes, optionally followed by K or M.
+    OUTPUT: 0 on success, -1 if spec is not valid or too large (t is left as it was).
+*/
+int parse_pipe_size(Mp_topology *t, const char *spec)
+{
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(spec, &end, 10);
+    if (end == spec || errno != 0 || *spec == '-')
+        return -1;
+    unsigned long unit = 1;
+    if (*end == 'K' || *end == 'k')
+        unit = 1 << 10;
+    else if (*end == 'M' || *end == 'm')
+        unit = 1 << 20;
+    if (unit > 1)
+        end++;
+    if (*end != '\0' || n < 1 || n > INT32_MAX / unit)
+        return -1;
+    n *= unit;
+    t->pipe_size = (int)n;
+    return 0;
+}
+
+/*  FUNCTION: pin_process
+    INPUT:  t, a topology.
+            proc, the index of the calling process.
+    OUTPUT: void
+
+    Pins the calling process to its CPUs, if it has any, so that the threads it starts afterwards run on them too. If the CPUs cannot be used an error message is printed out and the program exits.
+*/
+void pin_process(const Mp_topology *t, int proc)
+{
+    const char *list = t->cpus[proc];
+    if (list[0] == '\0')
+        return;
+    cpu_set_t set;
+    cpu_list(list, strlen(list), &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+        fprintf(stderr, "Error pinning the %s to the CPUs %s: %s\n", t->names[proc], list, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*  FUNCTION: print_topology
+    INPUT:  f, the stream to write to.
+            t, a topology.
+            ch, the first channel, already opened.
+    OUTPUT: void
+
+    Prints the processes with their stages and CPUs, and the kind and capacity of the channels.
+*/
+void print_topology(FILE *f, const Mp_topology *t, const Channel *ch)
+{
+    fprintf(f, "Processes: %d (%s)\n", t->n_procs, t->spec);
+    for (int proc = 0; proc < t->n_procs; proc++)
+    {
+        if (t->cpus[proc][0] != '\0')
+            fprintf(f, "Process %d, %s: CPUs %s\n", proc + 1, t->names[proc], t->cpus[proc]);
+        else
+            fprintf(f, "Process %d, %s: not pinned\n", proc + 1, t->names[proc]);
+    }
+    fprintf(f, "Channels: %s of %zu bytes\n", ch->type == CHAN_SHM ? "shared-memory rings" : "pipes", ch->cap);
+}
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define _GNU_SOURCE // sched_setaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
+#include "channel.h"
+
+#define MP_MAX_PROCS 3  // at most one process per stage
+#define MP_NAME_LEN 32  // room for the name of a process, e.g. "reader+formatter"
+#define MP_CPUS_LEN 128 // room for the CPU list of a process
+
+/*      The stages of the multi-process version:
+        MP_READ - reading and tokenizing the input lines.
+        MP_LAYOUT - laying out the lines on the pages.
+        MP_WRITE - writing the pages.
+*/
+typedef enum Mp_stage
+{
+    MP_READ,
+    MP_LAYOUT,
+    MP_WRITE,
+    N_MP_STAGES
+} Mp_stage;
+
+/*      The struct contains how the stages of -m are placed on processes and CPUs:
+        int n_procs - the number of processes, each one forks the next and is connected to it by a channel.
+        int proc_of[] - the process running each stage.
+        char spec[] - the processes as given to --topology, e.g. "rl,w".
+        char names[][] - the role of each process, as reported by -P.
+        char cpus[][] - the CPUs each process is pinned to (a list as 0-3,8), empty if it is not pinned.
+        Chan_type transport - the kind of the channels.
+        int pipe_size - the capacity of the pipes, 0 for the default of the system.
+*/
+typedef struct Mp_topology
+{
+    int n_procs;
+    int proc_of[N_MP_STAGES];
+    char spec[2 * N_MP_STAGES];
+    char names[MP_MAX_PROCS][MP_NAME_LEN];
+    char cpus[MP_MAX_PROCS][MP_CPUS_LEN];
+    Chan_type transport;
+    int pipe_size;
+} Mp_topology;
+
+/*  FUNCTION: parse_topology
+    INPUT:  t, the topology to set.
+            spec, the stages r (read and tokenize), l (layout) and w (write) in this order, the processes separated by commas (r,l,w, rl,w or r,lw).
+    OUTPUT: the number of processes, -1 if spec is not valid (t is left as it was).
+
+    The CPUs, the transport and the capacity of the pipes are not changed.
+*/
+int parse_topology(Mp_topology *t, const char *spec);
+
+/*  FUNCTION: parse_cpus
+    INPUT:  t, the topology to set.
+            spec, one CPU list per process (numbers and ranges separated by commas, as 0-3,8), the processes separated by colons.
+    OUTPUT: the number of lists, -1 if spec is not valid (t is left as it was).
+*/
+int parse_cpus(Mp_topology *t, const char *spec);
+
+/*  FUNCTION: parse_pipe_size
+    INPUT:  t, the topology to set.
+            spec, a number of bytes, optionally followed by K or M.
+    OUTPUT: 0 on success, -1 if spec is not valid or too large (t is left as it was).
+*/
+int parse_pipe_size(Mp_topology *t, const char *spec);
+
+/*  FUNCTION: pin_process
+    INPUT:  t, a topology.
+            proc, the index of the calling process.
+    OUTPUT: void
+
+    Pins the calling process to its CPUs, if it has any, so that the threads it starts afterwards run on them too. If the CPUs cannot be used an error message is printed out and the program exits.
+*/
+void pin_process(const Mp_topology *t, int proc);
+
+/*  FUNCTION: print_topology
+    INPUT:  f, the stream to write to.
+            t, a topology.
+            ch, the first channel, already opened.
+    OUTPUT: void
+
+    Prints the processes with their stages and CPUs, and the kind and capacity of the channels.
+*/
+void print_topology(FILE *f, const Mp_topology *t, const Channel *ch);
+
+#endif
\ No newline at end of file